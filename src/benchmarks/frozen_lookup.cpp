@@ -0,0 +1,61 @@
+// Lookups per second on one PersistentMap version against the FrozenMap copy made by freeze(),
+// for random hits and misses.
+// Usage: frozen_lookup [keys = 1000000] [lookups = 10000000]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include "../persistent_map.hpp"
+
+// Keys are drawn up front so that both structures see the same sequence and the generator is not timed
+template <class Find>
+static double rate(const std::vector<int>& keys, Find find, size_t& found) {
+    auto start = std::chrono::steady_clock::now();
+    size_t hits = 0;
+    for (auto key : keys) {
+        hits += find(key);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    found = hits;
+    return keys.size() / seconds / 1e6;
+}
+
+int main(int argc, char** argv) {
+    int keys = argc > 1 ? std::atoi(argv[1]) : 1000000;
+    size_t lookups = argc > 2 ? std::atoll(argv[2]) : 10000000;
+
+    PersistentMap<int, int> map;
+    size_t version = 0;
+    {
+        auto batch = map.batch(0);
+        for (int key = 0; key < keys; ++key) {
+            batch.insert(std::make_pair(2 * key, key));
+        }
+        version = batch.publish();
+    }
+    auto frozen = map.freeze(version);
+
+    // half of the keys miss, odd keys are never inserted
+    std::mt19937 random(7);
+    std::vector<int> sequence(lookups);
+    for (auto& key : sequence) {
+        key = random() % (2 * keys);
+    }
+
+    size_t mapFound = 0, frozenFound = 0;
+    double mapRate = rate(sequence, [&](const int key) {
+        return map.find(version, key) != map.end();
+    }, mapFound);
+    double frozenRate = rate(sequence, [&](const int key) {
+        return frozen.find(key) != frozen.end();
+    }, frozenFound);
+
+    if (mapFound != frozenFound) {
+        std::fprintf(stderr, "found %zu keys in the map but %zu in the frozen copy\n", mapFound, frozenFound);
+        return 1;
+    }
+    std::printf("%d keys, Mlookups/s: PersistentMap %.2f, FrozenMap %.2f, %.1fx\n",
+                keys, mapRate, frozenRate, frozenRate / mapRate);
+    return 0;
+}
@@ -0,0 +1,41 @@
+// Inserts per second into the newest version of a PersistentIndexedMap against a plain PersistentMap,
+// at doubling sizes: the ratio between the two should stay flat as the maps grow.
+// Usage: indexed_inserts [largest size = 80000]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include "../persistent_map.hpp"
+#include "../persistent_indexed_map.hpp"
+
+template <class Insert>
+static double rate(const int inserts, Insert insert) {
+    auto start = std::chrono::steady_clock::now();
+    for (int key = 0; key < inserts; ++key) {
+        insert(key);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return inserts / seconds / 1e6;
+}
+
+int main(int argc, char** argv) {
+    int largest = argc > 1 ? std::atoi(argv[1]) : 80000;
+
+    for (int inserts = largest / 8; inserts <= largest; inserts *= 2) {
+        PersistentMap<int, int> map;
+        double mapRate = rate(inserts, [&](const int key) {
+            map.insert(key, std::make_pair(key, key % 97));
+        });
+        PersistentIndexedMap<int, int> indexed;
+        double indexedRate = rate(inserts, [&](const int key) {
+            indexed.insert(key, std::make_pair(key, key % 97));
+        });
+        if (indexed.size(inserts) != map.size(inserts)) {
+            std::fprintf(stderr, "%zu keys in the indexed map but %zu in the map\n",
+                         indexed.size(inserts), map.size(inserts));
+            return 1;
+        }
+        std::printf("%d inserts, Minserts/s: PersistentMap %.3f, PersistentIndexedMap %.3f, %.1fx slower\n",
+                    inserts, mapRate, indexedRate, mapRate / indexedRate);
+    }
+    return 0;
+}
@@ -0,0 +1,110 @@
+// Writes per second of std::string and std::vector payloads passed by const reference, moved in or emplaced,
+// for PersistentVector::Batch::push_back, PersistentList::push_front and PersistentMap inserts.
+// Usage: move_writes [writes = 200000] [payload elements = 256]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+#include "../persistent_list.hpp"
+#include "../persistent_map.hpp"
+#include "../persistent_vector.hpp"
+
+// Each write builds a fresh payload of 'elements' elements, as a caller producing new values would
+template <class Write, class Finish>
+static double rate(const size_t writes, Write write, Finish finish) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < writes; ++i) {
+        write(i);
+    }
+    finish();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return writes / seconds / 1e6;
+}
+
+template <class Payload>
+static void run(const char* name, const size_t writes, const size_t elements, const typename Payload::value_type fill) {
+    // one version per push_back would time the version history rather than the payloads, so the
+    // vector takes every write in one batch and publishes it
+    double vectorCopy = 0, vectorMove = 0, vectorEmplace = 0;
+    {
+        PersistentVector<Payload> vector;
+        auto batch = vector.batch(0);
+        vectorCopy = rate(writes, [&](const size_t) {
+            Payload payload(elements, fill);
+            batch.push_back(payload);
+        }, [&]() { batch.publish(); });
+    }
+    {
+        PersistentVector<Payload> vector;
+        auto batch = vector.batch(0);
+        vectorMove = rate(writes, [&](const size_t) {
+            Payload payload(elements, fill);
+            batch.push_back(std::move(payload));
+        }, [&]() { batch.publish(); });
+    }
+    {
+        PersistentVector<Payload> vector;
+        auto batch = vector.batch(0);
+        vectorEmplace = rate(writes, [&](const size_t) {
+            batch.emplace_back(elements, fill);
+        }, [&]() { batch.publish(); });
+    }
+
+    double listCopy = 0, listMove = 0, listEmplace = 0;
+    {
+        PersistentList<Payload> list;
+        listCopy = rate(writes, [&](const size_t i) {
+            Payload payload(elements, fill);
+            list.push_front(i, payload);
+        }, []() {});
+    }
+    {
+        PersistentList<Payload> list;
+        listMove = rate(writes, [&](const size_t i) {
+            Payload payload(elements, fill);
+            list.push_front(i, std::move(payload));
+        }, []() {});
+    }
+    {
+        PersistentList<Payload> list;
+        listEmplace = rate(writes, [&](const size_t i) {
+            list.emplace_front(i, elements, fill);
+        }, []() {});
+    }
+
+    double mapCopy = 0, mapMove = 0, mapEmplace = 0;
+    {
+        PersistentMap<size_t, Payload> map;
+        mapCopy = rate(writes, [&](const size_t i) {
+            std::pair<const size_t, Payload> pair(i, Payload(elements, fill));
+            map.insert(i, pair);
+        }, []() {});
+    }
+    {
+        PersistentMap<size_t, Payload> map;
+        mapMove = rate(writes, [&](const size_t i) {
+            map.insert(i, std::pair<const size_t, Payload>(i, Payload(elements, fill)));
+        }, []() {});
+    }
+    {
+        PersistentMap<size_t, Payload> map;
+        mapEmplace = rate(writes, [&](const size_t i) {
+            map.try_emplace(i, i, elements, fill);
+        }, []() {});
+    }
+
+    std::printf("%-12s  vector %6.2f %6.2f %6.2f   list %6.2f %6.2f %6.2f   map %6.2f %6.2f %6.2f\n", name,
+                vectorCopy, vectorMove, vectorEmplace, listCopy, listMove, listEmplace, mapCopy, mapMove, mapEmplace);
+}
+
+int main(int argc, char** argv) {
+    size_t writes = argc > 1 ? std::atoll(argv[1]) : 200000;
+    size_t elements = argc > 2 ? std::atoll(argv[2]) : 256;
+
+    std::printf("Mwrites/s, const& / move / emplace\n");
+    run<std::string>("string", writes, elements, 'x');
+    run<std::vector<int> >("vector<int>", writes, elements, 1);
+    return 0;
+}
@@ -0,0 +1,58 @@
+// Lookups per second on one PersistentMap version for 1..N reader threads.
+// Usage: read_scaling [max threads = 64] [keys = 1000000] [lookups per thread = 2000000]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <vector>
+#include "../epoch.hpp"
+#include "../persistent_map.hpp"
+
+static void readKeys(const PersistentMap<int, int>& map, const size_t version, const int keys, const size_t lookups,
+                     const unsigned seed, size_t& found) {
+    std::mt19937 random(seed);
+    size_t hits = 0;
+    for (size_t done = 0; done < lookups; ) {
+        // one pin per block of lookups, as a request handler would do
+        EpochReclaimer::Guard guard;
+        for (size_t i = 0; i < 1024 && done < lookups; ++i, ++done) {
+            hits += map.find(version, random() % (2 * keys)) != map.end();
+        }
+    }
+    found = hits;
+}
+
+int main(int argc, char** argv) {
+    size_t maxThreads = argc > 1 ? std::atoi(argv[1]) : 64;
+    int keys = argc > 2 ? std::atoi(argv[2]) : 1000000;
+    size_t lookups = argc > 3 ? std::atoll(argv[3]) : 2000000;
+
+    PersistentMap<int, int> map;
+    size_t version = 0;
+    {
+        auto batch = map.batch(0);
+        for (int key = 0; key < keys; key += 1) {
+            batch.insert(std::make_pair(2 * key, key));
+        }
+        version = batch.publish();
+    }
+
+    std::printf("threads  Mlookups/s  per thread\n");
+    for (size_t threads = 1; threads <= maxThreads; threads *= 2) {
+        std::vector<std::thread> readers;
+        std::vector<size_t> found(threads);
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < threads; ++i) {
+            readers.push_back(std::thread(readKeys, std::cref(map), version, keys, lookups, (unsigned)i,
+                                          std::ref(found[i])));
+        }
+        for (auto& reader : readers) {
+            reader.join();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double rate = threads * lookups / seconds / 1e6;
+        std::printf("%7zu  %10.2f  %10.2f\n", threads, rate, rate / threads);
+    }
+    return 0;
+}
@@ -0,0 +1,63 @@
+// Records per second shipped from a primary process to a replica process over a Unix socket, and the
+// replica's lag, for a stream of PersistentMap inserts.
+// Usage: replication_throughput [records = 1000000] [batch bytes = 65536]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../replication.hpp"
+
+static void runReplica(const int fd) {
+    PersistentMap<int, int> map;
+    ReplicaApplier replica(fd);
+    replica.attach(map);
+    auto start = std::chrono::steady_clock::now();
+    bool first = true;
+    while (replica.apply()) {
+        if (first) {
+            start = std::chrono::steady_clock::now();
+            first = false;
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::printf("replica: %llu records in %llu batches, %.2f Mrecords/s applied, lag last %.3f ms, max %.3f ms\n",
+                (unsigned long long)replica.sequence(), (unsigned long long)replica.batches(),
+                replica.sequence() / seconds / 1e6, replica.lastLag() / 1e6, replica.maxLag() / 1e6);
+}
+
+int main(int argc, char** argv) {
+    size_t records = argc > 1 ? std::atoll(argv[1]) : 1000000;
+    size_t batchBytes = argc > 2 ? std::atoll(argv[2]) : ReplicationLog::DEFAULT_BATCH_BYTES;
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        std::perror("socketpair");
+        return 1;
+    }
+    pid_t child = fork();
+    if (child == 0) {
+        close(fds[0]);
+        runReplica(fds[1]);
+        return 0;
+    }
+    close(fds[1]);
+
+    PersistentMap<int, int> map;
+    ReplicationLog log(fds[0], batchBytes);
+    log.attach(map);
+    std::mt19937 random(1);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t version = 0; version < records; ++version) {
+        log.insert(map, version, std::make_pair((int)random(), (int)version));
+    }
+    log.flush();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    close(fds[0]);
+    std::printf("primary: %zu records, %.2f Mrecords/s applied and shipped\n", records, records / seconds / 1e6);
+    std::fflush(stdout);
+    waitpid(child, nullptr, 0);
+    return 0;
+}
@@ -0,0 +1,52 @@
+// Versions created per second by 1..N writer threads, each writing its own PersistentMap, with the
+// default allocator and with NodeAllocator.
+// Usage: write_scaling [max threads = 64] [inserts per thread = 200000]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <thread>
+#include <vector>
+#include "../node_arena.hpp"
+#include "../persistent_map.hpp"
+
+template <class Map>
+static void writeKeys(const size_t inserts, const unsigned seed) {
+    std::mt19937 random(seed);
+    // maps of ROUND versions are dropped and rebuilt, so that nodes are freed as well as allocated
+    const size_t ROUND = 4096;
+    for (size_t done = 0; done < inserts; ) {
+        Map map;
+        for (size_t version = 0; version < ROUND && done < inserts; ++version, ++done) {
+            map.insert(version, std::make_pair((int)random(), (int)version));
+        }
+    }
+}
+
+template <class Map>
+static double run(const size_t threads, const size_t inserts) {
+    std::vector<std::thread> writers;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < threads; ++i) {
+        writers.push_back(std::thread(writeKeys<Map>, inserts, (unsigned)i));
+    }
+    for (auto& writer : writers) {
+        writer.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return threads * inserts / seconds / 1e6;
+}
+
+int main(int argc, char** argv) {
+    size_t maxThreads = argc > 1 ? std::atoi(argv[1]) : 64;
+    size_t inserts = argc > 2 ? std::atoll(argv[2]) : 200000;
+
+    std::printf("threads  std::allocator Mversions/s  NodeAllocator Mversions/s\n");
+    for (size_t threads = 1; threads <= maxThreads; threads *= 2) {
+        double standard = run<PersistentMap<int, int> >(threads, inserts);
+        double arena = run<PersistentMap<int, int, std::less<int>, NodeAllocator<int> > >(threads, inserts);
+        std::printf("%7zu  %26.2f  %25.2f\n", threads, standard, arena);
+    }
+    return 0;
+}
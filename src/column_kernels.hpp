@@ -0,0 +1,193 @@
+#ifndef COLUMN_KERNELS_HPP
+#define COLUMN_KERNELS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/* Aggregate and filter kernels over a contiguous column. The overloads for int32_t, int64_t and double
+ * use AVX2 or SSE2 when the compiler targets them; everything else, and the tails that don't fill
+ * a register, goes through the scalar templates. */
+
+// Type the sum of a column is accumulated in
+template <class T>
+struct ColumnSum {
+    typedef T type;
+};
+template <>
+struct ColumnSum<int32_t> {
+    typedef int64_t type;
+};
+
+template <class T>
+typename ColumnSum<T>::type columnSum(const T* data, const size_t size) {
+    typename ColumnSum<T>::type sum = typename ColumnSum<T>::type();
+    for (size_t i = 0; i < size; ++i) {
+        sum += data[i];
+    }
+    return sum;
+}
+
+// Appends 'offset' + i for every i such that low <= data[i] <= high
+template <class T>
+void columnFilter(const T* data, const size_t size, const T& low, const T& high, std::vector<size_t>& rows,
+                  const size_t offset = 0) {
+    for (size_t i = 0; i < size; ++i) {
+        if (!(data[i] < low) && !(high < data[i])) {
+            rows.push_back(offset + i);
+        }
+    }
+}
+
+#if defined(__AVX2__) || defined(__SSE2__)
+
+inline void _columnPushMask(unsigned mask, const size_t base, std::vector<size_t>& rows) {
+    while (mask) {
+        rows.push_back(base + __builtin_ctz(mask));
+        mask &= mask - 1;
+    }
+}
+
+inline int64_t columnSum(const int32_t* data, const size_t size) {
+    size_t i = 0;
+#ifdef __AVX2__
+    __m256i sum = _mm256_setzero_si256();
+    for (; i + 8 <= size; i += 8) {
+        __m256i values = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        sum = _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(values)));
+        sum = _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(values, 1)));
+    }
+    int64_t lanes[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), sum);
+    int64_t total = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#else
+    __m128i sum = _mm_setzero_si128();
+    for (; i + 4 <= size; i += 4) {
+        __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        // sign-extend to 64 bits by interleaving with the sign masks
+        __m128i signs = _mm_srai_epi32(values, 31);
+        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(values, signs));
+        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(values, signs));
+    }
+    int64_t lanes[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), sum);
+    int64_t total = lanes[0] + lanes[1];
+#endif
+    return total + columnSum<int32_t>(data + i, size - i);
+}
+
+inline int64_t columnSum(const int64_t* data, const size_t size) {
+    size_t i = 0;
+#ifdef __AVX2__
+    __m256i sum = _mm256_setzero_si256();
+    for (; i + 4 <= size; i += 4) {
+        sum = _mm256_add_epi64(sum, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i)));
+    }
+    int64_t lanes[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), sum);
+    int64_t total = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#else
+    __m128i sum = _mm_setzero_si128();
+    for (; i + 2 <= size; i += 2) {
+        sum = _mm_add_epi64(sum, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)));
+    }
+    int64_t lanes[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), sum);
+    int64_t total = lanes[0] + lanes[1];
+#endif
+    return total + columnSum<int64_t>(data + i, size - i);
+}
+
+// Lanes are summed separately, so the result may differ from the scalar order in the last bits
+inline double columnSum(const double* data, const size_t size) {
+    size_t i = 0;
+#ifdef __AVX2__
+    __m256d sum = _mm256_setzero_pd();
+    for (; i + 4 <= size; i += 4) {
+        sum = _mm256_add_pd(sum, _mm256_loadu_pd(data + i));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, sum);
+    double total = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#else
+    __m128d sum = _mm_setzero_pd();
+    for (; i + 2 <= size; i += 2) {
+        sum = _mm_add_pd(sum, _mm_loadu_pd(data + i));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, sum);
+    double total = lanes[0] + lanes[1];
+#endif
+    return total + columnSum<double>(data + i, size - i);
+}
+
+inline void columnFilter(const int32_t* data, const size_t size, const int32_t& low, const int32_t& high,
+                         std::vector<size_t>& rows, const size_t offset = 0) {
+    size_t i = 0;
+#ifdef __AVX2__
+    __m256i lows = _mm256_set1_epi32(low);
+    __m256i highs = _mm256_set1_epi32(high);
+    for (; i + 8 <= size; i += 8) {
+        __m256i values = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        __m256i outside = _mm256_or_si256(_mm256_cmpgt_epi32(lows, values), _mm256_cmpgt_epi32(values, highs));
+        _columnPushMask(~_mm256_movemask_ps(_mm256_castsi256_ps(outside)) & 0xff, offset + i, rows);
+    }
+#else
+    __m128i lows = _mm_set1_epi32(low);
+    __m128i highs = _mm_set1_epi32(high);
+    for (; i + 4 <= size; i += 4) {
+        __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i outside = _mm_or_si128(_mm_cmplt_epi32(values, lows), _mm_cmpgt_epi32(values, highs));
+        _columnPushMask(~_mm_movemask_ps(_mm_castsi128_ps(outside)) & 0xf, offset + i, rows);
+    }
+#endif
+    columnFilter<int32_t>(data + i, size - i, low, high, rows, offset + i);
+}
+
+#ifdef __AVX2__
+inline void columnFilter(const int64_t* data, const size_t size, const int64_t& low, const int64_t& high,
+                         std::vector<size_t>& rows, const size_t offset = 0) {
+    size_t i = 0;
+    __m256i lows = _mm256_set1_epi64x(low);
+    __m256i highs = _mm256_set1_epi64x(high);
+    for (; i + 4 <= size; i += 4) {
+        __m256i values = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        __m256i outside = _mm256_or_si256(_mm256_cmpgt_epi64(lows, values), _mm256_cmpgt_epi64(values, highs));
+        _columnPushMask(~_mm256_movemask_pd(_mm256_castsi256_pd(outside)) & 0xf, offset + i, rows);
+    }
+    columnFilter<int64_t>(data + i, size - i, low, high, rows, offset + i);
+}
+#endif
+
+// NaN never passes the filter, as with the scalar comparisons
+inline void columnFilter(const double* data, const size_t size, const double& low, const double& high,
+                         std::vector<size_t>& rows, const size_t offset = 0) {
+    size_t i = 0;
+#ifdef __AVX2__
+    __m256d lows = _mm256_set1_pd(low);
+    __m256d highs = _mm256_set1_pd(high);
+    for (; i + 4 <= size; i += 4) {
+        __m256d values = _mm256_loadu_pd(data + i);
+        __m256d inside = _mm256_and_pd(_mm256_cmp_pd(values, lows, _CMP_GE_OQ),
+                                       _mm256_cmp_pd(values, highs, _CMP_LE_OQ));
+        _columnPushMask(_mm256_movemask_pd(inside), offset + i, rows);
+    }
+#else
+    __m128d lows = _mm_set1_pd(low);
+    __m128d highs = _mm_set1_pd(high);
+    for (; i + 2 <= size; i += 2) {
+        __m128d values = _mm_loadu_pd(data + i);
+        __m128d inside = _mm_and_pd(_mm_cmpge_pd(values, lows), _mm_cmple_pd(values, highs));
+        _columnPushMask(_mm_movemask_pd(inside), offset + i, rows);
+    }
+#endif
+    columnFilter<double>(data + i, size - i, low, high, rows, offset + i);
+}
+
+#endif // __AVX2__ || __SSE2__
+
+#endif // COLUMN_KERNELS_HPP
@@ -0,0 +1,159 @@
+#ifndef EPOCH_HPP
+#define EPOCH_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+/* Epoch-based reclamation shared by all containers. A reading thread holds a Guard while it walks
+ * nodes through raw pointers; containers retire() what they drop instead of releasing it, and a
+ * retired object is released only once every thread that was inside a Guard at the time has left it.
+ * Entering and leaving a Guard touch only the thread's own cache line. */
+class EpochReclaimer {
+private:
+    struct alignas(64) Slot {
+        // epoch the thread entered its outermost guard in, 0 outside guards
+        std::atomic<uint64_t> pinned;
+        std::atomic<bool> used;
+        size_t depth;
+
+        Slot() : pinned(0), used(false), depth(0)
+        {}
+    };
+
+    struct Retired {
+        uint64_t epoch;
+        std::shared_ptr<const void> object;
+    };
+
+    static const size_t MAX_THREADS = 256;
+
+    struct Domain {
+        std::atomic<uint64_t> epoch;
+        Slot slots[MAX_THREADS];
+        std::mutex mutex;
+        std::vector<Retired> retired;
+
+        Domain() : epoch(1)
+        {}
+    };
+
+    // Releases the slot when its thread exits
+    struct ThreadSlot {
+        Slot* slot;
+
+        ThreadSlot() : slot(nullptr)
+        {}
+        ~ThreadSlot() {
+            if (slot) {
+                slot->used.store(false, std::memory_order_release);
+            }
+        }
+    };
+
+public:
+    /* Pins the calling thread: nothing retired after the guard was entered is released before it is
+     * left. Guards nest; only the outermost one pins. */
+    class Guard {
+    public:
+        Guard() : _slot(_threadSlot()) {
+            if (_slot->depth++ == 0) {
+                _slot->pinned.store(_domain().epoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                // the pin must be visible before any node is read, see _collect
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+            }
+        }
+        ~Guard() {
+            if (--_slot->depth == 0) {
+                _slot->pinned.store(0, std::memory_order_release);
+            }
+        }
+        Guard(const Guard& other) = delete;
+        Guard& operator=(const Guard& other) = delete;
+
+    private:
+        Slot* _slot;
+    };
+
+    // 'object' must already be unreachable for readers entering a guard from now on
+    static void retire(std::shared_ptr<const void> object) {
+        Domain& domain = _domain();
+        std::vector<Retired> released;
+        {
+            std::lock_guard<std::mutex> lock(domain.mutex);
+            Retired retired;
+            retired.epoch = domain.epoch.fetch_add(1);
+            retired.object = std::move(object);
+            domain.retired.push_back(std::move(retired));
+            _collect(domain, released);
+        }
+    }
+    // Releases what no guard can reach anymore
+    static void collect() {
+        Domain& domain = _domain();
+        std::vector<Retired> released;
+        {
+            std::lock_guard<std::mutex> lock(domain.mutex);
+            _collect(domain, released);
+        }
+    }
+    // Number of retired objects not released yet
+    static size_t pending() {
+        Domain& domain = _domain();
+        std::lock_guard<std::mutex> lock(domain.mutex);
+        return domain.retired.size();
+    }
+
+private:
+    static Domain& _domain() {
+        static Domain domain;
+        return domain;
+    }
+
+    static Slot* _threadSlot() {
+        static thread_local ThreadSlot threadSlot;
+        if (!threadSlot.slot) {
+            Domain& domain = _domain();
+            for (size_t i = 0; i < MAX_THREADS && !threadSlot.slot; ++i) {
+                bool used = false;
+                if (domain.slots[i].used.compare_exchange_strong(used, true)) {
+                    threadSlot.slot = &domain.slots[i];
+                }
+            }
+            if (!threadSlot.slot) {
+                throw new std::out_of_range("Too many threads hold epoch guards");
+            }
+        }
+        return threadSlot.slot;
+    }
+
+    /* A reader pinned at epoch p may hold pointers to objects retired at epochs >= p. A reader whose pin
+     * the scan misses has not read any node yet (both sides fence), and will only find what is still
+     * reachable. The releasable objects are moved to 'released' and destroyed by the caller after
+     * unlocking, since destroying a container may retire its own versions. */
+    static void _collect(Domain& domain, std::vector<Retired>& released) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t oldest = std::numeric_limits<uint64_t>::max();
+        for (size_t i = 0; i < MAX_THREADS; ++i) {
+            uint64_t pinned = domain.slots[i].pinned.load(std::memory_order_acquire);
+            if (pinned && pinned < oldest) {
+                oldest = pinned;
+            }
+        }
+        size_t kept = 0;
+        for (size_t i = 0; i < domain.retired.size(); ++i) {
+            if (domain.retired[i].epoch >= oldest) {
+                domain.retired[kept++] = std::move(domain.retired[i]);
+            } else {
+                released.push_back(std::move(domain.retired[i]));
+            }
+        }
+        domain.retired.resize(kept);
+    }
+};
+
+#endif // EPOCH_HPP
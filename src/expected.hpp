@@ -0,0 +1,156 @@
+#ifndef EXPECTED_HPP
+#define EXPECTED_HPP
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+// Why a checked access failed
+enum class AccessError {
+    NONE,
+    INVALID_VERSION,
+    INDEX_OUT_OF_RANGE,
+    KEY_NOT_FOUND,
+    EMPTY
+};
+
+inline const char* accessErrorMessage(const AccessError error) noexcept {
+    switch (error) {
+    case AccessError::NONE:
+        return "No error";
+    case AccessError::INVALID_VERSION:
+        return "Invalid version";
+    case AccessError::INDEX_OUT_OF_RANGE:
+        return "Index out of range";
+    case AccessError::KEY_NOT_FOUND:
+        return "Key not found";
+    case AccessError::EMPTY:
+        return "This version is empty";
+    }
+    return "Unknown error";
+}
+
+/* Slow path of the throwing accessors. It is kept out of line, so a range check costs the accessor
+ * one compare and a call that is never taken, and the accessor itself stays small enough to inline. */
+[[noreturn]] __attribute__((noinline, cold)) inline void throwAccessError(const AccessError error) {
+    throw new std::out_of_range(accessErrorMessage(error));
+}
+[[noreturn]] __attribute__((noinline, cold)) inline void throwAccessError(const AccessError error, const size_t n) {
+    throw new std::out_of_range(std::string(accessErrorMessage(error)) + ": " + std::to_string(n));
+}
+
+/* Result of the try_* accessors, after C++23 std::expected: either a value or the AccessError that
+ * prevented it. Failures are reported without throwing or allocating; value() throws like the
+ * unchecked accessors would. T must be default constructible. */
+template <class T>
+class Expected {
+public:
+    Expected(const T& value) : _value(value), _error(AccessError::NONE)
+    {}
+    Expected(T&& value) : _value(std::move(value)), _error(AccessError::NONE)
+    {}
+    Expected(const AccessError error) : _value(), _error(error)
+    {}
+
+    inline bool has_value() const noexcept {
+        return _error == AccessError::NONE;
+    }
+    inline explicit operator bool() const noexcept {
+        return has_value();
+    }
+    inline AccessError error() const noexcept {
+        return _error;
+    }
+    // Only with has_value()
+    inline const T& operator*() const noexcept {
+        return _value;
+    }
+    inline const T* operator->() const noexcept {
+        return &_value;
+    }
+    const T& value() const {
+        if (_error != AccessError::NONE) {
+            throwAccessError(_error);
+        }
+        return _value;
+    }
+    inline T value_or(const T& other) const {
+        return has_value() ? _value : other;
+    }
+
+private:
+    T _value;
+    AccessError _error;
+};
+
+// Reference into the container, valid as long as the element it refers to
+template <class T>
+class Expected<T&> {
+public:
+    Expected(T& value) : _value(&value), _error(AccessError::NONE)
+    {}
+    Expected(const AccessError error) : _value(nullptr), _error(error)
+    {}
+
+    inline bool has_value() const noexcept {
+        return _error == AccessError::NONE;
+    }
+    inline explicit operator bool() const noexcept {
+        return has_value();
+    }
+    inline AccessError error() const noexcept {
+        return _error;
+    }
+    inline T& operator*() const noexcept {
+        return *_value;
+    }
+    inline T* operator->() const noexcept {
+        return _value;
+    }
+    T& value() const {
+        if (_error != AccessError::NONE) {
+            throwAccessError(_error);
+        }
+        return *_value;
+    }
+    // A copy, so that a temporary 'other' can not dangle
+    inline typename std::remove_const<T>::type value_or(const T& other) const {
+        return has_value() ? *_value : other;
+    }
+
+private:
+    T* _value;
+    AccessError _error;
+};
+
+// Result of a write: nothing but the error
+template <>
+class Expected<void> {
+public:
+    Expected() : _error(AccessError::NONE)
+    {}
+    Expected(const AccessError error) : _error(error)
+    {}
+
+    inline bool has_value() const noexcept {
+        return _error == AccessError::NONE;
+    }
+    inline explicit operator bool() const noexcept {
+        return has_value();
+    }
+    inline AccessError error() const noexcept {
+        return _error;
+    }
+    void value() const {
+        if (_error != AccessError::NONE) {
+            throwAccessError(_error);
+        }
+    }
+
+private:
+    AccessError _error;
+};
+
+#endif // EXPECTED_HPP
@@ -0,0 +1,162 @@
+#ifndef FROZEN_MAP_HPP
+#define FROZEN_MAP_HPP
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/* Immutable copy of one map version laid out for lookups (see PersistentMap::freeze). Keys are stored
+ * in Eytzinger order, the breadth-first order of a complete binary search tree, in an array of their
+ * own; values sit in a parallel array. A search reads one key per level, steps without branching on
+ * the comparison and prefetches the cache line holding the keys a few levels down. */
+template <class Key, class Value, class Comparator = std::less<Key> >
+class FrozenMap {
+public:
+    typedef Key key_type;
+    typedef Value mapped_type;
+    typedef std::pair<const key_type&, const mapped_type&> value_type;
+
+    class iterator : public std::iterator<std::forward_iterator_tag, value_type> {
+        friend class FrozenMap;
+
+    public:
+        struct Arrow {
+            value_type pair;
+
+            const value_type* operator->() const {
+                return &pair;
+            }
+        };
+
+        iterator() : _map(nullptr), _index(0)
+        {}
+
+        iterator& operator++() {
+            if (_index) {
+                _index = _map->_next(_index);
+            }
+            return *this;
+        }
+        iterator operator++(int) {
+            iterator tmp(*this);
+            operator++();
+            return tmp;
+        }
+        bool operator==(const iterator& other) const {
+            return _index == other._index;
+        }
+        bool operator!=(const iterator& other) const {
+            return _index != other._index;
+        }
+        value_type operator*() const {
+            if (!_index) {
+                throw new std::out_of_range("Iterator is out of range");
+            }
+            return value_type(_map->_keys[_index], _map->_values[_index]);
+        }
+        Arrow operator->() const {
+            return Arrow{operator*()};
+        }
+
+    private:
+        iterator(const FrozenMap* map, const size_t index) : _map(map), _index(index)
+        {}
+
+        const FrozenMap* _map;
+        // position in the Eytzinger arrays, 0 past the end
+        size_t _index;
+    };
+
+    FrozenMap() : _keys(1), _values(1)
+    {}
+    // 'pairs' must be sorted by key without duplicates
+    explicit FrozenMap(const std::vector<std::pair<const Key*, const Value*> >& pairs)
+        : _keys(pairs.size() + 1), _values(pairs.size() + 1) {
+        _fill(pairs, 0, 1);
+    }
+
+    inline size_t size() const {
+        return _keys.size() - 1;
+    }
+    inline bool empty() const {
+        return size() == 0;
+    }
+
+    iterator begin() const {
+        size_t index = 1;
+        while (2 * index <= size()) {
+            index *= 2;
+        }
+        return iterator(this, empty() ? 0 : index);
+    }
+    iterator end() const {
+        return iterator(this, 0);
+    }
+
+    iterator find(const Key& key) const {
+        size_t index = _lowerBound(key);
+        if (index && !_comparator(key, _keys[index])) {
+            return iterator(this, index);
+        }
+        return end();
+    }
+    // First element whose key is not less than 'key'
+    iterator lower_bound(const Key& key) const {
+        return iterator(this, _lowerBound(key));
+    }
+    const Value& at(const Key& key) const {
+        iterator it = find(key);
+        if (it == end()) {
+            throw new std::out_of_range("Key is not in the map");
+        }
+        return _values[it._index];
+    }
+
+private:
+    // the descendants of a key log2(PREFETCH_STRIDE) levels down are adjacent and fill about one cache line
+    static const size_t PREFETCH_STRIDE = 64 / sizeof(Key) > 1 ? 64 / sizeof(Key) : 1;
+
+    // index 0 is unused, the children of i are 2i and 2i + 1
+    std::vector<Key> _keys;
+    std::vector<Value> _values;
+    Comparator _comparator;
+
+    size_t _fill(const std::vector<std::pair<const Key*, const Value*> >& pairs, size_t next, const size_t index) {
+        if (index < _keys.size()) {
+            next = _fill(pairs, next, 2 * index);
+            _keys[index] = *pairs[next].first;
+            _values[index] = *pairs[next].second;
+            next = _fill(pairs, next + 1, 2 * index + 1);
+        }
+        return next;
+    }
+
+    size_t _lowerBound(const Key& key) const {
+        const Key* keys = _keys.data();
+        const size_t n = size();
+        size_t index = 1;
+        while (index <= n) {
+            __builtin_prefetch(keys + std::min(index * PREFETCH_STRIDE, n));
+            index = 2 * index + _comparator(keys[index], key);
+        }
+        // the path went right after the answer only; drop those steps and the last left one
+        return index >> __builtin_ffsll(~index);
+    }
+
+    // In-order successor in the implicit tree, 0 after the last element
+    size_t _next(size_t index) const {
+        if (2 * index + 1 <= size()) {
+            index = 2 * index + 1;
+            while (2 * index <= size()) {
+                index *= 2;
+            }
+            return index;
+        }
+        return index >> __builtin_ffsll(~index);
+    }
+};
+
+#endif // FROZEN_MAP_HPP
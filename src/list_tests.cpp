@@ -240,3 +240,140 @@ TEST_F(PersistentListTest, NestedMapTest) {
     ASSERT_EQ(2, list.size(2));
     ASSERT_EQ(1, list.size(3));
 }
+
+TEST_F(PersistentListTest, SharedPayloadTest) {
+    PersistentList<CopyCounter> list;
+    CopyCounter value;
+    for (size_t i = 0; i < 100; ++i) {
+        CopyCounter::copies = 0;
+        list.push_back(i, value);
+        ASSERT_EQ(1, CopyCounter::copies);
+    }
+    CopyCounter::copies = 0;
+    list.pop_back(100);
+    auto it = list.begin(101);
+    ++it;
+    list.erase(101, it);
+    ASSERT_EQ(0, CopyCounter::copies);
+    ASSERT_EQ(98, list.size(102));
+}
+
+TEST_F(PersistentListTest, MoveWritesTest) {
+    PersistentList<CopyCounter> list;
+    CopyCounter::copies = 0;
+    list.push_back(0, CopyCounter());
+    list.push_front(1, CopyCounter());
+    list.emplace_back(2);
+    list.emplace_front(3);
+    list.insert(4, list.begin(4), CopyCounter());
+    ASSERT_EQ(0, CopyCounter::copies);
+    ASSERT_EQ(5, list.size(5));
+
+    PersistentList<std::string> strings;
+    strings.emplace_back(0, 3, 'x');
+    strings.emplace_front(1, "front");
+    std::string moved(100, 'y');
+    strings.push_back(2, std::move(moved));
+    ASSERT_EQ("front", *strings.begin(3));
+    ASSERT_EQ(std::vector<std::string>({"front", "xxx", std::string(100, 'y')}),
+              std::vector<std::string>(strings.begin(3), strings.end()));
+}
+
+TEST_F(PersistentListTest, CheckedAccessTest) {
+    PersistentList<int> list;
+    list.push_back(0, 1);
+    list.push_back(1, 2);
+    ASSERT_EQ(1, *list.try_front(2));
+    ASSERT_EQ(2, *list.try_back(2));
+    ASSERT_EQ(AccessError::EMPTY, list.try_front(0).error());
+    ASSERT_EQ(AccessError::EMPTY, list.try_back(0).error());
+    ASSERT_EQ(AccessError::INVALID_VERSION, list.try_front(3).error());
+    ASSERT_EQ(5, list.try_back(0).value_or(5));
+    ASSERT_THROW(list.back(0), std::out_of_range*);
+}
+
+TEST_F(PersistentListTest, BatchTest) {
+    PersistentList<int> list;
+    list.push_back(0, 1);
+
+    auto batch = list.batch(1);
+    for (int i = 2; i <= 5; ++i) {
+        batch.push_back(i);
+    }
+    batch.push_front(0);
+    batch.pop_back();
+    ASSERT_EQ(5, batch.size());
+    ASSERT_EQ(2, list.versionsNumber());
+
+    ASSERT_EQ(2, batch.publish());
+    ASSERT_EQ(5, list.size(2));
+    auto it = list.begin(2);
+    for (int i = 0; i < 5; ++i, ++it) {
+        ASSERT_EQ(i, *it);
+    }
+    ASSERT_EQ(list.end(), it);
+    ASSERT_EQ(1, list.size(1));
+    ASSERT_EQ(1, list.front(1));
+
+    batch.pop_front();
+    batch.push_back(5);
+    ASSERT_EQ(3, batch.publish());
+    ASSERT_EQ(0, list.front(2));
+    ASSERT_EQ(4, list.back(2));
+    ASSERT_EQ(1, list.front(3));
+    ASSERT_EQ(5, list.back(3));
+    ASSERT_EQ(5, list.size(3));
+
+    // positional edits, and appends after them that reuse the batch's own last node
+    batch.insert(0, -1);
+    batch.insert(3, 10);
+    batch.insert(6, 6);
+    batch.erase(1);
+    batch.push_back(7);
+    batch.erase(6);
+    batch.push_back(8);
+    ASSERT_THROW(batch.insert(9, 0), std::out_of_range*);
+    ASSERT_THROW(batch.erase(8), std::out_of_range*);
+    ASSERT_EQ(4, batch.publish());
+    std::vector<int> expected = {-1, 2, 10, 3, 4, 6, 7, 8};
+    ASSERT_EQ(expected, std::vector<int>(list.begin(4), list.end()));
+    ASSERT_EQ(8, list.back(4));
+    ASSERT_EQ(5, list.size(3));
+    ASSERT_EQ(5, list.back(3));
+
+    batch.erase(6);
+    batch.push_back(9);
+    batch.erase(0);
+    ASSERT_EQ(5, batch.publish());
+    expected = {2, 10, 3, 4, 6, 8, 9};
+    ASSERT_EQ(expected, std::vector<int>(list.begin(5), list.end()));
+    ASSERT_EQ(expected.size(), list.size(5));
+    ASSERT_EQ(8, list.back(4));
+}
+
+TEST_F(PersistentListTest, SquashTest) {
+    std::shared_ptr<int> a = std::make_shared<int>(1);
+    std::shared_ptr<int> b = std::make_shared<int>(2);
+    PersistentList<std::shared_ptr<int> > list;
+    list.push_back(0, a);
+    list.push_back(1, b);
+    list.pop_back(2);
+    list.push_front(3, a);
+    ASSERT_EQ(2, b.use_count());
+
+    list.squash(0, 4);
+    ASSERT_EQ(1, b.use_count());
+    ASSERT_EQ(5, list.versionsNumber());
+    ASSERT_EQ(2, list.size(4));
+    ASSERT_EQ(a, list.front(4));
+    ASSERT_EQ(a, list.back(4));
+    ASSERT_THROW(list.push_back(2, a), std::out_of_range*);
+
+    list.push_back(4, b);
+    list.push_front(5, a);
+    list.push_front(5, b);
+    ASSERT_THROW(list.squash(4, 6), std::out_of_range*);
+    ASSERT_THROW(list.squash(6, 4), std::out_of_range*);
+    ASSERT_EQ(b, list.back(6));
+    ASSERT_EQ(4, list.size(6));
+}
@@ -1,4 +1,16 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
 #include "persistent_map.hpp"
+#include "persistent_indexed_map.hpp"
+#include "epoch.hpp"
+#include "node_arena.hpp"
+#include "work_stealing.hpp"
+#include "shared_memory_map.hpp"
+#include "out_of_core_map.hpp"
 #include "persistent_vector.hpp"
 #include "persistent_list.hpp"
 #include "tests.hpp"
@@ -181,3 +193,560 @@ TEST_F(PersistentMapTest, NestedListTest) {
     ASSERT_EQ(2, map.size(2));
     ASSERT_EQ(1, map.size(3));
 }
+
+TEST_F(PersistentMapTest, AppendTest) {
+    PersistentMap<int, int> map;
+    for (int i = 0; i < 1000; ++i) {
+        auto result = map.insert(i, std::make_pair(i, i * 10));
+        ASSERT_TRUE(result.second);
+        ASSERT_EQ(i * 10, (*(result.first)).second);
+    }
+    map.insert(1000, std::make_pair(-1, -10));
+    map.insert(1001, std::make_pair(2000, 20000));
+
+    for (int i = 0; i < 1000; ++i) {
+        ASSERT_EQ(i * 10, map.at(1002, i));
+        ASSERT_EQ(map.end(), map.find(i, i));
+        ASSERT_EQ(i * 10, map.at(i + 1, i));
+    }
+    ASSERT_EQ(-10, map.at(1002, -1));
+    ASSERT_EQ(20000, map.at(1002, 2000));
+    ASSERT_EQ(map.end(), map.find(1000, -1));
+    ASSERT_EQ(map.end(), map.find(1001, 2000));
+
+    ASSERT_EQ(1000, map.size(1000));
+    ASSERT_EQ(1002, map.size(1002));
+}
+
+TEST_F(PersistentMapTest, SharedPayloadTest) {
+    PersistentMap<int, CopyCounter> map;
+    for (int i = 0; i < 100; ++i) {
+        std::pair<const int, CopyCounter> pair(100 - i, CopyCounter());
+        CopyCounter::copies = 0;
+        map.insert(i, pair);
+        ASSERT_EQ(1, CopyCounter::copies);
+    }
+    CopyCounter::copies = 0;
+    map.erase(100, 50);
+    ASSERT_EQ(0, CopyCounter::copies);
+    ASSERT_EQ(map.end(), map.find(101, 50));
+    ASSERT_NE(map.end(), map.find(100, 50));
+}
+
+TEST_F(PersistentMapTest, MoveWritesTest) {
+    PersistentMap<int, CopyCounter> map;
+    CopyCounter::copies = 0;
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_TRUE(map.insert(i, std::pair<const int, CopyCounter>(100 - i, CopyCounter())).second);
+    }
+    ASSERT_TRUE(map.try_emplace(100, 0).second);
+    ASSERT_TRUE(map.emplace(101, -1, CopyCounter()).second);
+    ASSERT_EQ(0, CopyCounter::copies);
+
+    PersistentMap<int, std::string> strings;
+    std::string value(100, 'x');
+    ASSERT_TRUE(strings.insert(0, std::make_pair(1, std::move(value))).second);
+    ASSERT_TRUE(strings.try_emplace(1, 2, 3, 'y').second);
+    std::string kept("kept");
+    ASSERT_FALSE(strings.try_emplace(2, 2, std::move(kept)).second);
+    ASSERT_EQ("kept", kept);
+    ASSERT_EQ(std::string(100, 'x'), strings.at(3, 1));
+    ASSERT_EQ("yyy", strings.at(3, 2));
+    ASSERT_EQ(2, strings.size(3));
+}
+
+TEST_F(PersistentMapTest, CheckedAccessTest) {
+    PersistentMap<int, int> map;
+    for (int i = 0; i < 100; ++i) {
+        map.insert(i, std::make_pair(i, i * 10));
+    }
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_EQ(i * 10, map.unchecked_at(100, i));
+        ASSERT_EQ(i * 10, *map.try_at(100, i));
+    }
+    ASSERT_EQ(AccessError::KEY_NOT_FOUND, map.try_at(50, 50).error());
+    ASSERT_EQ(AccessError::INVALID_VERSION, map.try_at(101, 0).error());
+    ASSERT_THROW(map.try_at(50, 50).value(), std::out_of_range*);
+
+    ASSERT_FALSE(*map.try_insert(100, std::make_pair(5, 0)));
+    ASSERT_TRUE(*map.try_insert(101, std::make_pair(100, 0)));
+    ASSERT_EQ(AccessError::INVALID_VERSION, map.try_insert(103, std::make_pair(0, 0)).error());
+    ASSERT_TRUE(*map.try_erase(102, 5));
+    ASSERT_FALSE(*map.try_erase(103, 5));
+    ASSERT_EQ(AccessError::INVALID_VERSION, map.try_erase(105, 5).error());
+    ASSERT_EQ(105, map.versionsNumber());
+    ASSERT_EQ(100, map.size(104));
+}
+
+TEST_F(PersistentMapTest, BatchTest) {
+    PersistentMap<int, int> map;
+    map.insert(0, std::make_pair(1, 10));
+
+    auto batch = map.batch(1);
+    for (int i = 20; i > 1; --i) {
+        ASSERT_TRUE(batch.insert(std::make_pair(i, i * 10)).second);
+    }
+    ASSERT_FALSE(batch.insert(std::make_pair(5, 0)).second);
+    batch.erase(7);
+    batch.erase(100);
+    ASSERT_EQ(19, batch.size());
+    ASSERT_EQ(2, map.versionsNumber());
+
+    size_t version = batch.publish();
+    ASSERT_EQ(2, version);
+    ASSERT_EQ(3, map.versionsNumber());
+    ASSERT_EQ(19, map.size(2));
+    ASSERT_EQ(50, map.at(2, 5));
+    ASSERT_EQ(map.end(), map.find(2, 7));
+    ASSERT_EQ(map.end(), map.find(1, 5));
+
+    batch.erase(5);
+    batch.insert(std::make_pair(7, 70));
+    ASSERT_EQ(3, batch.publish());
+    ASSERT_EQ(50, map.at(2, 5));
+    ASSERT_EQ(map.end(), map.find(2, 7));
+    ASSERT_EQ(map.end(), map.find(3, 5));
+    ASSERT_EQ(70, map.at(3, 7));
+    ASSERT_EQ(19, map.size(3));
+}
+
+TEST_F(PersistentMapTest, EraseKeepsOlderVersionsTest) {
+    PersistentMap<int, int> map;
+    for (int i = 0; i < 64; ++i) {
+        map.insert(i, std::make_pair((i * 37) % 64, i));
+    }
+    for (int i = 0; i < 64; ++i) {
+        map.erase(64 + i, (i * 11) % 64);
+    }
+    for (int v = 0; v <= 64; ++v) {
+        for (int i = 0; i < 64; ++i) {
+            ASSERT_EQ(i < v, map.find(v, (i * 37) % 64) != map.end());
+        }
+    }
+    for (int v = 64; v <= 128; ++v) {
+        ASSERT_EQ(128 - v, map.size(v));
+        for (int i = 0; i < 64; ++i) {
+            ASSERT_EQ(i >= v - 64, map.find(v, (i * 11) % 64) != map.end());
+        }
+    }
+}
+
+TEST_F(PersistentMapTest, SquashTest) {
+    std::shared_ptr<int> a = std::make_shared<int>(1);
+    std::shared_ptr<int> b = std::make_shared<int>(2);
+    PersistentMap<int, std::shared_ptr<int> > map;
+    map.insert(0, std::make_pair(1, a));
+    map.insert(1, std::make_pair(2, b));
+    map.erase(2, 2);
+    map.insert(3, std::make_pair(3, a));
+    ASSERT_EQ(2, b.use_count());
+
+    map.squash(1, 4);
+    ASSERT_EQ(1, b.use_count());
+    ASSERT_EQ(5, map.versionsNumber());
+    ASSERT_EQ(1, map.size(1));
+    ASSERT_EQ(2, map.size(4));
+    ASSERT_EQ(a, map.at(4, 3));
+    ASSERT_EQ(map.end(), map.find(4, 2));
+    ASSERT_THROW(map.insert(2, std::make_pair(5, a)), std::out_of_range*);
+
+    map.insert(4, std::make_pair(5, b));
+    map.insert(5, std::make_pair(6, a));
+    map.insert(5, std::make_pair(7, a));
+    ASSERT_THROW(map.squash(4, 6), std::out_of_range*);
+    ASSERT_THROW(map.squash(6, 4), std::out_of_range*);
+    ASSERT_EQ(b, map.at(6, 5));
+    ASSERT_EQ(4, map.size(6));
+}
+
+TEST_F(PersistentMapTest, SecondaryIndexTest) {
+    PersistentIndexedMap<int, int> map;
+    for (int key = 0; key < 200; ++key) {
+        map.insert(key, std::make_pair(key, key % 7));
+    }
+    // an existing key keeps its value and its index entry
+    ASSERT_FALSE(map.insert(200, std::make_pair(3, 5)).second);
+    map.erase(201, 10);
+    map.erase(202, 1000);
+
+    ASSERT_EQ(204, map.versionsNumber());
+    ASSERT_EQ(199, map.size(203));
+    for (int value = 0; value < 7; ++value) {
+        std::vector<int> expected;
+        for (int key = 0; key < 200; ++key) {
+            if (key % 7 == value && key != 10) {
+                expected.push_back(key);
+            }
+        }
+        ASSERT_EQ(expected, map.keysWith(203, value));
+    }
+    ASSERT_EQ(std::vector<int>({3, 10}), map.keysWith(11, 3));
+    ASSERT_EQ(29, map.keysWith(201, 3).size());
+    ASSERT_EQ(28, map.keysWith(202, 3).size());
+    ASSERT_TRUE(map.keysWith(203, 7).empty());
+    ASSERT_TRUE(map.keysWith(0, 0).empty());
+    ASSERT_EQ(map.end(), map.find(203, 10));
+    ASSERT_EQ(3, map.find(201, 10)->second);
+}
+
+TEST_F(PersistentMapTest, FreezeTest) {
+    PersistentMap<int, std::string> map;
+    for (int i = 0; i < 1000; ++i) {
+        map.insert(i, std::make_pair((i * 7919) % 3001, std::to_string(i)));
+    }
+    map.erase(1000, 7919 % 3001);
+
+    FrozenMap<int, std::string> frozen = map.freeze(1001);
+    ASSERT_EQ(999, frozen.size());
+    ASSERT_TRUE(map.freeze(0).empty());
+    ASSERT_EQ(map.freeze(0).end(), map.freeze(0).begin());
+    for (int key = -1; key < 3002; ++key) {
+        auto expected = map.find(1001, key);
+        auto found = frozen.find(key);
+        if (expected == map.end()) {
+            ASSERT_EQ(frozen.end(), found);
+        } else {
+            ASSERT_EQ(key, found->first);
+            ASSERT_EQ(expected->second, found->second);
+        }
+    }
+    ASSERT_EQ("2", frozen.at((2 * 7919) % 3001));
+    ASSERT_THROW(frozen.at(7919 % 3001), std::out_of_range*);
+    ASSERT_EQ(frozen.end(), frozen.lower_bound(3001));
+
+    int previous = -1;
+    size_t count = 0;
+    for (auto it = frozen.begin(); it != frozen.end(); ++it, ++count) {
+        ASSERT_LT(previous, (*it).first);
+        ASSERT_EQ(it, frozen.lower_bound(previous + 1));
+        previous = (*it).first;
+    }
+    ASSERT_EQ(999, count);
+}
+
+TEST_F(PersistentMapTest, EpochReclamationTest) {
+    PersistentMap<int, int> map;
+    for (int i = 0; i < 100; ++i) {
+        map.insert(i, std::make_pair((i * 37) % 100, i));
+    }
+    int expected = 0;
+    for (auto it = map.begin(100); it != map.end(); ++it, ++expected) {
+        ASSERT_EQ(expected, it->first);
+    }
+    ASSERT_EQ(100, expected);
+
+    {
+        EpochReclaimer::Guard guard;
+        auto it = map.begin(50);
+        map.squash(10, 90);
+        // the dropped versions are kept for the guard
+        ASSERT_EQ(1, EpochReclaimer::pending());
+        expected = 0;
+        for (; it != map.end(); ++it) {
+            ++expected;
+        }
+        ASSERT_EQ(50, expected);
+    }
+    EpochReclaimer::collect();
+    ASSERT_EQ(0, EpochReclaimer::pending());
+    ASSERT_EQ(100, map.size(100));
+}
+
+TEST_F(PersistentMapTest, NodeArenaTest) {
+    // the main thread owns an arena of its own before it frees the writer's nodes
+    PersistentList<std::string, NodeAllocator<std::string> > list;
+    list.push_back(0, "a");
+    list.push_back(1, "b");
+    ASSERT_EQ("b", list.back(2));
+    NodeArena* mainArena = &NodeArena::local();
+    size_t mainChunks = mainArena->chunksNumber();
+
+    typedef PersistentMap<int, int, std::less<int>, NodeAllocator<int> > ArenaMap;
+    std::unique_ptr<ArenaMap> map;
+    NodeArena* writerArena = nullptr;
+    size_t chunks = 0;
+    std::thread writer([&map, &writerArena, &chunks]() {
+        map.reset(new ArenaMap());
+        for (int i = 0; i < 5000; ++i) {
+            map->insert(i, std::make_pair(i, -i));
+        }
+        writerArena = &NodeArena::local();
+        chunks = writerArena->chunksNumber();
+    });
+    writer.join();
+    ASSERT_NE(mainArena, writerArena);
+    ASSERT_EQ(5000, map->size(5000));
+    ASSERT_EQ(-1234, map->find(5000, 1234)->second);
+    // freed here, the nodes go back to the queue of the writer's arena, not to the main thread's one
+    map.reset();
+    ASSERT_EQ(mainArena, &NodeArena::local());
+    ASSERT_EQ(mainChunks, mainArena->chunksNumber());
+
+    // the next writer adopts the arena of the exited one and builds the same map from the freed blocks
+    NodeArena* nextArena = nullptr;
+    size_t reusedChunks = 0;
+    std::thread nextWriter([&map, &nextArena, &reusedChunks]() {
+        nextArena = &NodeArena::local();
+        map.reset(new ArenaMap());
+        for (int i = 0; i < 5000; ++i) {
+            map->insert(i, std::make_pair(i, i));
+        }
+        reusedChunks = NodeArena::local().chunksNumber();
+    });
+    nextWriter.join();
+    ASSERT_EQ(writerArena, nextArena);
+    ASSERT_EQ(chunks, reusedChunks);
+    ASSERT_EQ(1234, map->find(5000, 1234)->second);
+}
+
+TEST_F(PersistentMapTest, ParallelBuildTest) {
+    std::vector<std::pair<int, int> > input;
+    for (int i = 0; i < 100000; ++i) {
+        input.push_back(std::make_pair((i * 7919) % 50000, i));
+    }
+    PersistentMap<int, int> map;
+    map.insert(0, std::make_pair(-5, 0));
+    map.insert(1, std::make_pair(7919, -1));
+    ASSERT_EQ(3, map.parallel_build(2, input.begin(), input.end()));
+
+    ASSERT_EQ(50001, map.size(3));
+    ASSERT_EQ(2, map.size(2));
+    ASSERT_EQ(0, map.find(3, -5)->second);
+    // existing keys and the first of repeated keys win
+    ASSERT_EQ(-1, map.find(3, 7919)->second);
+    ASSERT_EQ(2, map.find(3, (2 * 7919) % 50000)->second);
+    int expected = -5;
+    for (auto it = map.begin(3); it != map.end(); ++it) {
+        ASSERT_EQ(expected, it->first);
+        expected = expected == -5 ? 0 : expected + 1;
+    }
+    ASSERT_EQ(50000, expected);
+    // the built tree takes further writes like any other version
+    map.erase(3, 25000);
+    map.insert(4, std::make_pair(60000, 1));
+    ASSERT_EQ(50001, map.size(5));
+    ASSERT_EQ(map.end(), map.find(5, 25000));
+}
+
+TEST_F(PersistentMapTest, ParallelReduceTest) {
+    PersistentMap<int, int> map;
+    for (int i = 0; i < 5000; ++i) {
+        map.insert(i, std::make_pair(i, i % 7));
+    }
+    long long expected = 0;
+    std::string keys;
+    for (auto it = map.begin(5000); it != map.end(); ++it) {
+        expected += it->second;
+        keys += std::to_string(it->first) + ",";
+    }
+
+    ASSERT_EQ(expected, map.parallel_reduce(5000, 0, std::plus<int>()));
+    // a non-commutative reduction still sees the pairs in key order
+    auto fold = [](const std::string& result, const std::pair<const int, int>& pair) {
+        return result + std::to_string(pair.first) + ",";
+    };
+    ASSERT_EQ(keys, map.parallel_reduce(5000, std::string(), fold, std::plus<std::string>(), 16));
+    ASSERT_EQ(0, map.parallel_reduce(0, 0, std::plus<int>()));
+    // bool results, which a std::vector<bool> of partial results would pack into shared words
+    auto hasSix = [](const bool result, const std::pair<const int, int>& pair) {
+        return result || pair.second == 6;
+    };
+    ASSERT_TRUE(map.parallel_reduce(5000, false, hasSix, std::logical_or<bool>(), 16));
+    ASSERT_FALSE(map.parallel_reduce(1, false, hasSix, std::logical_or<bool>(), 16));
+
+    std::atomic<long long> sum(0);
+    std::atomic<int> count(0);
+    map.parallel_for_each(5000, [&sum, &count](const std::pair<const int, int>& pair) {
+        sum += pair.second;
+        ++count;
+    }, 8);
+    ASSERT_EQ(expected, sum.load());
+    ASSERT_EQ(5000, count.load());
+}
+
+TEST_F(PersistentMapTest, WorkStealingTest) {
+    // uneven items on more threads than indices per slice, every index runs once
+    std::vector<std::atomic<int> > calls(1000);
+    for (auto& call : calls) {
+        call = 0;
+    }
+    workStealingFor(calls.size(), [&calls](const size_t i) {
+        if (i < 10) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        ++calls[i];
+    }, 8);
+    for (auto& call : calls) {
+        ASSERT_EQ(1, call.load());
+    }
+}
+
+TEST_F(PersistentMapTest, MergeTest) {
+    PersistentMap<int, int> map;
+    for (int i = 0; i < 1000; ++i) {
+        map.insert(i, std::make_pair(i, i));
+    }
+    const size_t base = 1000;
+    // insert keeps existing values, so values are changed by erasing first
+    // a: changes 10, adds 2000, erases 20 and 30
+    map.erase(base, 10);
+    map.insert(map.versionsNumber() - 1, std::make_pair(10, -10));
+    map.insert(map.versionsNumber() - 1, std::make_pair(2000, 1));
+    map.erase(map.versionsNumber() - 1, 20);
+    map.erase(map.versionsNumber() - 1, 30);
+    const size_t a = map.versionsNumber() - 1;
+    // b: changes 500, erases 30, conflicts with a on 10 and 20
+    map.erase(base, 500);
+    map.insert(map.versionsNumber() - 1, std::make_pair(500, -500));
+    map.erase(map.versionsNumber() - 1, 30);
+    map.erase(map.versionsNumber() - 1, 10);
+    map.insert(map.versionsNumber() - 1, std::make_pair(10, 100));
+    map.erase(map.versionsNumber() - 1, 20);
+    map.insert(map.versionsNumber() - 1, std::make_pair(20, 200));
+    const size_t b = map.versionsNumber() - 1;
+
+    std::vector<int> resolved;
+    auto resolve = [&resolved](const int& key, const int* base, const int* a, const int* b, int& merged) {
+        resolved.push_back(key);
+        if (!a) {
+            return false;
+        }
+        merged = *base + *a + *b;
+        return true;
+    };
+    std::pair<size_t, std::vector<int> > result = map.merge3(base, a, b, resolve);
+    ASSERT_EQ(std::vector<int>({10, 20}), result.second);
+    ASSERT_EQ(result.second, resolved);
+
+    size_t merged = result.first;
+    ASSERT_EQ(999, map.size(merged));
+    ASSERT_EQ(10 - 10 + 100, map.find(merged, 10)->second);
+    ASSERT_EQ(map.end(), map.find(merged, 20));
+    ASSERT_EQ(map.end(), map.find(merged, 30));
+    ASSERT_EQ(-500, map.find(merged, 500)->second);
+    ASSERT_EQ(1, map.find(merged, 2000)->second);
+    size_t count = 0;
+    int previous = -1;
+    for (auto it = map.begin(merged); it != map.end(); ++it, ++count) {
+        ASSERT_LT(previous, it->first);
+        previous = it->first;
+    }
+    ASSERT_EQ(999, count);
+
+    // one-sided merges take the changed side
+    ASSERT_EQ(map.size(a), map.size(map.merge3(base, a, base, resolve).first));
+    ASSERT_EQ(999, map.size(map.merge3(0, 0, base - 1, resolve).first));
+    ASSERT_EQ(0, map.size(map.merge3(base, 0, 0, resolve).first));
+}
+
+TEST_F(PersistentMapTest, SharedMemoryTest) {
+    const std::string name = "/pds_map_test_" + std::to_string(getpid());
+    SharedMemoryMap<int, double> writer(name, 1 << 20, 1000);
+    for (int i = 0; i < 100; ++i) {
+        writer.insert(i, i, i / 2.0);
+    }
+    writer.erase(100, 50);
+    // the reader maps the segment at another address
+    SharedMemoryMap<int, double> reader(name);
+    ASSERT_EQ(102, reader.versionsNumber());
+    ASSERT_EQ(99, reader.size(101));
+    ASSERT_EQ(0, reader.count(101, 50));
+    ASSERT_EQ(25.0, reader.at(100, 50));
+    ASSERT_EQ(10, reader.size(10));
+    ASSERT_THROW(reader.insert(0, 1, 1.0), std::out_of_range*);
+
+    writer.insert(0, -1, -1.0);
+    ASSERT_EQ(103, reader.versionsNumber());
+    ASSERT_EQ(-1.0, reader.at(102, -1));
+
+    pid_t child = fork();
+    if (child == 0) {
+        SharedMemoryMap<int, double> other(name);
+        int sum = 0;
+        other.visit(101, [&sum](const int& key, const double&) { sum += key; });
+        _exit(sum == 99 * 100 / 2 - 50 && other.at(102, -1) == -1.0 ? 0 : 1);
+    }
+    int status = 0;
+    waitpid(child, &status, 0);
+    SharedMemoryMap<int, double>::remove(name);
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(0, WEXITSTATUS(status));
+}
+
+TEST_F(PersistentMapTest, OutOfCoreTest) {
+    const std::string path = "/tmp/pds_out_of_core_test_" + std::to_string(getpid());
+    {
+        OutOfCoreMap<int, long long> map(path, 64);
+        for (int i = 0; i < 2000; ++i) {
+            map.insert(i, (i * 7919) % 2000, i);
+        }
+        map.erase(2000, 0);
+        ASSERT_EQ(64, map.cachedNodes());
+        ASSERT_EQ(1999, map.size(2001));
+        ASSERT_EQ(0, map.count(2001, 0));
+        ASSERT_EQ(1, map.count(2000, 0));
+        for (int i = 1; i < 2000; i += 97) {
+            ASSERT_EQ(i, map.at(2001, (i * 7919) % 2000));
+        }
+        ASSERT_EQ(10, map.size(10));
+        ASSERT_EQ(0, map.count(10, (10 * 7919) % 2000));
+
+        // a pinned version faults only below its resident upper levels
+        auto thrash = [&map]() {
+            for (int i = 0; i < 200; ++i) {
+                map.count(1000 + 3 * i, (i * 7919) % 2000);
+            }
+        };
+        map.pin(2001);
+        thrash();
+        size_t misses = map.misses();
+        map.count(2001, 1000);
+        size_t pinnedMisses = map.misses() - misses;
+        map.unpin(2001);
+        thrash();
+        misses = map.misses();
+        map.count(2001, 1000);
+        ASSERT_GT(map.misses() - misses, pinnedMisses);
+        // pins nest, and an unpin without a matching pin is rejected instead of wrapping the frame counts
+        ASSERT_THROW(map.unpin(2001), std::out_of_range*);
+        map.pin(5);
+        map.pin(5);
+        map.unpin(5);
+        map.unpin(5);
+        ASSERT_THROW(map.unpin(5), std::out_of_range*);
+        map.pin(2001);
+        map.unpin(2001);
+    }
+    // the history survives reopening
+    OutOfCoreMap<int, long long> reopened(path, 16);
+    ASSERT_EQ(2002, reopened.versionsNumber());
+    long long sum = 0;
+    reopened.visit(2001, [&sum](const int&, const long long& value) { sum += value; });
+    ASSERT_EQ(1999LL * 2000 / 2, sum);
+    std::remove(path.c_str());
+    std::remove((path + ".versions").c_str());
+
+    // a write that finds every frame pinned fails without breaking the writes after it
+    {
+        OutOfCoreMap<int, long long> pinned(path, 10);
+        for (int i = 0; i < 10; ++i) {
+            pinned.insert(i, i, i);
+        }
+        pinned.pin(10);
+        ASSERT_THROW(pinned.insert(10, 100, 100), std::out_of_range*);
+        ASSERT_EQ(11, pinned.versionsNumber());
+        pinned.unpin(10);
+        pinned.insert(10, 200, 200);
+        pinned.insert(11, -1, -1);
+        ASSERT_EQ(0, pinned.count(12, 100));
+        std::vector<int> keys;
+        pinned.visit(12, [&keys](const int& key, const long long& value) {
+            ASSERT_EQ(key, value);
+            keys.push_back(key);
+        });
+        std::vector<int> expected = {-1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 200};
+        ASSERT_EQ(expected, keys);
+    }
+    std::remove(path.c_str());
+    std::remove((path + ".versions").c_str());
+}
@@ -0,0 +1,210 @@
+#ifndef NODE_ARENA_HPP
+#define NODE_ARENA_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <vector>
+#include <sys/mman.h>
+
+/* Per-thread pools of small blocks for container nodes. Every thread allocates from its own arena
+ * without locking, from chunks the arena mapped and touched first, so under the default first-touch
+ * policy a node lands on the NUMA node of the thread that created it. A block freed by another
+ * thread is pushed on a lock-free queue of its arena and reused by the owner on its next allocation.
+ * Chunks are never returned to the system; the arena of an exited thread is handed to the next new one. */
+class NodeArena {
+public:
+    static const size_t GRANULE = 16;
+    // larger requests go to operator new
+    static const size_t MAX_BLOCK = 256;
+    static const size_t CHUNK_SIZE = 64 * 1024;
+
+    // Arena of the calling thread, adopted or created by its first call
+    static NodeArena& local() {
+        NodeArena*& arena = _current();
+        if (!arena) {
+            static thread_local ThreadArena threadArena;
+            arena = _adopt();
+            threadArena.arena = arena;
+        }
+        return *arena;
+    }
+
+    // 'size' must not exceed MAX_BLOCK
+    void* allocate(const size_t size) {
+        size_t sizeClass = (size - 1) / GRANULE;
+        Block* block = _free[sizeClass];
+        if (!block) {
+            block = _remote[sizeClass].head.exchange(nullptr, std::memory_order_acquire);
+        }
+        if (block) {
+            _free[sizeClass] = block->next;
+            return block;
+        }
+        size_t blockSize = (sizeClass + 1) * GRANULE;
+        if (_bump[sizeClass] + blockSize > _bumpEnd[sizeClass]) {
+            _newChunk(sizeClass);
+        }
+        void* memory = _bump[sizeClass];
+        _bump[sizeClass] += blockSize;
+        return memory;
+    }
+    // Any thread may free any block; a thread without an arena frees to the owner's queue and gets none
+    static void deallocate(void* memory) {
+        Chunk* chunk = reinterpret_cast<Chunk*>(reinterpret_cast<size_t>(memory) & ~(CHUNK_SIZE - 1));
+        NodeArena* owner = chunk->owner;
+        Block* block = static_cast<Block*>(memory);
+        if (owner == _current()) {
+            block->next = owner->_free[chunk->sizeClass];
+            owner->_free[chunk->sizeClass] = block;
+            return;
+        }
+        std::atomic<Block*>& head = owner->_remote[chunk->sizeClass].head;
+        block->next = head.load(std::memory_order_relaxed);
+        while (!head.compare_exchange_weak(block->next, block, std::memory_order_release, std::memory_order_relaxed))
+        {}
+    }
+
+    inline size_t chunksNumber() const {
+        return _chunks.size();
+    }
+
+private:
+    static const size_t CLASSES = MAX_BLOCK / GRANULE;
+
+    struct Block {
+        Block* next;
+    };
+    // Header at the start of every CHUNK_SIZE-aligned chunk, all blocks of a chunk have one size
+    struct Chunk {
+        NodeArena* owner;
+        size_t sizeClass;
+    };
+    // Blocks freed by other threads, on a cache line of its own
+    struct RemoteQueue {
+        std::atomic<Block*> head;
+        char padding[64 - sizeof(std::atomic<Block*>)];
+
+        RemoteQueue() : head(nullptr)
+        {}
+    };
+    // Hands the thread's arena to the pool when the thread exits
+    struct ThreadArena {
+        NodeArena* arena;
+
+        ThreadArena() : arena(nullptr)
+        {}
+        ~ThreadArena() {
+            if (arena) {
+                _current() = nullptr;
+                _release(arena);
+            }
+        }
+    };
+
+    Block* _free[CLASSES];
+    char* _bump[CLASSES];
+    char* _bumpEnd[CLASSES];
+    RemoteQueue _remote[CLASSES];
+    std::vector<void*> _chunks;
+
+    NodeArena() {
+        for (size_t i = 0; i < CLASSES; ++i) {
+            _free[i] = nullptr;
+            _bump[i] = nullptr;
+            _bumpEnd[i] = nullptr;
+        }
+    }
+    NodeArena(const NodeArena& other) = delete;
+    NodeArena& operator=(const NodeArena& other) = delete;
+
+    void _newChunk(const size_t sizeClass) {
+        // map twice the size to cut an aligned chunk out of it
+        char* mapped = static_cast<char*>(mmap(nullptr, 2 * CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if (mapped == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        char* chunk = reinterpret_cast<char*>((reinterpret_cast<size_t>(mapped) + CHUNK_SIZE - 1) & ~(CHUNK_SIZE - 1));
+        if (chunk > mapped) {
+            munmap(mapped, chunk - mapped);
+        }
+        munmap(chunk + CHUNK_SIZE, mapped + CHUNK_SIZE - chunk);
+
+        Chunk* header = reinterpret_cast<Chunk*>(chunk);
+        header->owner = this;
+        header->sizeClass = sizeClass;
+        _chunks.push_back(chunk);
+        _bump[sizeClass] = chunk + (sizeof(Chunk) + GRANULE - 1) / GRANULE * GRANULE;
+        _bumpEnd[sizeClass] = chunk + CHUNK_SIZE;
+    }
+
+    // Arena of the calling thread, nullptr until it allocates; a plain pointer, so reading it never creates one
+    static NodeArena*& _current() {
+        static thread_local NodeArena* arena = nullptr;
+        return arena;
+    }
+    // Arenas of exited threads; touched only when a thread allocates first or exits
+    static std::mutex& _poolMutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+    static std::vector<NodeArena*>& _pool() {
+        static std::vector<NodeArena*> pool;
+        return pool;
+    }
+    static NodeArena* _adopt() {
+        std::lock_guard<std::mutex> lock(_poolMutex());
+        if (_pool().empty()) {
+            return new NodeArena();
+        }
+        NodeArena* arena = _pool().back();
+        _pool().pop_back();
+        return arena;
+    }
+    static void _release(NodeArena* arena) {
+        std::lock_guard<std::mutex> lock(_poolMutex());
+        _pool().push_back(arena);
+    }
+};
+
+/* Allocator for the nodes of PersistentAVLTree, PersistentMap and PersistentList, e.g.
+ * PersistentMap<int, int, std::less<int>, NodeAllocator<int> >. All instances are interchangeable. */
+template <class T>
+class NodeAllocator {
+public:
+    typedef T value_type;
+
+    NodeAllocator() noexcept
+    {}
+    template <class U>
+    NodeAllocator(const NodeAllocator<U>&) noexcept
+    {}
+
+    T* allocate(const size_t n) {
+        if (n * sizeof(T) <= NodeArena::MAX_BLOCK) {
+            return static_cast<T*>(NodeArena::local().allocate(n * sizeof(T)));
+        }
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    void deallocate(T* memory, const size_t n) {
+        if (n * sizeof(T) <= NodeArena::MAX_BLOCK) {
+            NodeArena::deallocate(memory);
+        } else {
+            ::operator delete(memory);
+        }
+    }
+
+    template <class U>
+    bool operator==(const NodeAllocator<U>&) const noexcept {
+        return true;
+    }
+    template <class U>
+    bool operator!=(const NodeAllocator<U>&) const noexcept {
+        return false;
+    }
+};
+
+#endif // NODE_ARENA_HPP
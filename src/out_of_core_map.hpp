@@ -0,0 +1,401 @@
+#ifndef OUT_OF_CORE_MAP_HPP
+#define OUT_OF_CORE_MAP_HPP
+
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Persistent map whose history lives on disk. Path-copied AVL nodes are immutable, so every node is
+ * appended to the node file once, after the write that created it, and a version is one root entry in
+ * the version file. Reads fault nodes into a cache of a fixed number of frames replaced by CLOCK;
+ * pin() keeps the top levels of a hot version resident, so its lookups only fault below them, along
+ * with its root entry. Other roots are read from the version file on each access, so memory use depends
+ * on the cache size and the pins alone, not on the history length. Opening existing files continues their
+ * history. Keys and values are stored byte by byte and must be trivially copyable. */
+template <class Key, class Value, class Comparator = std::less<Key> >
+class OutOfCoreMap {
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "OutOfCoreMap needs trivially copyable keys and values");
+
+private:
+    // Node i (from 1) is record i - 1 of the node file, 0 is no node
+    typedef uint64_t Offset;
+
+    struct Node {
+        Offset left;
+        Offset right;
+        uint64_t height;
+        Key key;
+        Value value;
+    };
+    struct VersionEntry {
+        Offset root;
+        uint64_t size;
+    };
+    struct Frame {
+        Offset offset;
+        Node node;
+        bool referenced;
+        unsigned int pins;
+    };
+
+public:
+    // Levels of a version kept resident by pin()
+    static const size_t PINNED_LEVELS = 6;
+
+    // Opens or creates 'path' (nodes) and 'path'.versions, caching at most 'cacheNodes' nodes
+    OutOfCoreMap(const std::string& path, const size_t cacheNodes) :
+        _nodesFd(-1), _versionsFd(-1), _capacity(cacheNodes), _hand(0), _misses(0) {
+        if (cacheNodes == 0) {
+            throw new std::out_of_range("The node cache needs at least one frame");
+        }
+        _nodesFd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        _versionsFd = open((path + ".versions").c_str(), O_RDWR | O_CREAT, 0644);
+        struct stat nodes;
+        struct stat versions;
+        if (_nodesFd < 0 || _versionsFd < 0 || fstat(_nodesFd, &nodes) != 0 || fstat(_versionsFd, &versions) != 0) {
+            _close();
+            throw new std::runtime_error("Cannot open " + path);
+        }
+        _written = nodes.st_size / sizeof(Node);
+        _versionsNumber = versions.st_size / sizeof(VersionEntry);
+        _frames.reserve(_capacity);
+        if (_versionsNumber == 0) {
+            _publish(0, 0);
+        }
+    }
+    OutOfCoreMap(const OutOfCoreMap& other) = delete;
+    OutOfCoreMap& operator=(const OutOfCoreMap& other) = delete;
+    ~OutOfCoreMap() {
+        _close();
+    }
+
+    inline size_t versionsNumber() const {
+        return _versionsNumber;
+    }
+    inline size_t size(const size_t version) const {
+        return _version(version).size;
+    }
+    inline bool empty(const size_t version) const {
+        return size(version) == 0;
+    }
+    // Nodes resident in the cache, never more than the cache size
+    inline size_t cachedNodes() const {
+        return _frames.size();
+    }
+    // Node reads that went to the file
+    inline size_t misses() const {
+        return _misses;
+    }
+
+    Value at(const size_t version, const Key& key) {
+        Node node;
+        if (!_find(_version(version).root, key, node)) {
+            throw new std::out_of_range("Key not found");
+        }
+        return node.value;
+    }
+    size_t count(const size_t version, const Key& key) {
+        Node node;
+        return _find(_version(version).root, key, node) ? 1 : 0;
+    }
+    // Calls visit(key, value) on every pair of 'version' in key order
+    template <class Visitor>
+    void visit(const size_t version, Visitor visit) {
+        _visit(_version(version).root, visit);
+    }
+
+    // New version with 'key' added to 'srcVersion', a present key keeps its value. Returns whether it was added
+    bool insert(const size_t srcVersion, const Key& key, const Value& value) {
+        VersionEntry src = _version(srcVersion);
+        _pending.clear();
+        bool added = false;
+        Offset root = _insert(src.root, key, value, added);
+        _flush();
+        _publish(root, added ? src.size + 1 : src.size);
+        return added;
+    }
+    void erase(const size_t srcVersion, const Key& key) {
+        VersionEntry src = _version(srcVersion);
+        _pending.clear();
+        bool erased = false;
+        Offset root = _erase(src.root, key, erased);
+        _flush();
+        _publish(root, erased ? src.size - 1 : src.size);
+    }
+
+    // Keeps the top PINNED_LEVELS levels of 'version' in the cache until unpin(version); pins of a version nest
+    void pin(const size_t version) {
+        VersionEntry entry = _version(version);
+        _pin(entry.root, PINNED_LEVELS, 1);
+        PinnedVersion& pinned = _pinned[version];
+        pinned.entry = entry;
+        ++pinned.pins;
+    }
+    // Releases one pin() of 'version', which must have one
+    void unpin(const size_t version) {
+        auto it = _pinned.find(version);
+        if (it == _pinned.end()) {
+            throw new std::out_of_range("Version is not pinned: " + std::to_string(version));
+        }
+        _pin(it->second.entry.root, PINNED_LEVELS, -1);
+        if (--it->second.pins == 0) {
+            _pinned.erase(it);
+        }
+    }
+
+private:
+    int _nodesFd;
+    int _versionsFd;
+    // entries in the version file
+    size_t _versionsNumber;
+    struct PinnedVersion {
+        // pin() calls not yet matched by unpin()
+        size_t pins;
+        VersionEntry entry;
+
+        PinnedVersion() : pins(0)
+        {}
+    };
+    std::unordered_map<size_t, PinnedVersion> _pinned;
+    // nodes in the file; nodes of the running write are in _pending until it ends
+    size_t _written;
+    std::vector<Node> _pending;
+    size_t _capacity;
+    std::vector<Frame> _frames;
+    std::unordered_map<Offset, size_t> _index;
+    size_t _hand;
+    size_t _misses;
+    Comparator _comparator;
+
+    void _close() {
+        if (_nodesFd >= 0) {
+            close(_nodesFd);
+        }
+        if (_versionsFd >= 0) {
+            close(_versionsFd);
+        }
+    }
+
+    VersionEntry _version(const size_t version) const {
+        if (version >= _versionsNumber) {
+            throw new std::out_of_range("Invalid version: " + std::to_string(version));
+        }
+        auto pinned = _pinned.find(version);
+        if (pinned != _pinned.end()) {
+            return pinned->second.entry;
+        }
+        VersionEntry entry;
+        if (pread(_versionsFd, &entry, sizeof(entry), version * sizeof(entry)) != (ssize_t)sizeof(entry)) {
+            throw new std::runtime_error("Cannot read version " + std::to_string(version));
+        }
+        return entry;
+    }
+    void _publish(const Offset root, const size_t size) {
+        VersionEntry entry;
+        entry.root = root;
+        entry.size = size;
+        if (pwrite(_versionsFd, &entry, sizeof(entry), _versionsNumber * sizeof(entry)) != (ssize_t)sizeof(entry)) {
+            throw new std::runtime_error("Cannot write version " + std::to_string(_versionsNumber));
+        }
+        ++_versionsNumber;
+    }
+    /* Appends the nodes of the finished write in one go; they stay cached as the hottest path. The nodes
+     * count as written before any is cached, so if no frame is left for one, the frames already indexed
+     * still hold the nodes at their offsets and the next write appends after them */
+    void _flush() {
+        if (_pending.empty()) {
+            return;
+        }
+        ssize_t bytes = _pending.size() * sizeof(Node);
+        if (pwrite(_nodesFd, _pending.data(), bytes, _written * sizeof(Node)) != bytes) {
+            throw new std::runtime_error("Cannot write nodes");
+        }
+        std::vector<Node> written;
+        written.swap(_pending);
+        Offset first = _written + 1;
+        _written += written.size();
+        for (size_t i = 0; i < written.size(); ++i) {
+            size_t frame = _victim();
+            _frames[frame].offset = first + i;
+            _frames[frame].node = written[i];
+            _frames[frame].referenced = true;
+            _index[first + i] = frame;
+        }
+    }
+
+    // Frame to load a node into: a free one, or the first unpinned one CLOCK finds unreferenced
+    size_t _victim() {
+        if (_frames.size() < _capacity) {
+            _frames.push_back(Frame());
+            return _frames.size() - 1;
+        }
+        for (size_t step = 0; step < 2 * _capacity; ++step) {
+            Frame& frame = _frames[_hand];
+            size_t current = _hand;
+            _hand = (_hand + 1) % _capacity;
+            if (frame.pins > 0) {
+                continue;
+            }
+            if (frame.referenced) {
+                frame.referenced = false;
+                continue;
+            }
+            _index.erase(frame.offset);
+            return current;
+        }
+        throw new std::out_of_range("The node cache is full of pinned nodes");
+    }
+    size_t _load(const Offset offset) {
+        auto it = _index.find(offset);
+        if (it != _index.end()) {
+            _frames[it->second].referenced = true;
+            return it->second;
+        }
+        ++_misses;
+        Node node;
+        if (pread(_nodesFd, &node, sizeof(Node), (offset - 1) * sizeof(Node)) != (ssize_t)sizeof(Node)) {
+            throw new std::runtime_error("Cannot read node " + std::to_string(offset));
+        }
+        size_t frame = _victim();
+        _frames[frame].offset = offset;
+        _frames[frame].node = node;
+        _frames[frame].referenced = true;
+        _index[offset] = frame;
+        return frame;
+    }
+    // A copy, since loading the next node may evict this one
+    Node _read(const Offset offset) {
+        if (offset > _written) {
+            return _pending[offset - _written - 1];
+        }
+        return _frames[_load(offset)].node;
+    }
+    uint64_t _height(const Offset offset) {
+        return offset ? _read(offset).height : 0;
+    }
+
+    void _pin(const Offset offset, const size_t levels, const int delta) {
+        if (!offset || levels == 0) {
+            return;
+        }
+        size_t frame = _load(offset);
+        _frames[frame].pins += delta;
+        Node node = _frames[frame].node;
+        _pin(node.left, levels - 1, delta);
+        _pin(node.right, levels - 1, delta);
+    }
+
+    Offset _makeNode(const Offset left, const Key& key, const Value& value, const Offset right) {
+        Node node;
+        node.left = left;
+        node.right = right;
+        uint64_t hl = _height(left);
+        uint64_t hr = _height(right);
+        node.height = (hl > hr ? hl : hr) + 1;
+        node.key = key;
+        node.value = value;
+        _pending.push_back(node);
+        return _written + _pending.size();
+    }
+    // New node over 'left', the pair and 'right', rotated when the heights differ by two
+    Offset _balance(const Offset left, const Key& key, const Value& value, const Offset right) {
+        if (_height(left) > _height(right) + 1) {
+            Node l = _read(left);
+            if (_height(l.left) >= _height(l.right)) {
+                return _makeNode(l.left, l.key, l.value, _makeNode(l.right, key, value, right));
+            }
+            Node lr = _read(l.right);
+            return _makeNode(_makeNode(l.left, l.key, l.value, lr.left), lr.key, lr.value,
+                             _makeNode(lr.right, key, value, right));
+        }
+        if (_height(right) > _height(left) + 1) {
+            Node r = _read(right);
+            if (_height(r.right) >= _height(r.left)) {
+                return _makeNode(_makeNode(left, key, value, r.left), r.key, r.value, r.right);
+            }
+            Node rl = _read(r.left);
+            return _makeNode(_makeNode(left, key, value, rl.left), rl.key, rl.value,
+                             _makeNode(rl.right, r.key, r.value, r.right));
+        }
+        return _makeNode(left, key, value, right);
+    }
+
+    bool _find(Offset offset, const Key& key, Node& node) {
+        while (offset) {
+            node = _read(offset);
+            if (_comparator(key, node.key)) {
+                offset = node.left;
+            } else if (_comparator(node.key, key)) {
+                offset = node.right;
+            } else {
+                return true;
+            }
+        }
+        return false;
+    }
+    template <class Visitor>
+    void _visit(const Offset offset, Visitor& visit) {
+        if (offset) {
+            Node node = _read(offset);
+            _visit(node.left, visit);
+            visit(node.key, node.value);
+            _visit(node.right, visit);
+        }
+    }
+    Offset _insert(const Offset offset, const Key& key, const Value& value, bool& added) {
+        if (!offset) {
+            added = true;
+            return _makeNode(0, key, value, 0);
+        }
+        Node node = _read(offset);
+        if (_comparator(key, node.key)) {
+            Offset left = _insert(node.left, key, value, added);
+            return added ? _balance(left, node.key, node.value, node.right) : offset;
+        }
+        if (_comparator(node.key, key)) {
+            Offset right = _insert(node.right, key, value, added);
+            return added ? _balance(node.left, node.key, node.value, right) : offset;
+        }
+        return offset;
+    }
+    Offset _removeMin(const Offset offset) {
+        Node node = _read(offset);
+        if (!node.left) {
+            return node.right;
+        }
+        return _balance(_removeMin(node.left), node.key, node.value, node.right);
+    }
+    Offset _erase(const Offset offset, const Key& key, bool& erased) {
+        if (!offset) {
+            return 0;
+        }
+        Node node = _read(offset);
+        if (_comparator(key, node.key)) {
+            Offset left = _erase(node.left, key, erased);
+            return erased ? _balance(left, node.key, node.value, node.right) : offset;
+        }
+        if (_comparator(node.key, key)) {
+            Offset right = _erase(node.right, key, erased);
+            return erased ? _balance(node.left, node.key, node.value, right) : offset;
+        }
+        erased = true;
+        if (!node.left || !node.right) {
+            return node.left ? node.left : node.right;
+        }
+        Node min = _read(node.right);
+        while (min.left) {
+            min = _read(min.left);
+        }
+        return _balance(node.left, min.key, min.value, _removeMin(node.right));
+    }
+};
+
+#endif // OUT_OF_CORE_MAP_HPP
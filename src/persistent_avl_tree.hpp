@@ -3,39 +3,63 @@
 
 #include <algorithm>
 #include <iostream>
+#include <limits>
 #include <vector>
 #include <memory>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_set>
+#include <utility>
+#include "epoch.hpp"
+#include "expected.hpp"
+#include "work_stealing.hpp"
+#include "workspace.h"
 
-template <class Key, class Value, class Comparator = std::less<Key>>
+/* Reads (find, iteration) walk raw pointers and may run in any number of threads at once. Versions
+ * dropped by squash() or clear() are retired to the EpochReclaimer, so a reader inside an
+ * EpochReclaimer::Guard can finish with them; creating versions still has to be synchronized with readers. */
+template <class Key, class Value, class Comparator = std::less<Key>, class Allocator = std::allocator<Key>>
 class PersistentAVLTree {
 public:
     typedef std::pair<const Key, Value> value_type;
+    // Pairs per piece of work of parallel_for_each and parallel_reduce
+    static const size_t DEFAULT_GRAIN = 1024;
 
 private:
+    // Key and value live in an immutable block shared by every copy of the node,
+    // so path copying costs the same regardless of the payload size
     struct Node {
         std::shared_ptr<Node> left;
         std::shared_ptr<Node> right;
-        value_type kvPair;
+        std::shared_ptr<const value_type> kvPair;
         unsigned int height;
+        size_t edit;
 
         Node(const Key & newKey = Key(), const Value & newValue = Value()) :
-            left(nullptr), right(nullptr), kvPair(newKey, newValue), height(1)
+            left(nullptr), right(nullptr), kvPair(std::make_shared<const value_type>(newKey, newValue)), height(1),
+            edit(0)
+        {}
+        Node(const std::shared_ptr<const value_type>& kvPair_) :
+            left(nullptr), right(nullptr), kvPair(kvPair_), height(1), edit(0)
         {}
 
-        Key key() const {
-            return kvPair.first;
+        const Key& key() const {
+            return kvPair->first;
         }
-        Value value() const {
-            return kvPair.second;
+        const Value& value() const {
+            return kvPair->second;
         }
     };
 
     struct Version {
         std::shared_ptr<Node> root;
         size_t size;
+        // version this one was derived from, SQUASHED once squash() has dropped it
+        size_t parent;
 
-        Version(std::shared_ptr<Node> root_,  const size_t size_) :
-            root(root_), size(size_)
+        Version(std::shared_ptr<Node> root_,  const size_t size_, const size_t parent_) :
+            root(root_), size(size_), parent(parent_)
         {}
 
         bool operator==(const Version& other) {
@@ -46,53 +70,29 @@ private:
         }
     };
 
+    /* Walks raw pointers, so iterating costs no reference count updates. Valid while its version
+     * exists: the tree keeps the nodes alive, or an EpochReclaimer::Guard does once the version is
+     * dropped. The path to the current node is only built by the first increment. */
     template<class T>
     class TreeIterator : public std::iterator<std::forward_iterator_tag, T> {
     public:
-        TreeIterator() : _cur(nullptr)
-        {}
-        TreeIterator(std::shared_ptr<Node> node) : _cur(node)
+        TreeIterator() : _root(nullptr), _cur(nullptr)
         {}
-        TreeIterator(const TreeIterator& other) : _cur(other._cur)
+        TreeIterator(const Node* root, const Node* node) : _root(root), _cur(node)
         {}
-        TreeIterator(TreeIterator&& other) : _cur(other._cur) {
-            other._cur = nullptr;
-        }
-        TreeIterator& operator=(const TreeIterator& other) {
-            if (*this != other) {
-                _cur = other._cur;
-            }
-            return* this;
-        }
-        TreeIterator& operator=(TreeIterator&& other) {
-            if (*this != other) {
-                std::swap(_cur, other._cur);
-            }
-            return* this;
-        }
+
         TreeIterator& operator++() {
             if (!_cur) {
                 return* this;
             }
-            if (_cur->right) {
-                _cur = _cur->right;
-                while (_cur && _cur->left) {
-                    _cur = _cur->left;
-                }
-            } else {
-                std::shared_ptr<Node> parent = _cur->parent;
-                if (nullptr == parent) {
-                    _cur = nullptr;
-                } else {
-                    while (parent && _cur == parent->right) {
-                        _cur = parent;
-                        parent = parent->parent;
-                    }
-                    if (_cur && _cur->right != parent) {
-                        _cur = parent;
-                    }
-                }
+            if (_path.empty()) {
+                _buildPath();
             }
+            _path.pop_back();
+            for (const Node* node = _cur->right.get(); node; node = node->left.get()) {
+                _path.push_back(node);
+            }
+            _cur = _path.empty() ? nullptr : _path.back();
             return* this;
         }
         TreeIterator operator++(int) {
@@ -100,63 +100,90 @@ private:
             operator++();
             return tmp;
         }
-        bool operator==(const TreeIterator& other) {
-            return _cur == other._cur;
-        }
         bool operator==(const TreeIterator& other) const {
             return _cur == other._cur;
         }
-        bool operator!=(const TreeIterator& other) {
-            return _cur != other._cur;
-        }
         bool operator!=(const TreeIterator& other) const {
             return _cur != other._cur;
         }
-        T& operator*() {
+        T& operator*() const {
             if (_cur) {
-                return _cur->kvPair;
+                return *(_cur->kvPair);
             } else {
                 throw new std::out_of_range("Iterator is out of range");
             }
         }
-        T* operator->() {
+        T* operator->() const {
             if (_cur) {
-                return &(_cur->kvPair);
+                return _cur->kvPair.get();
             } else {
                 throw new std::out_of_range("Iterator is out of range");
             }
         }
     private:
-        std::shared_ptr<Node> _cur;
+        const Node* _root;
+        const Node* _cur;
+        // ancestors whose left subtree holds the current node, then the node itself
+        std::vector<const Node*> _path;
+
+        void _buildPath() {
+            Comparator comparator;
+            for (const Node* node = _root; node != _cur; ) {
+                if (comparator(_cur->key(), node->key())) {
+                    _path.push_back(node);
+                    node = node->left.get();
+                } else {
+                    node = node->right.get();
+                }
+            }
+            _path.push_back(_cur);
+        }
     };
 
 public:
     typedef TreeIterator<const value_type> iterator;
 
-    PersistentAVLTree() {
-        _versions.push_back(Version(nullptr, 0));
+    PersistentAVLTree() : _lastEdit(0), _workspace(nullptr) {
+        _versions.push_back(Version(nullptr, 0, 0));
+    }
+    // Member of 'workspace': the tree is empty in every version the workspace already has
+    explicit PersistentAVLTree(Workspace& workspace) : _lastEdit(0), _workspace(&workspace) {
+        _versions.assign(workspace.versionsNumber(), Version(nullptr, 0, 0));
+        _workspace->_attach(this, [this](size_t version, size_t srcVersion) { _alias(version, srcVersion); },
+                            [this](size_t version) { _drop(version); });
     }
-    PersistentAVLTree(const PersistentAVLTree& other) : _versions(other._versions)
+    // Copies never belong to a workspace. Workspace members can't be assigned to or from, their versions
+    // are numbered by the workspace
+    PersistentAVLTree(const PersistentAVLTree& other)
+        : _versions(other._versions), _lastEdit(other._lastEdit), _workspace(nullptr)
     {}
-    PersistentAVLTree(PersistentAVLTree&& other) : _versions(other._versions) {
+    PersistentAVLTree(PersistentAVLTree&& other)
+        : _versions(other._versions), _lastEdit(other._lastEdit), _workspace(nullptr) {
         other.clear();
     }
     PersistentAVLTree& operator=(const PersistentAVLTree& other) {
         if (*this != other) {
+            _checkAssignable(other);
             if (!_versions.empty()) {
                 clear();
             }
             _versions = other._versions;
+            _lastEdit = std::max(_lastEdit, other._lastEdit);
         }
         return *this;
     }
     PersistentAVLTree& operator=(PersistentAVLTree&& other) {
         if (*this != other) {
+            _checkAssignable(other);
             std::swap(_versions, other._versions);
+            std::swap(_lastEdit, other._lastEdit);
         }
         return *this;
     }
     ~PersistentAVLTree() {
+        if (_workspace) {
+            _workspace->_detach(this);
+        }
         if (!_versions.empty()) {
             clear();
         }
@@ -176,11 +203,11 @@ public:
     }
 
     inline iterator begin(const size_t version) const noexcept {
-        std::shared_ptr<Node> cur = _versions[version].root;
-        while (cur->left) {
-            cur = cur->left;
+        const Node* cur = _versions[version].root.get();
+        while (cur && cur->left) {
+            cur = cur->left.get();
         }
-        return iterator(cur);
+        return iterator(_versions[version].root.get(), cur);
     }
     inline iterator end() const noexcept {
         return iterator();
@@ -195,69 +222,534 @@ public:
     inline size_t versionsNumber() const {
         return _versions.size();
     }
+    // A workspace member keeps its versions, all of them become empty
     inline void clear() {
-        _versions.clear();
+        std::vector<Version> dropped;
+        if (_workspace) {
+            dropped.assign(_versions.size(), Version(nullptr, 0, 0));
+        }
+        std::swap(dropped, _versions);
+        _retire(std::move(dropped));
     }
 
-    std::pair<iterator, bool> insert(const size_t srcVersion, const Key& key, const Value& value) {
-        if (_versions.size() - 1 < srcVersion) {
-            throw new std::out_of_range("Invalid version: " + srcVersion);
+    /* Deferred-write mode: edits are applied to an unpublished tip whose nodes are owned by the batch
+     * and mutated in place, so a burst of edits costs one path copy per touched node instead of one
+     * per edit. Only publish() creates a version; the batch then continues from the published one. */
+    class Batch {
+        friend class PersistentAVLTree;
+
+    public:
+        Batch(Batch&& other)
+            : _tree(other._tree), _srcVersion(other._srcVersion), _root(other._root), _size(other._size),
+              _edit(other._edit) {
+            other._tree = nullptr;
+            other._root = nullptr;
+        }
+        Batch(const Batch& other) = delete;
+        Batch& operator=(const Batch& other) = delete;
+
+        std::pair<iterator, bool> insert(const Key& key, const Value& value) {
+            std::shared_ptr<Node> node;
+            bool added = false;
+            auto make = [&]() {
+                return std::allocate_shared<const value_type>(_tree->_allocator, key, value);
+            };
+            _root = _tree->_insertRoot(_root, key, make, _edit, node, added);
+            if (added) {
+                ++_size;
+            }
+            return std::make_pair(iterator(_root.get(), node.get()), added);
+        }
+        std::pair<iterator, bool> insert(const value_type& pair) {
+            return insert(pair.first, pair.second);
+        }
+        void erase(const Key& key) {
+            bool erased = false;
+            _root = _tree->_erase(_root, key, _edit, erased);
+            if (erased) {
+                --_size;
+            }
+        }
+        iterator find(const Key& key) const {
+            return _tree->_find(_root, key);
+        }
+        size_t size() const {
+            return _size;
+        }
+        bool empty() const {
+            return _size == 0;
         }
 
-        auto root = _versions[srcVersion].root;
-        auto size = _versions[srcVersion].size;
+        // Materializes the tip as a new version of the tree and returns its number
+        size_t publish() {
+            _srcVersion = _tree->_pushVersion(Version(_root, _size, _srcVersion));
+            _edit = _tree->_nextEdit();
+            return _srcVersion;
+        }
 
-        if (!root) {
-            std::shared_ptr<Node> newRoot = std::make_shared<Node>(key, value);
-            _versions.push_back(Version(newRoot, size + 1));
-            return std::make_pair(iterator(newRoot), true);
+    private:
+        Batch(PersistentAVLTree& tree, const size_t srcVersion)
+            : _tree(&tree), _srcVersion(srcVersion), _root(tree._versions[srcVersion].root),
+              _size(tree._versions[srcVersion].size),
+              _edit(tree._nextEdit())
+        {}
+
+        PersistentAVLTree* _tree;
+        size_t _srcVersion;
+        std::shared_ptr<Node> _root;
+        size_t _size;
+        size_t _edit;
+    };
+
+    std::pair<iterator, bool> insert(const size_t srcVersion, const Key& key, const Value& value) {
+        return _insertVersion(srcVersion, key, [&]() {
+            return std::allocate_shared<const value_type>(_allocator, key, value);
+        });
+    }
+    // The pair is moved into the new node, and left untouched if the key is present
+    std::pair<iterator, bool> insert(const size_t srcVersion, value_type&& pair) {
+        return _insertVersion(srcVersion, pair.first, [&]() {
+            return std::allocate_shared<const value_type>(_allocator, std::move(pair));
+        });
+    }
+    // insert() of the value constructed from 'args', which is not constructed at all if the key is present
+    template <class... Args>
+    std::pair<iterator, bool> try_emplace(const size_t srcVersion, const Key& key, Args&&... args) {
+        return _insertVersion(srcVersion, key, [&]() {
+            return std::allocate_shared<const value_type>(_allocator, std::piecewise_construct,
+                                                          std::forward_as_tuple(key),
+                                                          std::forward_as_tuple(std::forward<Args>(args)...));
+        });
+    }
+
+    // insert() reporting an invalid version as the error; the value tells whether the key was added
+    Expected<bool> try_insert(const size_t srcVersion, const Key& key, const Value& value) {
+        if (!_isValid(srcVersion)) {
+            return AccessError::INVALID_VERSION;
         }
-        std::shared_ptr<Node> newRoot = _insert(root, key, value);
-        _versions.push_back(Version(newRoot, size + 1));
-        return std::make_pair(iterator(newRoot), true);
+        return insert(srcVersion, key, value).second;
     }
 
     void erase(const size_t srcVersion, const Key& key) {
-        if (_versions.size() < srcVersion) {
-            throw new std::out_of_range("Invalid version: " + srcVersion);
+        if (!_isValid(srcVersion)) {
+            throwAccessError(AccessError::INVALID_VERSION, srcVersion);
+        }
+        _eraseVersion(srcVersion, key);
+    }
+    // erase() reporting an invalid version as the error; the value tells whether the key was there
+    Expected<bool> try_erase(const size_t srcVersion, const Key& key) {
+        if (!_isValid(srcVersion)) {
+            return AccessError::INVALID_VERSION;
+        }
+        return _eraseVersion(srcVersion, key);
+    }
+
+    /* New version holding 'srcVersion' and the pairs of [first, last), built on all cores: the pairs are
+     * sorted in parallel, then the perfectly balanced tree over them is built bottom-up, one subtree per
+     * thread. As with insert(), a key keeps the value it has in 'srcVersion' or, failing that, its
+     * first value in the input. Returns the new version */
+    template <class InputIt>
+    size_t parallel_build(const size_t srcVersion, InputIt first, InputIt last) {
+        if (!_isValid(srcVersion)) {
+            throw new std::out_of_range("Invalid version: " + std::to_string(srcVersion));
+        }
+        std::vector<std::pair<Key, Value> > pairs;
+        pairs.reserve(_versions[srcVersion].size);
+        visit(srcVersion, [&pairs](const value_type& pair) { pairs.push_back(pair); });
+        pairs.insert(pairs.end(), first, last);
+
+        size_t threads = std::max(1u, std::thread::hardware_concurrency());
+        _parallelSort(pairs, threads);
+        const Comparator& comparator = _comparator;
+        pairs.erase(std::unique(pairs.begin(), pairs.end(),
+                                [&comparator](const std::pair<Key, Value>& left, const std::pair<Key, Value>& right) {
+                                    return !comparator(left.first, right.first);
+                                }),
+                    pairs.end());
+
+        size_t forks = 0;
+        while (((size_t)1 << forks) < threads) {
+            ++forks;
         }
+        std::shared_ptr<Node> root = _buildBalanced(pairs.data(), pairs.size(), _nextEdit(), forks);
+        return _pushVersion(Version(root, pairs.size(), srcVersion));
+    }
 
-        auto root = _versions[srcVersion].root;
-        auto size = _versions[srcVersion].size;
-        std::shared_ptr<Node> newRoot = _erase(root, key);
-        _versions.push_back(Version(newRoot,  size - 1));
+    /* Merges what 'a' and 'b' changed relative to 'base' into a new version derived from 'a'. A key
+     * changed on one side only gets that side's pair or absence; a key both sides changed differently
+     * is a conflict: resolve(key, base, a, b, merged) gets its three values, nullptr where absent, and
+     * returns true with 'merged' set to keep the key or false to drop it. A pair counts as changed once
+     * it was written, even with an equal value. Subtrees the versions share are taken whole, so the cost
+     * grows with the changed regions, not with the size. Returns the new version and the conflicting
+     * keys in key order */
+    template <class Resolver>
+    std::pair<size_t, std::vector<Key> > merge3(const size_t base, const size_t a, const size_t b, Resolver resolve) {
+        if (!_isValid(base) || !_isValid(a) || !_isValid(b)) {
+            throw new std::out_of_range("Invalid merge versions");
+        }
+        std::vector<Key> conflicts;
+        long long adjustment = 0;
+        std::shared_ptr<Node> root = _merge3(_versions[base].root, _versions[a].root, _versions[b].root, _nextEdit(),
+                                             resolve, conflicts, adjustment);
+        // every key is in the merge as often as in 'a' and 'b' together minus 'base', except for the adjustment
+        size_t size = _versions[a].size + _versions[b].size - _versions[base].size + adjustment;
+        return std::make_pair(_pushVersion(Version(root, size, a)), std::move(conflicts));
+    }
+
+    Batch batch(const size_t srcVersion) {
+        if (!_isValid(srcVersion)) {
+            throwAccessError(AccessError::INVALID_VERSION, srcVersion);
+        }
+        return Batch(*this, srcVersion);
+    }
+
+    /* Drops the chain of versions between 'from' and its descendant 'to', so 'to' is derived directly
+     * from 'from'. Every dropped version must have exactly one child; nodes referenced only by the
+     * dropped versions are released. Dropped version numbers are not reused and become invalid.
+     * Not available for workspace members, whose version numbers are shared. */
+    void squash(const size_t from, const size_t to) {
+        if (_workspace || !_isValid(from) || !_isValid(to) || from == to) {
+            throw new std::out_of_range("Invalid squash range");
+        }
+        std::unordered_set<size_t> chain;
+        for (size_t cur = _versions[to].parent; cur != from; cur = _versions[cur].parent) {
+            if (cur == 0) {
+                throw new std::out_of_range("Squash bounds are not an ancestor and its descendant");
+            }
+            chain.insert(cur);
+        }
+        for (size_t version = 1; version < _versions.size(); ++version) {
+            if (version != to && !chain.count(version) && chain.count(_versions[version].parent)) {
+                throw new std::out_of_range("Versions between squash bounds must form a chain");
+            }
+        }
+        std::vector<Version> dropped;
+        for (auto version : chain) {
+            dropped.push_back(_versions[version]);
+            _versions[version] = Version(nullptr, 0, SQUASHED);
+        }
+        _retire(std::move(dropped));
+        _versions[to].parent = from;
     }
 
     inline iterator find(const size_t version, const Key& key) const {
-        auto cur = _versions[version].root;
-        if (!cur) {
-            return end();
+        return _find(_versions[version].root, key);
+    }
+    // find() reporting an invalid version or a missing key as the error instead of returning end()
+    Expected<const value_type&> try_find(const size_t version, const Key& key) const {
+        if (!_isValid(version)) {
+            return AccessError::INVALID_VERSION;
         }
-        while (cur) {
-            if (_comparator(key, cur->key())) {
-                cur = cur->left;
-            } else if (_comparator(cur->key(), key)) {
-                cur = cur->right;
+        const Node* node = _findNode(_versions[version].root.get(), key);
+        if (!node) {
+            return AccessError::KEY_NOT_FOUND;
+        }
+        return *node->kvPair;
+    }
+    // Value of 'key' without any check, for trusted loops: 'version' must be valid and hold 'key'
+    inline const Value& unchecked_at(const size_t version, const Key& key) const {
+        return _findNode(_versions[version].root.get(), key)->value();
+    }
+    // Calls 'visit' on every pair of 'version' in key order
+    template <class Visitor>
+    void visit(const size_t version, Visitor visit) const {
+        if (!_isValid(version)) {
+            throw new std::out_of_range("Invalid version: " + std::to_string(version));
+        }
+        _visit(_versions[version].root.get(), visit);
+    }
+    // Calls 'visit' on every pair of 'version' whose key lies in [low, high], in key order. O(log n + k)
+    template <class Visitor>
+    void visitRange(const size_t version, const Key& low, const Key& high, Visitor visit) const {
+        if (!_isValid(version)) {
+            throw new std::out_of_range("Invalid version: " + std::to_string(version));
+        }
+        _visitRange(_versions[version].root, low, high, visit);
+    }
+    /* Calls 'f' on every pair of 'version' from all hardware threads, in no particular order. The tree is
+     * cut into subtrees of about 'grainSize' pairs plus the nodes above them, which idle threads steal. */
+    template <class Function>
+    void parallel_for_each(const size_t version, Function f, const size_t grainSize = DEFAULT_GRAIN) const {
+        std::vector<Piece> pieces = _pieces(version, grainSize);
+        workStealingFor(pieces.size(), [this, &pieces, &f](const size_t i) {
+            if (pieces[i].subtree) {
+                _visit(pieces[i].node, f);
             } else {
-                break;
+                f(*pieces[i].node->kvPair);
             }
+        });
+    }
+    /* Reduces the pairs of 'version' in parallel: every piece is folded from 'identity' with
+     * fold(T, const value_type&), and the partial results are merged with combine(T, T) in key order.
+     * Equals the sequential in-order fold when 'combine' is associative with 'identity' as its identity
+     * and fold(a, x) == combine(a, fold(identity, x)). */
+    template <class T, class Fold, class Combine>
+    T parallel_reduce(const size_t version, const T& identity, Fold fold, Combine combine,
+                      const size_t grainSize = DEFAULT_GRAIN) const {
+        std::vector<Piece> pieces = _pieces(version, grainSize);
+        std::vector<Partial<T> > results(pieces.size(), Partial<T>(identity));
+        workStealingFor(pieces.size(), [this, &pieces, &results, &identity, &fold](const size_t i) {
+            T result = identity;
+            if (pieces[i].subtree) {
+                auto visit = [&result, &fold](const value_type& pair) { result = fold(result, pair); };
+                _visit(pieces[i].node, visit);
+            } else {
+                result = fold(result, *pieces[i].node->kvPair);
+            }
+            results[i].value = result;
+        });
+        T total = identity;
+        for (const Partial<T>& result : results) {
+            total = combine(total, result.value);
         }
-        if (cur) {
-            return iterator(cur);
-        }
-        return end();
+        return total;
+    }
+    // Reduces the values of 'version' with the associative 'op', 'identity' being its identity
+    template <class Op>
+    Value parallel_reduce(const size_t version, const Value& identity, Op op) const {
+        return parallel_reduce(version, identity,
+                               [&op](const Value& result, const value_type& pair) { return op(result, pair.second); },
+                               op);
     }
 
 private:
+    // AVL height never exceeds 1.45 * log2(n + 2), so this covers any size_t element count
+    static const size_t MAX_HEIGHT = 96;
+    static const size_t SQUASHED = std::numeric_limits<size_t>::max();
+    // Unit of work of the parallel traversals: a whole subtree or a single node above the subtrees
+    struct Piece {
+        const Node* node;
+        bool subtree;
+    };
+    /* Result of one piece of parallel_reduce. Every piece writes an object of its own, which
+     * std::vector<bool> would not give, and the padding keeps neighbouring pieces off one cache line */
+    template <class T>
+    struct Partial {
+        T value;
+        char padding[64];
+
+        Partial(const T& value_) : value(value_)
+        {}
+    };
+
     std::vector<Version> _versions;
     Comparator _comparator;
+    // nodes and their key/value blocks come from it, see NodeAllocator
+    Allocator _allocator;
+    size_t _lastEdit;
+    Workspace* _workspace;
+
+    void _checkAssignable(const PersistentAVLTree& other) const {
+        if (_workspace || other._workspace) {
+            throw new std::out_of_range("Can't assign containers shared with a workspace");
+        }
+    }
+    bool _isValid(const size_t version) const {
+        return version < _versions.size() && _versions[version].parent != SQUASHED;
+    }
+    // Every write operation gets its own edit token; nodes carrying it may be changed in place by it
+    size_t _nextEdit() {
+        return ++_lastEdit;
+    }
+    // Every new version goes through here so that the workspace, if any, numbers it for all members
+    size_t _pushVersion(const Version& version) {
+        if (!_workspace) {
+            _versions.push_back(version);
+            return _versions.size() - 1;
+        }
+        size_t number = _workspace->_beginVersion(version.parent);
+        _versions.push_back(version);
+        _workspace->_endVersion(number, version.parent);
+        return number;
+    }
+    // Dropped versions are released through the EpochReclaimer, readers inside a guard may still walk them
+    static void _retire(std::vector<Version>&& versions) {
+        if (!versions.empty()) {
+            EpochReclaimer::retire(std::make_shared<const std::vector<Version> >(std::move(versions)));
+        }
+    }
+    // Workspace version made without this tree: same contents as 'srcVersion'
+    void _alias(const size_t version, const size_t srcVersion) {
+        if (_versions.size() == version) {
+            _versions.push_back(Version(_versions[srcVersion].root, _versions[srcVersion].size, srcVersion));
+        }
+    }
+    // Workspace version whose commit failed
+    void _drop(const size_t version) {
+        if (_versions.size() == version + 1) {
+            _versions.pop_back();
+        }
+    }
+    std::shared_ptr<Node> _makeNode(const Key& key, const Value& value, const size_t edit) {
+        return _makeNode(std::allocate_shared<const value_type>(_allocator, key, value), edit);
+    }
+    std::shared_ptr<Node> _makeNode(const std::shared_ptr<const value_type>& kvPair, const size_t edit) {
+        std::shared_ptr<Node> node = std::allocate_shared<Node>(_allocator, kvPair);
+        node->edit = edit;
+        return node;
+    }
+    // 'make' returns the pair of the new node, it is called only once the key is known to be absent
+    template <class Make>
+    std::pair<iterator, bool> _insertVersion(const size_t srcVersion, const Key& key, Make make) {
+        if (!_isValid(srcVersion)) {
+            throwAccessError(AccessError::INVALID_VERSION, srcVersion);
+        }
+
+        auto root = _versions[srcVersion].root;
+        auto size = _versions[srcVersion].size;
 
-    std::shared_ptr<Node> _copyNode(std::shared_ptr<Node> node) {
-        std::shared_ptr<Node> copy = std::make_shared<Node>(node->key(), node->value());
+        std::shared_ptr<Node> node;
+        bool added = false;
+        std::shared_ptr<Node> newRoot = _insertRoot(root, key, make, _nextEdit(), node, added);
+        _pushVersion(Version(newRoot, added ? size + 1 : size, srcVersion));
+        return std::make_pair(iterator(newRoot.get(), node.get()), added);
+    }
+    // Whether the key was there
+    bool _eraseVersion(const size_t srcVersion, const Key& key) {
+        auto root = _versions[srcVersion].root;
+        auto size = _versions[srcVersion].size;
+        bool erased = false;
+        std::shared_ptr<Node> newRoot = _erase(root, key, _nextEdit(), erased);
+        _pushVersion(Version(newRoot, erased ? size - 1 : size, srcVersion));
+        return erased;
+    }
+    // Returns the node itself if it belongs to the current write operation, otherwise its copy
+    std::shared_ptr<Node> _copyNode(const std::shared_ptr<Node>& node, const size_t edit) {
+        if (node->edit == edit) {
+            return node;
+        }
+        std::shared_ptr<Node> copy = std::allocate_shared<Node>(_allocator, node->kvPair);
         copy->left = node->left;
         copy->right = node->right;
+        copy->height = node->height;
+        copy->edit = edit;
         return copy;
     }
+    iterator _find(const std::shared_ptr<Node>& root, const Key& key) const {
+        const Node* node = _findNode(root.get(), key);
+        return node ? iterator(root.get(), node) : end();
+    }
+    const Node* _findNode(const Node* cur, const Key& key) const {
+        while (cur) {
+            if (_comparator(key, cur->key())) {
+                cur = cur->left.get();
+            } else if (_comparator(cur->key(), key)) {
+                cur = cur->right.get();
+            } else {
+                return cur;
+            }
+        }
+        return nullptr;
+    }
+    template <class Visitor>
+    void _visit(const Node* node, Visitor& visit) const {
+        if (node) {
+            _visit(node->left.get(), visit);
+            visit(*node->kvPair);
+            _visit(node->right.get(), visit);
+        }
+    }
+    // Pieces of 'version' in key order, subtrees no higher than needed to hold 'grainSize' pairs
+    std::vector<Piece> _pieces(const size_t version, const size_t grainSize) const {
+        if (!_isValid(version)) {
+            throw new std::out_of_range("Invalid version: " + std::to_string(version));
+        }
+        unsigned int grainHeight = 1;
+        while (grainHeight < 63 && (((size_t)1 << grainHeight) - 1) < grainSize) {
+            ++grainHeight;
+        }
+        std::vector<Piece> pieces;
+        _collectPieces(_versions[version].root.get(), grainHeight, pieces);
+        return pieces;
+    }
+    void _collectPieces(const Node* node, const unsigned int grainHeight, std::vector<Piece>& pieces) const {
+        if (!node) {
+            return;
+        }
+        if (node->height <= grainHeight) {
+            pieces.push_back(Piece{node, true});
+            return;
+        }
+        _collectPieces(node->left.get(), grainHeight, pieces);
+        pieces.push_back(Piece{node, false});
+        _collectPieces(node->right.get(), grainHeight, pieces);
+    }
+    template <class Visitor>
+    void _visitRange(const std::shared_ptr<Node>& node, const Key& low, const Key& high, Visitor& visit) const {
+        if (!node) {
+            return;
+        }
+        bool aboveLow = !_comparator(node->key(), low);
+        bool belowHigh = !_comparator(high, node->key());
+        if (aboveLow) {
+            _visitRange(node->left, low, high, visit);
+        }
+        if (aboveLow && belowHigh) {
+            visit(*node->kvPair);
+        }
+        if (belowHigh) {
+            _visitRange(node->right, low, high, visit);
+        }
+    }
+    // Stable: equal keys keep their order, so the first of them survives deduplication
+    void _parallelSort(std::vector<std::pair<Key, Value> >& pairs, const size_t threads) const {
+        const Comparator& comparator = _comparator;
+        auto less = [&comparator](const std::pair<Key, Value>& left, const std::pair<Key, Value>& right) {
+            return comparator(left.first, right.first);
+        };
+        size_t runs = std::max<size_t>(1, std::min(threads, pairs.size() / 4096));
+        std::vector<size_t> bounds;
+        for (size_t i = 0; i <= runs; ++i) {
+            bounds.push_back(pairs.size() * i / runs);
+        }
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < runs; ++i) {
+            workers.push_back(std::thread([&pairs, &bounds, &less, i]() {
+                std::stable_sort(pairs.begin() + bounds[i], pairs.begin() + bounds[i + 1], less);
+            }));
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        // merge neighbouring runs pairwise, each level in parallel
+        for (size_t width = 1; width < runs; width *= 2) {
+            workers.clear();
+            for (size_t i = 0; i + width < runs; i += 2 * width) {
+                size_t begin = bounds[i];
+                size_t middle = bounds[i + width];
+                size_t end = bounds[std::min(i + 2 * width, runs)];
+                workers.push_back(std::thread([&pairs, &less, begin, middle, end]() {
+                    std::inplace_merge(pairs.begin() + begin, pairs.begin() + middle, pairs.begin() + end, less);
+                }));
+            }
+            for (auto& worker : workers) {
+                worker.join();
+            }
+        }
+    }
+    // Subtree over the sorted 'pairs', the two halves built in parallel for the top 'forks' levels
+    std::shared_ptr<Node> _buildBalanced(const std::pair<Key, Value>* pairs, const size_t size, const size_t edit,
+                                         const size_t forks) {
+        if (size == 0) {
+            return nullptr;
+        }
+        size_t middle = size / 2;
+        std::shared_ptr<Node> node = _makeNode(pairs[middle].first, pairs[middle].second, edit);
+        if (forks > 0) {
+            std::shared_ptr<Node> left;
+            std::thread worker([this, &left, pairs, middle, edit, forks]() {
+                left = _buildBalanced(pairs, middle, edit, forks - 1);
+            });
+            node->right = _buildBalanced(pairs + middle + 1, size - middle - 1, edit, forks - 1);
+            worker.join();
+            node->left = left;
+        } else {
+            node->left = _buildBalanced(pairs, middle, edit, 0);
+            node->right = _buildBalanced(pairs + middle + 1, size - middle - 1, edit, 0);
+        }
+        _fixHeight(node);
+        return node;
+    }
     unsigned int _height(std::shared_ptr<Node> node) {
         return node ? node->height : 0;
     }
@@ -269,84 +761,250 @@ private:
         unsigned int hr = _height(node->right);
         node->height = (hl > hr ? hl : hr) + 1;
     }
-    std::shared_ptr<Node> _rotateRight(std::shared_ptr<Node> node) {
-        std::shared_ptr<Node> l = node->left;
+    // Rotations change 'node' and one of its children, both have to be owned by 'edit'
+    std::shared_ptr<Node> _rotateRight(std::shared_ptr<Node> node, const size_t edit) {
+        std::shared_ptr<Node> l = _copyNode(node->left, edit);
         node->left = l->right;
         l->right = node;
         _fixHeight(node);
         _fixHeight(l);
         return l;
     }
-    std::shared_ptr<Node> _rotateleft(std::shared_ptr<Node> node) {
-        std::shared_ptr<Node> r = node->right;
+    std::shared_ptr<Node> _rotateleft(std::shared_ptr<Node> node, const size_t edit) {
+        std::shared_ptr<Node> r = _copyNode(node->right, edit);
         node->right = r->left;
         r->left = node;
         _fixHeight(node);
         _fixHeight(r);
         return r;
     }
-    std::shared_ptr<Node> _balance(std::shared_ptr<Node> node) {
+    std::shared_ptr<Node> _balance(std::shared_ptr<Node> node, const size_t edit) {
         _fixHeight(node);
         if (_getBalance(node) == 2) {
             if (_getBalance(node->right) < 0) {
-                node->right = _rotateRight(node->right);
+                node->right = _rotateRight(_copyNode(node->right, edit), edit);
             }
-            return _rotateleft(node);
+            return _rotateleft(node, edit);
         }
         if (_getBalance(node) == -2) {
             if (_getBalance(node->left) > 0) {
-                node->left = _rotateleft(node->left);
+                node->left = _rotateleft(_copyNode(node->left, edit), edit);
             }
-            return _rotateRight(node);
+            return _rotateRight(node, edit);
         }
         return node;
     }
-    std::shared_ptr<Node> _insert(std::shared_ptr<Node> root, const Key& key, const Value& value) {
+    template <class Make>
+    std::shared_ptr<Node> _insertRoot(const std::shared_ptr<Node>& root, const Key& key, Make& make,
+                                      const size_t edit, std::shared_ptr<Node>& node, bool& added) {
+        if (root) {
+            std::shared_ptr<Node> newRoot = _appendMax(root, key, make, edit, node);
+            if (newRoot) {
+                added = true;
+                return newRoot;
+            }
+        }
+        return _insert(root, key, make, edit, node, added);
+    }
+    // 'node' receives the node holding 'key', 'added' tells whether it was created by this call
+    template <class Make>
+    std::shared_ptr<Node> _insert(const std::shared_ptr<Node>& root, const Key& key, Make& make,
+                                  const size_t edit, std::shared_ptr<Node>& node, bool& added) {
         if (!root) {
-            return std::make_shared<Node>(key, value);
+            node = _makeNode(make(), edit);
+            added = true;
+            return node;
+        }
+        if (_comparator(key, root->key())) {
+            std::shared_ptr<Node> left = _insert(root->left, key, make, edit, node, added);
+            if (!added) {
+                return root;
+            }
+            std::shared_ptr<Node> copyP = _copyNode(root, edit);
+            copyP->left = left;
+            return _balance(copyP, edit);
+        }
+        if (_comparator(root->key(), key)) {
+            std::shared_ptr<Node> right = _insert(root->right, key, make, edit, node, added);
+            if (!added) {
+                return root;
+            }
+            std::shared_ptr<Node> copyP = _copyNode(root, edit);
+            copyP->right = right;
+            return _balance(copyP, edit);
         }
-        std::shared_ptr<Node> copyP = _copyNode(root);
-        if (_comparator(key, copyP->key())) {
-            copyP->left = _insert(copyP->left, key, value);
-        } else if (_comparator(copyP->key(), key)) {
-            copyP->right = _insert(copyP->right, key, value);
+        node = root;
+        return root;
+    }
+    /* Fast path for keys greater than the current maximum: the new node always becomes the rightmost
+     * leaf, so only the right spine is copied. The key is compared with every spine node on the way down
+     * and the first one that is not smaller ends the fast path, so other inserts lose no more than the
+     * comparisons _insert repeats on the same nodes. Rebalancing stops as soon as a copied subtree keeps
+     * its old height. Returns nullptr if 'key' is not greater than the maximum of 'root'. */
+    template <class Make>
+    std::shared_ptr<Node> _appendMax(const std::shared_ptr<Node>& root, const Key& key, Make& make,
+                                     const size_t edit, std::shared_ptr<Node>& inserted) {
+        const std::shared_ptr<Node>* spine[MAX_HEIGHT];
+        size_t depth = 0;
+        for (const std::shared_ptr<Node>* cur = &root; *cur; cur = &(*cur)->right) {
+            if (!_comparator((*cur)->key(), key)) {
+                return nullptr;
+            }
+            spine[depth++] = cur;
+        }
+
+        inserted = _makeNode(make(), edit);
+        std::shared_ptr<Node> child = inserted;
+        bool grown = true;
+        while (depth > 0) {
+            const std::shared_ptr<Node>& old = *spine[--depth];
+            unsigned int oldHeight = old->height;
+            std::shared_ptr<Node> copyP = _copyNode(old, edit);
+            copyP->right = child;
+            if (grown) {
+                child = _balance(copyP, edit);
+                grown = child->height != oldHeight;
+            } else {
+                child = copyP;
+            }
+        }
+        return child;
+    }
+    // AVL join: 'left', the pair, then 'right', O(difference of the heights)
+    std::shared_ptr<Node> _join(const std::shared_ptr<Node>& left, const std::shared_ptr<const value_type>& kvPair,
+                                const std::shared_ptr<Node>& right, const size_t edit) {
+        if (_height(left) > _height(right) + 1) {
+            std::shared_ptr<Node> copyP = _copyNode(left, edit);
+            copyP->right = _join(left->right, kvPair, right, edit);
+            return _balance(copyP, edit);
+        }
+        if (_height(right) > _height(left) + 1) {
+            std::shared_ptr<Node> copyP = _copyNode(right, edit);
+            copyP->left = _join(left, kvPair, right->left, edit);
+            return _balance(copyP, edit);
+        }
+        std::shared_ptr<Node> node = std::allocate_shared<Node>(_allocator, kvPair);
+        node->edit = edit;
+        node->left = left;
+        node->right = right;
+        _fixHeight(node);
+        return node;
+    }
+    std::shared_ptr<Node> _join(const std::shared_ptr<Node>& left, const std::shared_ptr<Node>& right, const size_t edit) {
+        if (!left) {
+            return right;
+        }
+        if (!right) {
+            return left;
+        }
+        std::shared_ptr<const value_type> min = _findMin(right)->kvPair;
+        return _join(left, min, _removeMin(right, edit), edit);
+    }
+    // Splits 'root' into the keys below 'key', the pair of 'key' if any, and the keys above it
+    void _split(const std::shared_ptr<Node>& root, const Key& key, const size_t edit, std::shared_ptr<Node>& left,
+                std::shared_ptr<const value_type>& kvPair, std::shared_ptr<Node>& right) {
+        if (!root) {
+            left = nullptr;
+            kvPair = nullptr;
+            right = nullptr;
+        } else if (_comparator(key, root->key())) {
+            std::shared_ptr<Node> rest;
+            _split(root->left, key, edit, left, kvPair, rest);
+            right = _join(rest, root->kvPair, root->right, edit);
+        } else if (_comparator(root->key(), key)) {
+            std::shared_ptr<Node> rest;
+            _split(root->right, key, edit, rest, kvPair, right);
+            left = _join(root->left, root->kvPair, rest, edit);
+        } else {
+            left = root->left;
+            kvPair = root->kvPair;
+            right = root->right;
+        }
+    }
+    /* Splits all three trees at the root key of one of them and merges the halves recursively, until
+     * a side equals the base. 'adjustment' collects the keys whose presence in the merge differs from
+     * their presence in 'a' plus 'b' minus 'base' */
+    template <class Resolver>
+    std::shared_ptr<Node> _merge3(const std::shared_ptr<Node>& base, const std::shared_ptr<Node>& a,
+                                  const std::shared_ptr<Node>& b, const size_t edit, Resolver& resolve,
+                                  std::vector<Key>& conflicts, long long& adjustment) {
+        if (a == base) {
+            return b;
+        }
+        if (b == base) {
+            return a;
+        }
+        std::shared_ptr<const value_type> pivot = (a ? a : b ? b : base)->kvPair;
+        const Key& key = pivot->first;
+        std::shared_ptr<Node> baseLeft, baseRight, aLeft, aRight, bLeft, bRight;
+        std::shared_ptr<const value_type> basePair, aPair, bPair;
+        _split(base, key, edit, baseLeft, basePair, baseRight);
+        _split(a, key, edit, aLeft, aPair, aRight);
+        _split(b, key, edit, bLeft, bPair, bRight);
+
+        std::shared_ptr<Node> left = _merge3(baseLeft, aLeft, bLeft, edit, resolve, conflicts, adjustment);
+        std::shared_ptr<const value_type> merged;
+        if (aPair == basePair) {
+            merged = bPair;
+        } else if (bPair == basePair || aPair == bPair) {
+            merged = aPair;
         } else {
-            return copyP;
+            conflicts.push_back(key);
+            Value value;
+            if (resolve(key, basePair ? &basePair->second : nullptr, aPair ? &aPair->second : nullptr,
+                        bPair ? &bPair->second : nullptr, value)) {
+                merged = std::allocate_shared<const value_type>(_allocator, key, value);
+            }
         }
-        return _balance(copyP);
+        adjustment += (merged ? 1 : 0) - (aPair ? 1 : 0) - (bPair ? 1 : 0) + (basePair ? 1 : 0);
+        std::shared_ptr<Node> right = _merge3(baseRight, aRight, bRight, edit, resolve, conflicts, adjustment);
+        return merged ? _join(left, merged, right, edit) : _join(left, right, edit);
     }
     std::shared_ptr<Node> _findMin(std::shared_ptr<Node> root) {
         return root->left ? _findMin(root->left) : root;
     }
-    std::shared_ptr<Node> _removeMin(std::shared_ptr<Node> root) {
+    std::shared_ptr<Node> _removeMin(const std::shared_ptr<Node>& root, const size_t edit) {
         if (!root->left) {
             return root->right;
         }
-        root->left = _removeMin(root->left);
-        return _balance(root);
+        std::shared_ptr<Node> copyP = _copyNode(root, edit);
+        copyP->left = _removeMin(copyP->left, edit);
+        return _balance(copyP, edit);
     }
-    std::shared_ptr<Node> _erase(std::shared_ptr<Node> root, const Key& key) {
+    std::shared_ptr<Node> _erase(const std::shared_ptr<Node>& root, const Key& key, const size_t edit, bool& erased) {
         if (!root) {
             return nullptr;
         }
 
-        std::shared_ptr<Node> copyP = _copyNode(root);
-        if (_comparator(key, copyP->key())) {
-            copyP->left = _erase(copyP->left,key);
-        } else if (_comparator(copyP->key(), key)) {
-            copyP->right = _erase(copyP->right,key);
-        } else {
-            std::shared_ptr<Node> l = copyP->left;
-            std::shared_ptr<Node> r = copyP->right;
-            if (!r) {
-                return l;
+        if (_comparator(key, root->key())) {
+            std::shared_ptr<Node> left = _erase(root->left, key, edit, erased);
+            if (!erased) {
+                return root;
             }
-            std::shared_ptr<Node> min = _findMin(r);
-            min->right = _removeMin(r);
-            min->left = l;
-            return _balance(min);
+            std::shared_ptr<Node> copyP = _copyNode(root, edit);
+            copyP->left = left;
+            return _balance(copyP, edit);
+        }
+        if (_comparator(root->key(), key)) {
+            std::shared_ptr<Node> right = _erase(root->right, key, edit, erased);
+            if (!erased) {
+                return root;
+            }
+            std::shared_ptr<Node> copyP = _copyNode(root, edit);
+            copyP->right = right;
+            return _balance(copyP, edit);
         }
-        return _balance(copyP);
+
+        erased = true;
+        std::shared_ptr<Node> l = root->left;
+        std::shared_ptr<Node> r = root->right;
+        if (!r) {
+            return l;
+        }
+        std::shared_ptr<Node> min = _copyNode(_findMin(r), edit);
+        min->right = _removeMin(r, edit);
+        min->left = l;
+        return _balance(min, edit);
     }
 };
 
@@ -0,0 +1,121 @@
+#ifndef PERSISTENT_INDEXED_MAP_HPP
+#define PERSISTENT_INDEXED_MAP_HPP
+
+#include <functional>
+#include <utility>
+#include <vector>
+#include "persistent_avl_tree.hpp"
+#include "persistent_map.hpp"
+#include "workspace.h"
+
+/* PersistentMap with a secondary index from values to keys. The index is a PersistentAVLTree ordered
+ * by (value, key); both trees are members of one Workspace, so every version of the map has the
+ * matching version of the index. A write edits both trees in one transaction and copies one path in
+ * each, and keysWith() walks only the index entries of the requested value. */
+template <class Key, class Value, class Comparator = std::less<Key>, class ValueComparator = std::less<Value> >
+class PersistentIndexedMap {
+public:
+    typedef Key key_type;
+    typedef Value mapped_type;
+    typedef std::pair<const key_type, mapped_type> value_type;
+    typedef typename PersistentMap<Key, Value, Comparator>::iterator iterator;
+
+private:
+    // Real entries have bound EXACT; LOWEST and HIGHEST entries only delimit the range of a value
+    enum Bound {
+        LOWEST = -1,
+        EXACT = 0,
+        HIGHEST = 1
+    };
+
+    struct IndexKey {
+        Value value;
+        int bound;
+        Key key;
+
+        IndexKey(const Value& value_ = Value(), const int bound_ = EXACT, const Key& key_ = Key()) :
+            value(value_), bound(bound_), key(key_)
+        {}
+    };
+
+    struct IndexOrder {
+        ValueComparator valueComparator;
+        Comparator comparator;
+
+        bool operator()(const IndexKey& left, const IndexKey& right) const {
+            if (valueComparator(left.value, right.value)) {
+                return true;
+            }
+            if (valueComparator(right.value, left.value)) {
+                return false;
+            }
+            if (left.bound != right.bound) {
+                return left.bound < right.bound;
+            }
+            return comparator(left.key, right.key);
+        }
+    };
+
+    typedef PersistentAVLTree<IndexKey, bool, IndexOrder> index_type;
+
+public:
+    PersistentIndexedMap() : _map(_workspace), _index(_workspace)
+    {}
+    PersistentIndexedMap(const PersistentIndexedMap& other) = delete;
+    PersistentIndexedMap& operator=(const PersistentIndexedMap& other) = delete;
+
+    inline size_t versionsNumber() const {
+        return _workspace.versionsNumber();
+    }
+    inline size_t size(const size_t version) const {
+        return _map.size(version);
+    }
+    inline bool empty(const size_t version) const {
+        return _map.empty(version);
+    }
+    inline const PersistentMap<Key, Value, Comparator>& map() const {
+        return _map;
+    }
+
+    inline iterator find(const size_t version, const Key& key) const {
+        return _map.find(version, key);
+    }
+    inline iterator end() const noexcept {
+        return _map.end();
+    }
+    // Keys mapped to 'value' in 'version', in key order. O(log n + k)
+    std::vector<Key> keysWith(const size_t version, const Value& value) const {
+        std::vector<Key> keys;
+        _index.visitRange(version, IndexKey(value, LOWEST), IndexKey(value, HIGHEST),
+                          [&keys](const typename index_type::value_type& entry) { keys.push_back(entry.first.key); });
+        return keys;
+    }
+
+    // Like PersistentMap::insert, an existing key keeps its value
+    std::pair<iterator, bool> insert(const size_t srcVersion, const value_type& pair) {
+        auto transaction = _workspace.transaction(srcVersion);
+        std::pair<iterator, bool> result = transaction.edit(_map).insert(pair);
+        if (result.second) {
+            transaction.edit(_index).insert(IndexKey(pair.second, EXACT, pair.first), true);
+        }
+        transaction.commit();
+        return result;
+    }
+    void erase(const size_t srcVersion, const Key& key) {
+        auto transaction = _workspace.transaction(srcVersion);
+        iterator it = _map.find(srcVersion, key);
+        if (it != _map.end()) {
+            transaction.edit(_index).erase(IndexKey(it->second, EXACT, key));
+            transaction.edit(_map).erase(key);
+        }
+        transaction.commit();
+    }
+
+private:
+    // declared before the trees, which detach from it when destroyed
+    Workspace _workspace;
+    PersistentMap<Key, Value, Comparator> _map;
+    index_type _index;
+};
+
+#endif // PERSISTENT_INDEXED_MAP_HPP
@@ -1,39 +1,53 @@
 #ifndef PERSISTENT_LIST_HPP
 #define PERSISTENT_LIST_HPP
 
+#include <algorithm>
 #include <utility>
 #include <functional>
 #include <iterator>
+#include <limits>
 #include <memory>
+#include <unordered_set>
 #include <vector>
 #include <utility>
+#include "epoch.hpp"
+#include "expected.hpp"
+#include "workspace.h"
 //#include "persistent_vector.hpp"
 
-template <class T>
+template <class T, class Allocator = std::allocator<T> >
 class PersistentList {
 public:
     typedef T value_type;
     typedef std::less<size_t> comparator_type;
 
 private:
+    // Values are kept in immutable shared blocks, so copying a node during
+    // path copying never copies the value itself
     struct Node {
         std::shared_ptr<Node> next;
-        value_type value;
+        std::shared_ptr<const value_type> value;
+        // batch allowed to change this node in place, 0 if the node is immutable
+        size_t edit;
 
-        Node(const value_type & value_) : value(value_)
+        Node(const value_type & value_) : value(std::make_shared<const value_type>(value_)), edit(0)
+        {}
+        Node(const std::shared_ptr<const value_type> & value_) : value(value_), edit(0)
         {}
     };
 
     struct Version {
         std::shared_ptr<Node> root;
         size_t size;
+        // version this one was derived from, SQUASHED once squash() has dropped it
+        size_t parent;
 
-        Version(std::shared_ptr<Node> root_, const size_t size_) :
-            root(root_), size(size_)
+        Version(std::shared_ptr<Node> root_, const size_t size_, const size_t parent_) :
+            root(root_), size(size_), parent(parent_)
         {}
         
-        value_type& front() {
-            return root->value;
+        const value_type& front() const {
+            return *(root->value);
         }
 
         bool operator==(const Version& other) {
@@ -44,33 +58,20 @@ private:
         }
     };
 
+    /* Walks raw pointers, so iterating costs no reference count updates. Valid while its version
+     * exists: the list keeps the nodes alive, or an EpochReclaimer::Guard does once the version is dropped */
     template<class Y>
     class ListIterator : public std::iterator<std::forward_iterator_tag, Y> {
     public:
         ListIterator() : _cur(nullptr)
         {}
-        ListIterator(std::shared_ptr<Node> node) : _cur(node)
+        ListIterator(const Node* node) : _cur(node)
         {}
-        ListIterator(const ListIterator& other) : _cur(other._cur)
+        ListIterator(const std::shared_ptr<Node>& node) : _cur(node.get())
         {}
-        ListIterator(ListIterator&& other) : _cur(other._cur) {
-            other._cur = nullptr;
-        }
-        ListIterator& operator=(const ListIterator& other) {
-            if (*this != other) {
-                _cur = other._cur;
-            }
-            return* this;
-        }
-        ListIterator& operator=(ListIterator&& other) {
-            if (*this != other) {
-                std::swap(_cur, other._cur);
-            }
-            return* this;
-        }
         ListIterator& operator++() {
             if (_cur) {
-                _cur = _cur->next;
+                _cur = _cur->next.get();
             }
             return* this;
         }
@@ -79,64 +80,223 @@ private:
             operator++();
             return tmp;
         }
-        bool operator==(const ListIterator& other) {
-            return _cur == other._cur;
-        }
         bool operator==(const ListIterator& other) const {
             return _cur == other._cur;
         }
-        bool operator!=(const ListIterator& other) {
-            return _cur != other._cur;
-        }
         bool operator!=(const ListIterator& other) const {
             return _cur != other._cur;
         }
-        const value_type& operator*() {
+        const value_type& operator*() const {
             if (_cur) {
-                return _cur->value;
+                return *(_cur->value);
             } else {
                 throw new std::out_of_range("Iterator is out of range");
             }
         }
-        const value_type* operator->() {
+        const value_type* operator->() const {
             if (_cur) {
-                return &(_cur->value);
+                return _cur->value.get();
             } else {
                 throw new std::out_of_range("Iterator is out of range");
             }
         }
     private:
-        std::shared_ptr<Node> _cur;
+        const Node* _cur;
     };
 
 
 public:
     typedef ListIterator<const value_type> iterator;
 
-    PersistentList() {
-        _versions.push_back(Version(nullptr, 0));
+    /* Deferred-write mode: edits go to an unpublished tip whose copied nodes belong to the batch and
+     * are changed in place, so consecutive edits share one path copy. Only publish() creates a version;
+     * the batch then continues from the published one. The first push_back() after publish() copies the
+     * whole list, later ones append to the batch's own last node in O(1). */
+    class Batch {
+        friend class PersistentList;
+
+    public:
+        Batch(Batch&& other)
+            : _list(other._list), _srcVersion(other._srcVersion), _root(other._root), _size(other._size),
+              _edit(other._edit), _last(other._last) {
+            other._list = nullptr;
+            other._root = nullptr;
+            other._last = nullptr;
+        }
+        Batch(const Batch& other) = delete;
+        Batch& operator=(const Batch& other) = delete;
+
+        void push_front(const value_type& value) {
+            auto newNode = _makeNode(value);
+            newNode->next = _root;
+            _root = newNode;
+            if (_size == 0) {
+                _last = newNode.get();
+            }
+            ++_size;
+        }
+        void pop_front() {
+            if (!_root) {
+                throw new std::out_of_range("List is empty");
+            }
+            _root = _root->next;
+            if (--_size == 0) {
+                _last = nullptr;
+            }
+        }
+        void push_back(const value_type& value) {
+            auto newNode = _makeNode(value);
+            if (_size == 0) {
+                _root = newNode;
+            } else {
+                if (!_last) {
+                    _ownPrefix(_size, _last);
+                }
+                _last->next = newNode;
+            }
+            _last = newNode.get();
+            ++_size;
+        }
+        void pop_back() {
+            if (!_root) {
+                throw new std::out_of_range("List is empty");
+            }
+            Node* previous = nullptr;
+            *_ownPrefix(_size - 1, previous) = nullptr;
+            _last = previous;
+            --_size;
+        }
+        // Inserts before the element at 'index', copying the elements in front of it
+        void insert(const size_t index, const value_type& value) {
+            if (index > _size) {
+                throwAccessError(AccessError::INDEX_OUT_OF_RANGE, index);
+            }
+            Node* previous = nullptr;
+            std::shared_ptr<Node>* link = _ownPrefix(index, previous);
+            auto newNode = _makeNode(value);
+            newNode->next = *link;
+            *link = newNode;
+            if (index == _size) {
+                _last = newNode.get();
+            }
+            ++_size;
+        }
+        void erase(const size_t index) {
+            if (index >= _size) {
+                throwAccessError(AccessError::INDEX_OUT_OF_RANGE, index);
+            }
+            Node* previous = nullptr;
+            std::shared_ptr<Node>* link = _ownPrefix(index, previous);
+            *link = (*link)->next;
+            if (index == _size - 1) {
+                _last = previous;
+            }
+            --_size;
+        }
+
+        iterator begin() const {
+            return iterator(_root);
+        }
+        size_t size() const {
+            return _size;
+        }
+        bool empty() const {
+            return _size == 0;
+        }
+
+        // Materializes the tip as a new version of the list and returns its number
+        size_t publish() {
+            _srcVersion = _list->_pushVersion(Version(_root, _size, _srcVersion));
+            _edit = ++_list->_lastEdit;
+            // the published nodes are immutable from now on
+            _last = nullptr;
+            return _srcVersion;
+        }
+
+    private:
+        Batch(PersistentList& list, const size_t srcVersion)
+            : _list(&list), _srcVersion(srcVersion), _root(list._versions[srcVersion].root),
+              _size(list._versions[srcVersion].size),
+              _edit(++list._lastEdit), _last(nullptr)
+        {}
+
+        std::shared_ptr<Node> _makeNode(const value_type& value) {
+            auto node = _list->_emplaceNode(value);
+            node->edit = _edit;
+            return node;
+        }
+        std::shared_ptr<Node> _own(const std::shared_ptr<Node>& node) {
+            if (node->edit == _edit) {
+                return node;
+            }
+            auto copy = _list->_newNode(node->value);
+            copy->next = node->next;
+            copy->edit = _edit;
+            return copy;
+        }
+        // Owns the first 'count' nodes and returns the link after them; 'owner' gets the node holding
+        // that link, nullptr for the root
+        std::shared_ptr<Node>* _ownPrefix(const size_t count, Node*& owner) {
+            std::shared_ptr<Node>* link = &_root;
+            owner = nullptr;
+            for (size_t i = 0; i < count; ++i) {
+                *link = _own(*link);
+                owner = link->get();
+                link = &owner->next;
+            }
+            return link;
+        }
+
+        PersistentList* _list;
+        size_t _srcVersion;
+        std::shared_ptr<Node> _root;
+        size_t _size;
+        size_t _edit;
+        // the last node if it and every node before it belong to the batch, nullptr if unknown
+        Node* _last;
+    };
+
+    PersistentList() : _lastEdit(0), _workspace(nullptr) {
+        _versions.push_back(Version(nullptr, 0, 0));
     }
-    PersistentList(const PersistentList& other) : _versions (other._versions)
+    // Member of 'workspace': the list is empty in every version the workspace already has
+    explicit PersistentList(Workspace& workspace) : _lastEdit(0), _workspace(&workspace) {
+        _versions.assign(workspace.versionsNumber(), Version(nullptr, 0, 0));
+        _workspace->_attach(this, [this](size_t version, size_t srcVersion) { _alias(version, srcVersion); },
+                            [this](size_t version) { _drop(version); });
+    }
+    // Copies never belong to a workspace. Workspace members can't be assigned to or from, their versions
+    // are numbered by the workspace
+    PersistentList(const PersistentList& other)
+        : _versions (other._versions), _lastEdit(other._lastEdit), _workspace(nullptr)
     {}
-    PersistentList(PersistentList&& other) : _versions(other._versions) {
+    PersistentList(PersistentList&& other)
+        : _versions(other._versions), _lastEdit(other._lastEdit), _workspace(nullptr) {
         other.clear();
     }
     PersistentList& operator=(const PersistentList& other) {
         if (*this != other) {
+            _checkAssignable(other);
             if (!_versions.empty()) {
                 clear();
             }
             _versions = other._versions;
+            _lastEdit = std::max(_lastEdit, other._lastEdit);
         }
         return *this;
     }
     PersistentList& operator=(PersistentList&& other) {
         if (*this != other) {
+            _checkAssignable(other);
             std::swap(_versions, other._versions);
+            std::swap(_lastEdit, other._lastEdit);
         }
         return *this;
     }
     ~PersistentList() {
+        if (_workspace) {
+            _workspace->_detach(this);
+        }
         clear();
     }
 
@@ -158,7 +318,7 @@ public:
             throw new std::out_of_range("List is empty");
         }
         if (!_versions[srcVersion].root) {
-            throw new std::out_of_range("This version is empty: " + srcVersion);
+            throwAccessError(AccessError::EMPTY, srcVersion);
         }
         return _versions[srcVersion].front();
     }
@@ -167,7 +327,7 @@ public:
             throw new std::out_of_range("List is empty");
         }
         if (!_versions[srcVersion].root) {
-            throw new std::out_of_range("This version is empty: " + srcVersion);
+            throwAccessError(AccessError::EMPTY, srcVersion);
         }
         return _versions[srcVersion].front();
     }
@@ -178,12 +338,12 @@ public:
         
         auto cur =  _versions[srcVersion].root;
         if (!cur) {
-            throw new std::out_of_range("This version is empty: " + srcVersion);
+            throwAccessError(AccessError::EMPTY, srcVersion);
         }
         while (cur->next) {
             cur = cur->next;
         }
-        return cur->value;
+        return *(cur->value);
     }
     const value_type& back(const size_t srcVersion) const {
         if (_versions.empty()) {
@@ -192,12 +352,35 @@ public:
         
         auto cur =  _versions[srcVersion].root;
         if (!cur) {
-            throw new std::out_of_range("This version is empty: " + srcVersion);
+            throwAccessError(AccessError::EMPTY, srcVersion);
         }
         while (cur->next) {
             cur = cur->next;
         }
-        return cur->value;
+        return *(cur->value);
+    }
+    // front() and back() reporting an invalid or empty version as the error instead of throwing
+    Expected<const value_type&> try_front(const size_t version) const {
+        if (!_isValid(version)) {
+            return AccessError::INVALID_VERSION;
+        }
+        if (!_versions[version].root) {
+            return AccessError::EMPTY;
+        }
+        return _versions[version].front();
+    }
+    Expected<const value_type&> try_back(const size_t version) const {
+        if (!_isValid(version)) {
+            return AccessError::INVALID_VERSION;
+        }
+        const Node* cur = _versions[version].root.get();
+        if (!cur) {
+            return AccessError::EMPTY;
+        }
+        while (cur->next) {
+            cur = cur->next.get();
+        }
+        return *(cur->value);
     }
 
     inline iterator begin(const size_t srcVersion) const noexcept {
@@ -216,29 +399,43 @@ public:
     inline size_t versionsNumber() const {
         return _versions.size();
     }
-    inline void clear() noexcept {
-        _versions.clear();
+    // A workspace member keeps its versions, all of them become empty
+    inline void clear() {
+        std::vector<Version> dropped;
+        if (_workspace) {
+            dropped.assign(_versions.size(), Version(nullptr, 0, 0));
+        }
+        std::swap(dropped, _versions);
+        _retire(std::move(dropped));
     }
 
     inline iterator insert(const size_t srcVersion, iterator pos, const value_type& value) {
-        if (_versions.size() - 1 < srcVersion) {
-            throw new std::out_of_range("Invalid version: " + srcVersion);
+        return emplace(srcVersion, pos, value);
+    }
+    inline iterator insert(const size_t srcVersion, iterator pos, value_type&& value) {
+        return emplace(srcVersion, pos, std::move(value));
+    }
+    // insert() of the value constructed from 'args' in its shared block
+    template <class... Args>
+    iterator emplace(const size_t srcVersion, iterator pos, Args&&... args) {
+        if (!_isValid(srcVersion)) {
+            throwAccessError(AccessError::INVALID_VERSION, srcVersion);
         }
-        auto newNode = std::make_shared<Node>(value);
+        auto newNode = _emplaceNode(std::forward<Args>(args)...);
         auto root = _versions[srcVersion].root;
         auto size = _versions[srcVersion].size;
         if (!root) {
-            _versions.push_back(Version(newNode, size + 1));
+            _pushVersion(Version(newNode, size + 1, srcVersion));
         } else if (pos == begin(srcVersion)) {
             newNode->next = root;
-            _versions.push_back(Version(newNode, size + 1));
+            _pushVersion(Version(newNode, size + 1, srcVersion));
         } else {
             auto curOld = root;
             auto curOldIt = iterator(root);
             std::shared_ptr<Node> prevNew = nullptr;
             std::shared_ptr<Node> copyRoot = nullptr;
             while (curOldIt != pos) {
-                auto copyCur = std::make_shared<Node>(*curOldIt);
+                auto copyCur = _newNode(curOld->value);
                 if (curOldIt == begin(srcVersion)) {
                     copyRoot = copyCur;
                 }
@@ -253,21 +450,21 @@ public:
             }
             prevNew->next = newNode;
             newNode->next = curOld;
-            _versions.push_back(Version(copyRoot, size + 1));
+            _pushVersion(Version(copyRoot, size + 1, srcVersion));
         }
         return iterator(newNode);
     }
 
     inline iterator erase(const size_t srcVersion, iterator pos) {
-        if (_versions.size() - 1 < srcVersion) {
-            throw new std::out_of_range("Invalid version: " + srcVersion);
+        if (!_isValid(srcVersion)) {
+            throwAccessError(AccessError::INVALID_VERSION, srcVersion);
         }
         auto root = _versions[srcVersion].root;
         auto size = _versions[srcVersion].size;
         if (!root || pos == end()) {
             return end();
         } else if (pos == begin(srcVersion)) {
-            _versions.push_back(Version(root->next, size - 1));
+            _pushVersion(Version(root->next, size - 1, srcVersion));
             return iterator(root->next);
         } else {
             auto curOldIt = iterator(root);
@@ -275,7 +472,7 @@ public:
             std::shared_ptr<Node> curNew = nullptr;
             std::shared_ptr<Node> copyRoot = nullptr;
             while (curOldIt != pos) {
-                auto copyCur = std::make_shared<Node>(*curOldIt);
+                auto copyCur = _newNode(curOld->value);
                 if (curOldIt == begin(srcVersion)) {
                     copyRoot = copyCur;
                 }
@@ -289,12 +486,19 @@ public:
                 curOld = curOld->next;
             }
             curNew->next = curOld->next;
-            _versions.push_back(Version(copyRoot, size - 1));
+            _pushVersion(Version(copyRoot, size - 1, srcVersion));
             return iterator(curNew->next);
         }
     }
     void push_back(const size_t srcVersion, const value_type& value) {
-        insert(srcVersion, end(), value);
+        emplace(srcVersion, end(), value);
+    }
+    void push_back(const size_t srcVersion, value_type&& value) {
+        emplace(srcVersion, end(), std::move(value));
+    }
+    template <class... Args>
+    void emplace_back(const size_t srcVersion, Args&&... args) {
+        emplace(srcVersion, end(), std::forward<Args>(args)...);
     }
     void pop_back(const size_t srcVersion) {
         auto root = _versions[srcVersion].root;
@@ -303,7 +507,7 @@ public:
         std::shared_ptr<Node> curNew = nullptr;
         std::shared_ptr<Node> copyRoot = nullptr;
         while (curOld->next) {
-            auto copyCur = std::make_shared<Node>(curOld->value);
+            auto copyCur = _newNode(curOld->value);
             if (curNew) {
                 curNew->next = copyCur;
                 curNew = curNew->next;
@@ -315,17 +519,114 @@ public:
             }
             curOld = curOld->next;
         }
-        _versions.push_back(Version(copyRoot, size - 1));
+        _pushVersion(Version(copyRoot, size - 1, srcVersion));
     }
     void push_front(const size_t srcVersion, const value_type& value) {
-        insert(srcVersion, begin(srcVersion), value);
+        emplace(srcVersion, begin(srcVersion), value);
+    }
+    void push_front(const size_t srcVersion, value_type&& value) {
+        emplace(srcVersion, begin(srcVersion), std::move(value));
+    }
+    template <class... Args>
+    void emplace_front(const size_t srcVersion, Args&&... args) {
+        emplace(srcVersion, begin(srcVersion), std::forward<Args>(args)...);
     }
     void pop_front(const size_t srcVersion) {
         erase(srcVersion, begin(srcVersion));
     }
 
+    Batch batch(const size_t srcVersion) {
+        if (!_isValid(srcVersion)) {
+            throwAccessError(AccessError::INVALID_VERSION, srcVersion);
+        }
+        return Batch(*this, srcVersion);
+    }
+
+    /* Drops the chain of versions between 'from' and its descendant 'to', so 'to' is derived directly
+     * from 'from'. Every dropped version must have exactly one child; nodes referenced only by the
+     * dropped versions are released. Dropped version numbers are not reused and become invalid.
+     * Not available for workspace members, whose version numbers are shared. */
+    void squash(const size_t from, const size_t to) {
+        if (_workspace || !_isValid(from) || !_isValid(to) || from == to) {
+            throw new std::out_of_range("Invalid squash range");
+        }
+        std::unordered_set<size_t> chain;
+        for (size_t cur = _versions[to].parent; cur != from; cur = _versions[cur].parent) {
+            if (cur == 0) {
+                throw new std::out_of_range("Squash bounds are not an ancestor and its descendant");
+            }
+            chain.insert(cur);
+        }
+        for (size_t version = 1; version < _versions.size(); ++version) {
+            if (version != to && !chain.count(version) && chain.count(_versions[version].parent)) {
+                throw new std::out_of_range("Versions between squash bounds must form a chain");
+            }
+        }
+        std::vector<Version> dropped;
+        for (auto version : chain) {
+            dropped.push_back(_versions[version]);
+            _versions[version] = Version(nullptr, 0, SQUASHED);
+        }
+        _retire(std::move(dropped));
+        _versions[to].parent = from;
+    }
+
 private:
+    static const size_t SQUASHED = std::numeric_limits<size_t>::max();
+
     std::vector<Version> _versions;
+    size_t _lastEdit;
+    Workspace* _workspace;
+    // nodes and their value blocks come from it, see NodeAllocator
+    Allocator _allocator;
+
+    void _checkAssignable(const PersistentList& other) const {
+        if (_workspace || other._workspace) {
+            throw new std::out_of_range("Can't assign containers shared with a workspace");
+        }
+    }
+    bool _isValid(const size_t version) const {
+        return version < _versions.size() && _versions[version].parent != SQUASHED;
+    }
+    // Every new version goes through here so that the workspace, if any, numbers it for all members
+    size_t _pushVersion(const Version& version) {
+        if (!_workspace) {
+            _versions.push_back(version);
+            return _versions.size() - 1;
+        }
+        size_t number = _workspace->_beginVersion(version.parent);
+        _versions.push_back(version);
+        _workspace->_endVersion(number, version.parent);
+        return number;
+    }
+    // Node with a new value block constructed from 'args'
+    template <class... Args>
+    std::shared_ptr<Node> _emplaceNode(Args&&... args) {
+        return std::allocate_shared<Node>(_allocator,
+                                          std::allocate_shared<const value_type>(_allocator, std::forward<Args>(args)...));
+    }
+    // Node sharing the value block of another one
+    std::shared_ptr<Node> _newNode(const std::shared_ptr<const value_type>& value) {
+        return std::allocate_shared<Node>(_allocator, value);
+    }
+    // Dropped versions are released through the EpochReclaimer, readers inside a guard may still walk them
+    static void _retire(std::vector<Version>&& versions) {
+        if (!versions.empty()) {
+            EpochReclaimer::retire(std::make_shared<const std::vector<Version> >(std::move(versions)));
+        }
+    }
+    // Workspace version made without this list: same contents as 'srcVersion'
+    void _alias(const size_t version, const size_t srcVersion) {
+        if (_versions.size() == version) {
+            _versions.push_back(Version(_versions[srcVersion].root, _versions[srcVersion].size, srcVersion));
+        }
+    }
+    // Workspace version whose commit failed
+    void _drop(const size_t version) {
+        if (_versions.size() == version + 1) {
+            _versions.pop_back();
+        }
+    }
 };
 
 #endif // PERSISTENT_LIST_HPP
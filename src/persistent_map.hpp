@@ -6,27 +6,32 @@
 #include <iterator>
 #include <memory>
 #include <utility>
+#include <vector>
+#include "frozen_map.hpp"
 #include "persistent_avl_tree.hpp"
 
-template <class Key, class Value, class Comparator = std::less<Key> >
+template <class Key, class Value, class Comparator = std::less<Key>, class Allocator = std::allocator<Key> >
 class PersistentMap {
 public:
     typedef Key key_type;
     typedef Value mapped_type;
     typedef std::pair<const key_type, mapped_type> value_type;
     typedef Comparator comparator_type;
-    typedef typename PersistentAVLTree<key_type, mapped_type, comparator_type>::iterator iterator;
+    typedef PersistentAVLTree<key_type, mapped_type, comparator_type, Allocator> tree_type;
+    typedef typename tree_type::iterator iterator;
+    typedef typename tree_type::Batch batch_type;
 
-    PersistentMap() : _tree (PersistentAVLTree<Key, Value, Comparator>())
+    PersistentMap() : _tree (PersistentAVLTree<Key, Value, Comparator, Allocator>())
+    {}
+    // Shares the versions of 'workspace', see Workspace
+    explicit PersistentMap(Workspace& workspace) : _tree(workspace)
     {}
     PersistentMap(const PersistentMap& other) : _tree (other._tree)
     {}
-    PersistentMap(PersistentMap&& other) : _tree(other._tree) {
-        other._tree = PersistentAVLTree<Key, Value, Comparator>();
-    }
+    PersistentMap(PersistentMap&& other) : _tree(std::move(other._tree))
+    {}
     PersistentMap& operator=(const PersistentMap& other) {
         if (*this != other) {
-            _tree.clear();
             _tree = other._tree;
         }
         return *this;
@@ -64,6 +69,18 @@ public:
         std::swap(key, keyCopy);
         return at(version, keyCopy);
     }
+    // at() without any check, for trusted loops: 'version' must be valid and hold 'key'
+    inline const mapped_type& unchecked_at(const size_t version, const key_type& key) const {
+        return _tree.unchecked_at(version, key);
+    }
+    // at() reporting an invalid version or a missing key as the error instead of throwing
+    inline Expected<const mapped_type&> try_at(const size_t version, const key_type& key) const {
+        auto found = _tree.try_find(version, key);
+        if (!found) {
+            return found.error();
+        }
+        return found->second;
+    }
 
     inline iterator begin(const size_t version) const noexcept {
         return _tree.begin(version);
@@ -87,15 +104,76 @@ public:
     inline std::pair<iterator, bool> insert(const size_t version, const value_type& pair) {
         return _tree.insert(version, pair.first, pair.second);
     }
+    inline std::pair<iterator, bool> insert(const size_t version, value_type&& pair) {
+        return _tree.insert(version, std::move(pair));
+    }
+    // Builds the pair from 'args' before looking the key up, as std::map does
+    template <class... Args>
+    std::pair<iterator, bool> emplace(const size_t version, Args&&... args) {
+        return _tree.insert(version, value_type(std::forward<Args>(args)...));
+    }
+    // Constructs the value from 'args' only if 'key' is absent from 'version'
+    template <class... Args>
+    std::pair<iterator, bool> try_emplace(const size_t version, const key_type& key, Args&&... args) {
+        return _tree.try_emplace(version, key, std::forward<Args>(args)...);
+    }
     inline void erase(const size_t version, const Key& key) {
         return _tree.erase(version, key);
     }
+    // insert() and erase() reporting an invalid version as the error; the value tells whether the key
+    // was added or erased
+    inline Expected<bool> try_insert(const size_t version, const value_type& pair) {
+        return _tree.try_insert(version, pair.first, pair.second);
+    }
+    inline Expected<bool> try_erase(const size_t version, const key_type& key) {
+        return _tree.try_erase(version, key);
+    }
     inline iterator find(const size_t version, const key_type& key) const {
         return _tree.find(version, key);
     }
+    // Deferred writes on top of 'version', see PersistentAVLTree::Batch
+    inline batch_type batch(const size_t version) {
+        return _tree.batch(version);
+    }
+    // New version with the pairs of [first, last) added to 'srcVersion', see PersistentAVLTree::parallel_build
+    template <class InputIt>
+    inline size_t parallel_build(const size_t srcVersion, InputIt first, InputIt last) {
+        return _tree.parallel_build(srcVersion, first, last);
+    }
+    // See PersistentAVLTree::parallel_for_each
+    template <class Function>
+    inline void parallel_for_each(const size_t version, Function f, const size_t grainSize = tree_type::DEFAULT_GRAIN) const {
+        _tree.parallel_for_each(version, f, grainSize);
+    }
+    // See PersistentAVLTree::parallel_reduce
+    template <class T, class Fold, class Combine>
+    inline T parallel_reduce(const size_t version, const T& identity, Fold fold, Combine combine,
+                             const size_t grainSize = tree_type::DEFAULT_GRAIN) const {
+        return _tree.parallel_reduce(version, identity, fold, combine, grainSize);
+    }
+    template <class Op>
+    inline Value parallel_reduce(const size_t version, const Value& identity, Op op) const {
+        return _tree.parallel_reduce(version, identity, op);
+    }
+    // Three-way merge of 'a' and 'b' relative to 'base', see PersistentAVLTree::merge3
+    template <class Resolver>
+    inline std::pair<size_t, std::vector<Key> > merge3(const size_t base, const size_t a, const size_t b, Resolver resolve) {
+        return _tree.merge3(base, a, b, resolve);
+    }
+    // Read-only copy of 'version' with a faster find, see FrozenMap
+    FrozenMap<Key, Value, Comparator> freeze(const size_t version) const {
+        std::vector<std::pair<const Key*, const Value*> > pairs;
+        pairs.reserve(_tree.size(version));
+        _tree.visit(version, [&pairs](const value_type& pair) { pairs.push_back(std::make_pair(&pair.first, &pair.second)); });
+        return FrozenMap<Key, Value, Comparator>(pairs);
+    }
+    // Drops the chain of versions between 'from' and 'to', see PersistentAVLTree::squash
+    inline void squash(const size_t from, const size_t to) {
+        _tree.squash(from, to);
+    }
 
 private:
-    PersistentAVLTree<Key, Value, Comparator> _tree;
+    PersistentAVLTree<Key, Value, Comparator, Allocator> _tree;
 };
 
 #endif // PERSISTENT_MAP_H
@@ -0,0 +1,363 @@
+#ifndef PERSISTENT_ROPE_HPP
+#define PERSISTENT_ROPE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* Versioned text: an AVL tree whose leaves are immutable chunks of up to CHUNK_CAPACITY characters and
+ * whose inner nodes know the length and the number of line breaks below them. Every edit splits and
+ * joins O(log n) nodes, the rest of the tree is shared with the source version. */
+class PersistentRope {
+private:
+    // a chunk with its header takes four cache lines
+    static const size_t CHUNK_CAPACITY = 4 * 64 - 2 * sizeof(uint32_t);
+
+    struct Chunk {
+        uint32_t size;
+        uint32_t newlines;
+        char data[CHUNK_CAPACITY];
+
+        Chunk(const char* data_, const size_t size_) : size(size_), newlines(std::count(data_, data_ + size_, '\n')) {
+            std::memcpy(data, data_, size_);
+        }
+    };
+
+    struct Node;
+    typedef std::shared_ptr<const Node> NodePtr;
+
+    struct Node {
+        NodePtr left;
+        NodePtr right;
+        std::shared_ptr<const Chunk> chunk;     // leaves only
+        size_t size;
+        size_t newlines;
+        unsigned int height;
+
+        Node(const NodePtr& left_, const NodePtr& right_) :
+            left(left_), right(right_), chunk(nullptr), size(left_->size + right_->size),
+            newlines(left_->newlines + right_->newlines), height(std::max(left_->height, right_->height) + 1)
+        {}
+        Node(const std::shared_ptr<const Chunk>& chunk_) :
+            left(nullptr), right(nullptr), chunk(chunk_), size(chunk_->size), newlines(chunk_->newlines), height(1)
+        {}
+
+        bool isLeaf() const {
+            return chunk != nullptr;
+        }
+    };
+
+public:
+    PersistentRope() {
+        _versions.push_back(nullptr);
+    }
+    explicit PersistentRope(const std::string& text) {
+        _versions.push_back(_build(text.data(), text.size()));
+    }
+
+    bool operator==(const PersistentRope& other) const {
+        return _versions == other._versions;
+    }
+    bool operator!=(const PersistentRope& other) const {
+        return !operator==(other);
+    }
+
+    inline size_t versionsNumber() const {
+        return _versions.size();
+    }
+    inline size_t size(const size_t version) const {
+        return _size(_root(version));
+    }
+    inline bool empty(const size_t version) const {
+        return size(version) == 0;
+    }
+    // Number of lines, a text without line breaks has one
+    inline size_t lines(const size_t version) const {
+        NodePtr root = _root(version);
+        return (root ? root->newlines : 0) + 1;
+    }
+
+    char at(const size_t version, size_t pos) const {
+        NodePtr node = _root(version);
+        if (pos >= _size(node)) {
+            throw new std::out_of_range("Position out of range");
+        }
+        while (!node->isLeaf()) {
+            if (pos < node->left->size) {
+                node = node->left;
+            } else {
+                pos -= node->left->size;
+                node = node->right;
+            }
+        }
+        return node->chunk->data[pos];
+    }
+    std::string substr(const size_t version, const size_t pos, size_t count) const {
+        NodePtr root = _root(version);
+        if (pos > _size(root)) {
+            throw new std::out_of_range("Position out of range");
+        }
+        count = std::min(count, _size(root) - pos);
+        std::string text;
+        text.reserve(count);
+        _append(root, pos, count, text);
+        return text;
+    }
+    std::string str(const size_t version) const {
+        return substr(version, 0, size(version));
+    }
+
+    // Position of 'column' in 'line', both counted from zero
+    size_t position(const size_t version, const size_t line, const size_t column) const {
+        NodePtr node = _root(version);
+        if (line >= lines(version)) {
+            throw new std::out_of_range("Line out of range");
+        }
+        size_t pos = 0;
+        if (line > 0) {
+            // position right after the line-th line break
+            size_t breaks = line;
+            while (!node->isLeaf()) {
+                if (breaks <= node->left->newlines) {
+                    node = node->left;
+                } else {
+                    breaks -= node->left->newlines;
+                    pos += node->left->size;
+                    node = node->right;
+                }
+            }
+            const char* data = node->chunk->data;
+            for (size_t i = 0; ; ++i) {
+                if (data[i] == '\n' && --breaks == 0) {
+                    pos += i + 1;
+                    break;
+                }
+            }
+        }
+        if (pos + column > size(version)) {
+            throw new std::out_of_range("Column out of range");
+        }
+        return pos + column;
+    }
+    // Line and column of 'pos', both counted from zero
+    std::pair<size_t, size_t> lineColumn(const size_t version, const size_t pos) const {
+        NodePtr node = _root(version);
+        if (pos > _size(node)) {
+            throw new std::out_of_range("Position out of range");
+        }
+        size_t line = 0;
+        size_t rest = pos;
+        while (node && !node->isLeaf()) {
+            if (rest < node->left->size) {
+                node = node->left;
+            } else {
+                line += node->left->newlines;
+                rest -= node->left->size;
+                node = node->right;
+            }
+        }
+        if (node) {
+            line += std::count(node->chunk->data, node->chunk->data + rest, '\n');
+        }
+        return std::make_pair(line, pos - (line > 0 ? position(version, line, 0) : 0));
+    }
+
+    void insert(const size_t srcVersion, const size_t pos, const std::string& text) {
+        NodePtr root = _root(srcVersion);
+        if (pos > _size(root)) {
+            throw new std::out_of_range("Position out of range");
+        }
+        std::pair<NodePtr, NodePtr> parts = _split(root, pos);
+        _versions.push_back(_concat(_concat(parts.first, _build(text.data(), text.size())), parts.second));
+    }
+    void append(const size_t srcVersion, const std::string& text) {
+        insert(srcVersion, size(srcVersion), text);
+    }
+    void erase(const size_t srcVersion, const size_t pos, size_t count) {
+        NodePtr root = _root(srcVersion);
+        if (pos > _size(root)) {
+            throw new std::out_of_range("Position out of range");
+        }
+        count = std::min(count, _size(root) - pos);
+        std::pair<NodePtr, NodePtr> head = _split(root, pos);
+        std::pair<NodePtr, NodePtr> tail = _split(head.second, count);
+        _versions.push_back(_concat(head.first, tail.second));
+    }
+    // Creates two versions: the text before 'pos', then the text from 'pos' on
+    void split(const size_t srcVersion, const size_t pos) {
+        NodePtr root = _root(srcVersion);
+        if (pos > _size(root)) {
+            throw new std::out_of_range("Position out of range");
+        }
+        std::pair<NodePtr, NodePtr> parts = _split(root, pos);
+        _versions.push_back(parts.first);
+        _versions.push_back(parts.second);
+    }
+    // New version with the text of 'leftVersion' followed by the text of 'rightVersion'
+    void concat(const size_t leftVersion, const size_t rightVersion) {
+        _versions.push_back(_concat(_root(leftVersion), _root(rightVersion)));
+    }
+
+private:
+    std::vector<NodePtr> _versions;
+
+    NodePtr _root(const size_t version) const {
+        if (version >= _versions.size()) {
+            throw new std::out_of_range("Invalid version: " + std::to_string(version));
+        }
+        return _versions[version];
+    }
+    static size_t _size(const NodePtr& node) {
+        return node ? node->size : 0;
+    }
+    static unsigned int _height(const NodePtr& node) {
+        return node ? node->height : 0;
+    }
+
+    static NodePtr _makeLeaf(const char* data, const size_t size) {
+        return std::make_shared<const Node>(std::make_shared<const Chunk>(data, size));
+    }
+    static NodePtr _makeNode(const NodePtr& left, const NodePtr& right) {
+        return std::make_shared<const Node>(left, right);
+    }
+
+    // Balanced tree of full chunks holding 'data'
+    static NodePtr _build(const char* data, const size_t size) {
+        if (size == 0) {
+            return nullptr;
+        }
+        std::vector<NodePtr> level;
+        for (size_t pos = 0; pos < size; pos += CHUNK_CAPACITY) {
+            level.push_back(_makeLeaf(data + pos, std::min(size - pos, (size_t)CHUNK_CAPACITY)));
+        }
+        return _buildLevel(level, 0, level.size());
+    }
+    static NodePtr _buildLevel(const std::vector<NodePtr>& leaves, const size_t begin, const size_t end) {
+        if (end - begin == 1) {
+            return leaves[begin];
+        }
+        size_t middle = begin + (end - begin) / 2;
+        return _makeNode(_buildLevel(leaves, begin, middle), _buildLevel(leaves, middle, end));
+    }
+
+    // Node over 'left' and 'right' whose heights differ by at most two
+    static NodePtr _balance(const NodePtr& left, const NodePtr& right) {
+        if (_height(left) > _height(right) + 1) {
+            if (_height(left->left) >= _height(left->right)) {
+                return _makeNode(left->left, _makeNode(left->right, right));
+            }
+            return _makeNode(_makeNode(left->left, left->right->left), _makeNode(left->right->right, right));
+        }
+        if (_height(right) > _height(left) + 1) {
+            if (_height(right->right) >= _height(right->left)) {
+                return _makeNode(_makeNode(left, right->left), right->right);
+            }
+            return _makeNode(_makeNode(left, right->left->left), _makeNode(right->left->right, right->right));
+        }
+        return _makeNode(left, right);
+    }
+    // AVL join, O(difference of the heights)
+    static NodePtr _join(const NodePtr& left, const NodePtr& right) {
+        if (!left) {
+            return right;
+        }
+        if (!right) {
+            return left;
+        }
+        if (_height(left) > _height(right) + 1) {
+            return _balance(left->left, _join(left->right, right));
+        }
+        if (_height(right) > _height(left) + 1) {
+            return _balance(_join(left, right->left), right->right);
+        }
+        return _makeNode(left, right);
+    }
+    // _join that also merges the chunks meeting at the seam when they fit in one
+    static NodePtr _concat(NodePtr left, NodePtr right) {
+        if (!left || !right || _last(left)->size + _first(right)->size > CHUNK_CAPACITY) {
+            return _join(left, right);
+        }
+        NodePtr last;
+        NodePtr first;
+        left = _removeLast(left, last);
+        right = _removeFirst(right, first);
+        char data[CHUNK_CAPACITY];
+        std::memcpy(data, last->chunk->data, last->size);
+        std::memcpy(data + last->size, first->chunk->data, first->size);
+        return _join(_join(left, _makeLeaf(data, last->size + first->size)), right);
+    }
+
+    static const Node* _first(const NodePtr& node) {
+        const Node* cur = node.get();
+        while (!cur->isLeaf()) {
+            cur = cur->left.get();
+        }
+        return cur;
+    }
+    static const Node* _last(const NodePtr& node) {
+        const Node* cur = node.get();
+        while (!cur->isLeaf()) {
+            cur = cur->right.get();
+        }
+        return cur;
+    }
+    static NodePtr _removeFirst(const NodePtr& node, NodePtr& first) {
+        if (node->isLeaf()) {
+            first = node;
+            return nullptr;
+        }
+        return _join(_removeFirst(node->left, first), node->right);
+    }
+    static NodePtr _removeLast(const NodePtr& node, NodePtr& last) {
+        if (node->isLeaf()) {
+            last = node;
+            return nullptr;
+        }
+        return _join(node->left, _removeLast(node->right, last));
+    }
+
+    // The first 'pos' characters and the rest
+    static std::pair<NodePtr, NodePtr> _split(const NodePtr& node, const size_t pos) {
+        if (!node || pos == 0) {
+            return std::make_pair(nullptr, node);
+        }
+        if (pos >= node->size) {
+            return std::make_pair(node, nullptr);
+        }
+        if (node->isLeaf()) {
+            const char* data = node->chunk->data;
+            return std::make_pair(_makeLeaf(data, pos), _makeLeaf(data + pos, node->size - pos));
+        }
+        if (pos < node->left->size) {
+            std::pair<NodePtr, NodePtr> parts = _split(node->left, pos);
+            return std::make_pair(parts.first, _join(parts.second, node->right));
+        }
+        std::pair<NodePtr, NodePtr> parts = _split(node->right, pos - node->left->size);
+        return std::make_pair(_join(node->left, parts.first), parts.second);
+    }
+
+    static void _append(const NodePtr& node, const size_t pos, const size_t count, std::string& text) {
+        if (!node || count == 0) {
+            return;
+        }
+        if (node->isLeaf()) {
+            text.append(node->chunk->data + pos, count);
+            return;
+        }
+        size_t leftSize = node->left->size;
+        if (pos < leftSize) {
+            size_t leftCount = std::min(count, leftSize - pos);
+            _append(node->left, pos, leftCount, text);
+            _append(node->right, 0, count - leftCount, text);
+        } else {
+            _append(node->right, pos - leftSize, count, text);
+        }
+    }
+};
+
+#endif // PERSISTENT_ROPE_HPP
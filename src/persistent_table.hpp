@@ -0,0 +1,139 @@
+#ifndef PERSISTENT_TABLE_HPP
+#define PERSISTENT_TABLE_HPP
+
+#include <cstddef>
+#include <iterator>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "column_kernels.hpp"
+#include "persistent_vector.hpp"
+#include "workspace.h"
+
+/* Versioned records stored column by column: one PersistentVector per field, all of them members of
+ * one Workspace, so a version of the table is the same version of every column. Updating a field
+ * writes only its column, and scans of a field read only that column. */
+template <class... Columns>
+class PersistentTable {
+public:
+    typedef std::tuple<Columns...> row_type;
+
+    template <size_t I>
+    struct column_type {
+        typedef typename std::tuple_element<I, row_type>::type type;
+    };
+
+    PersistentTable() : _columns(_workspaceFor<Columns>()...)
+    {}
+    PersistentTable(const PersistentTable& other) = delete;
+    PersistentTable& operator=(const PersistentTable& other) = delete;
+
+    inline size_t versionsNumber() const {
+        return _workspace.versionsNumber();
+    }
+    inline size_t size(const size_t version) const {
+        return std::get<0>(_columns).size(version);
+    }
+    inline bool empty(const size_t version) const {
+        return size(version) == 0;
+    }
+
+    template <size_t I>
+    inline const PersistentVector<typename column_type<I>::type>& column() const {
+        return std::get<I>(_columns);
+    }
+    template <size_t I>
+    inline typename PersistentVector<typename column_type<I>::type>::const_reference
+    at(const size_t version, const size_t row) const {
+        return std::get<I>(_columns).at(version, row);
+    }
+    row_type row(const size_t version, const size_t row) const {
+        return _row(version, row, typename _Indices<sizeof...(Columns)>::type());
+    }
+
+    // New version where only field I of 'row' is changed
+    template <size_t I>
+    void update(const size_t srcVersion, const size_t row, const typename column_type<I>::type& value) {
+        std::get<I>(_columns).update(srcVersion, row, value);
+    }
+    void push_back(const size_t srcVersion, const Columns&... values) {
+        auto transaction = _workspace.transaction(srcVersion);
+        _push<0>(transaction, values...);
+        transaction.commit();
+    }
+    void pop_back(const size_t srcVersion) {
+        auto transaction = _workspace.transaction(srcVersion);
+        _pop<0>(transaction);
+        transaction.commit();
+    }
+
+    // Field I of every row of 'version', contiguous, gathered in one pass over the column
+    template <size_t I>
+    std::vector<typename column_type<I>::type> scan(const size_t version) const {
+        const PersistentVector<typename column_type<I>::type>& column = std::get<I>(_columns);
+        std::vector<typename column_type<I>::type> values;
+        values.reserve(column.size(version));
+        column.copy(version, std::back_inserter(values));
+        return values;
+    }
+    template <size_t I>
+    typename ColumnSum<typename column_type<I>::type>::type sum(const size_t version) const {
+        auto values = scan<I>(version);
+        return columnSum(values.data(), values.size());
+    }
+    // Rows of 'version' whose field I lies in [low, high]
+    template <size_t I>
+    std::vector<size_t> filter(const size_t version, const typename column_type<I>::type& low,
+                               const typename column_type<I>::type& high) const {
+        auto values = scan<I>(version);
+        std::vector<size_t> rows;
+        columnFilter(values.data(), values.size(), low, high, rows);
+        return rows;
+    }
+
+private:
+    template <size_t... Is>
+    struct _IndexList {
+    };
+    template <size_t N, size_t... Is>
+    struct _Indices : _Indices<N - 1, N - 1, Is...> {
+    };
+    template <size_t... Is>
+    struct _Indices<0, Is...> {
+        typedef _IndexList<Is...> type;
+    };
+
+    // declared before the columns, which detach from it when destroyed
+    Workspace _workspace;
+    std::tuple<PersistentVector<Columns>...> _columns;
+
+    template <class Column>
+    Workspace& _workspaceFor() {
+        return _workspace;
+    }
+
+    template <size_t... Is>
+    row_type _row(const size_t version, const size_t row, _IndexList<Is...>) const {
+        return row_type(std::get<Is>(_columns).at(version, row)...);
+    }
+
+    template <size_t I>
+    void _push(Workspace::Transaction&)
+    {}
+    template <size_t I, class Head, class... Tail>
+    void _push(Workspace::Transaction& transaction, const Head& head, const Tail&... tail) {
+        transaction.edit(std::get<I>(_columns)).push_back(head);
+        _push<I + 1>(transaction, tail...);
+    }
+
+    template <size_t I>
+    typename std::enable_if<I == sizeof...(Columns)>::type _pop(Workspace::Transaction&)
+    {}
+    template <size_t I>
+    typename std::enable_if<(I < sizeof...(Columns))>::type _pop(Workspace::Transaction& transaction) {
+        transaction.edit(std::get<I>(_columns)).pop_back();
+        _pop<I + 1>(transaction);
+    }
+};
+
+#endif // PERSISTENT_TABLE_HPP
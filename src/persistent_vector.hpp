@@ -1,43 +1,325 @@
 #ifndef PERSISTENT_VECTOR_HPP
 #define PERSISTENT_VECTOR_HPP
 
+#include <algorithm>
+#include <array>
+#include <deque>
 #include <utility>
 #include <functional>
 #include <iterator>
+#include <limits>
+#include <map>
 #include <memory>
+#include <tuple>
+#include <unordered_set>
 #include <utility>
 #include <vector>
+#include "expected.hpp"
+#include "value_storage.hpp"
 #include "version_tree.h"
+#include "workspace.h"
 
-template <class T>
+/* Storage decides how the values written to an index are kept, see value_storage.hpp.
+ * PooledStorage<T> interns equal values once for large or often repeated T. */
+template <class T, class Storage = InlineStorage<T> >
 class PersistentVector {
 public:
     typedef T value_type;
+    typedef typename Storage::const_reference const_reference;
+    typedef Storage storage_type;
 
 private:
-    struct VersionValue {
-        size_t version;
-        T value;
+    // events per fat-node piece, see FatNode
+    static const size_t FAT_NODE_CAPACITY = 64;
+    // fat nodes per directory page, see FatNodeDirectory
+    static const size_t PAGE_SIZE = 64;
+    static const size_t NONE = std::numeric_limits<size_t>::max();
 
-        VersionValue(const size_t version_, const T value_) : version(version_), value(value_)
-        {}
+    /* All values written to one index. Lookups go through the entry and exit events of the written versions
+     * in Euler tour order, each event remembering the value visible right after it. The events are kept in
+     * pieces of at most FAT_NODE_CAPACITY that split in halves when they overflow, so a lookup is two binary
+     * searches however often the index was written. */
+    struct FatNode {
+        struct Event {
+            long event;     // version for its entry event, -version for its exit event
+            size_t owner;   // position in history of the value visible after the event, NONE if none
+
+            Event(const long event_, const size_t owner_) : event(event_), owner(owner_)
+            {}
+        };
+
+        typename Storage::History history;
+        std::vector<std::vector<Event> > pieces;
+
+        // Position in history of the nearest ancestor-or-self of 'version' that wrote this index, NONE if none did
+        size_t find(const VersionTree& versions, const size_t version) const {
+            size_t label = versions.label(version);
+            auto piece = std::upper_bound(pieces.begin(), pieces.end(), label,
+                                          [&versions](const size_t l, const std::vector<Event>& p) {
+                return l < versions.label(p.front().event);
+            });
+            if (piece == pieces.begin()) {
+                return NONE;
+            }
+            --piece;
+            auto event = std::upper_bound(piece->begin(), piece->end(), label,
+                                          [&versions](const size_t l, const Event& e) {
+                return l < versions.label(e.event);
+            });
+            --event;
+            return event->owner;
+        }
 
-        bool operator==(const VersionValue& other) {
-            return version == other.version && value == other.value;
+        // Position in history of the nearest proper ancestor entry of entry 'owner', NONE if there is none.
+        // That is the value visible right before the entry event of the owner's version.
+        size_t parent(const VersionTree& versions, const size_t owner) const {
+            size_t label = versions.label(history.version(owner));
+            size_t pieceIndex = std::upper_bound(pieces.begin(), pieces.end(), label,
+                                                 [&versions](const size_t l, const std::vector<Event>& p) {
+                return l < versions.label(p.front().event);
+            }) - pieces.begin() - 1;
+            const std::vector<Event>& piece = pieces[pieceIndex];
+            size_t eventIndex = std::upper_bound(piece.begin(), piece.end(), label,
+                                                 [&versions](const size_t l, const Event& e) {
+                return l < versions.label(e.event);
+            }) - piece.begin() - 1;
+            if (eventIndex > 0) {
+                return piece[eventIndex - 1].owner;
+            }
+            return pieceIndex > 0 ? pieces[pieceIndex - 1].back().owner : NONE;
         }
-        bool operator==(const VersionValue& other) const {
-            return version == other.version && value == other.value;
+
+        /* Writes the value constructed from 'args' in 'version', which must not have descendants that wrote
+         * this index; that holds for every new version */
+        template <class... Args>
+        void add(const VersionTree& versions, Storage& storage, const size_t version, Args&&... args) {
+            history.emplace_back(version, storage, std::forward<Args>(args)...);
+            size_t owner = history.size() - 1;
+            size_t label = versions.label(version);
+
+            if (pieces.empty()) {
+                pieces.push_back(std::vector<Event>());
+                pieces.back().push_back(Event(version, owner));
+                pieces.back().push_back(Event(-1 * (long)version, NONE));
+                return;
+            }
+            size_t pieceIndex = std::upper_bound(pieces.begin(), pieces.end(), label,
+                                                 [&versions](const size_t l, const std::vector<Event>& p) {
+                return l < versions.label(p.front().event);
+            }) - pieces.begin();
+            pieceIndex = pieceIndex > 0 ? pieceIndex - 1 : 0;
+            std::vector<Event>& piece = pieces[pieceIndex];
+            auto pos = std::upper_bound(piece.begin(), piece.end(), label,
+                                        [&versions](const size_t l, const Event& e) {
+                return l < versions.label(e.event);
+            });
+            size_t previous = pos == piece.begin() ? NONE : (pos - 1)->owner;
+            pos = piece.insert(pos, Event(version, owner));
+            piece.insert(pos + 1, Event(-1 * (long)version, previous));
+
+            if (piece.size() > FAT_NODE_CAPACITY) {
+                auto middle = piece.begin() + piece.size() / 2;
+                std::vector<Event> upper(middle, piece.end());
+                piece.erase(middle, piece.end());
+                pieces.insert(pieces.begin() + pieceIndex + 1, upper);
+            }
+        }
+
+        // Drops the values whose 'keep' flag is false and rebuilds the lookup index
+        void retain(const VersionTree& versions, Storage& storage, const std::vector<bool>& keep) {
+            history.retain(keep, storage);
+
+            std::vector<std::pair<size_t, Event> > events;
+            for (size_t i = 0; i < history.size(); ++i) {
+                long version = history.version(i);
+                events.push_back(std::make_pair(versions.label(version), Event(version, i)));
+                events.push_back(std::make_pair(versions.label(-1 * version), Event(-1 * version, NONE)));
+            }
+            std::sort(events.begin(), events.end(),
+                      [](const std::pair<size_t, Event>& l, const std::pair<size_t, Event>& r) {
+                return l.first < r.first;
+            });
+            pieces.clear();
+            std::vector<size_t> open;
+            for (auto& labeled : events) {
+                Event& event = labeled.second;
+                if (event.event > 0) {
+                    open.push_back(event.owner);
+                } else {
+                    open.pop_back();
+                    event.owner = open.empty() ? NONE : open.back();
+                }
+                if (pieces.empty() || pieces.back().size() >= FAT_NODE_CAPACITY / 2) {
+                    pieces.push_back(std::vector<Event>());
+                }
+                pieces.back().push_back(event);
+            }
+        }
+
+        bool equals(const FatNode& other, const Storage& storage, const Storage& otherStorage) const {
+            return history.equals(other.history, storage, otherStorage);
         }
     };
 
-    struct FatNode {
-        std::list<VersionValue> nodeVersions;
+    /* Fat nodes of all indices. Pages of PAGE_SIZE nodes are allocated by the first write to one of their
+     * indices and are found through a two-level table, so indices that were never written cost nothing
+     * and a huge, mostly untouched vector needs one pointer per TABLE_SIZE pages. */
+    class FatNodeDirectory {
+    public:
+        FatNodeDirectory()
+        {}
+        FatNodeDirectory(const FatNodeDirectory& other) {
+            _copy(other);
+        }
+        FatNodeDirectory(FatNodeDirectory&& other) : _tables(std::move(other._tables))
+        {}
+        FatNodeDirectory& operator=(const FatNodeDirectory& other) {
+            if (this != &other) {
+                _tables.clear();
+                _copy(other);
+            }
+            return *this;
+        }
+        FatNodeDirectory& operator=(FatNodeDirectory&& other) {
+            std::swap(_tables, other._tables);
+            return *this;
+        }
+
+        // nullptr if no index of the page was written
+        const FatNode* find(const size_t index) const {
+            const std::unique_ptr<Page>* page = _page(index);
+            return page && *page ? &(**page)[index % PAGE_SIZE] : nullptr;
+        }
+        FatNode* find(const size_t index) {
+            const std::unique_ptr<Page>* page = _page(index);
+            return page && *page ? &(**page)[index % PAGE_SIZE] : nullptr;
+        }
+        FatNode& operator[](const size_t index) {
+            size_t table = index / TABLE_SPAN;
+            if (table >= _tables.size()) {
+                _tables.resize(table + 1);
+            }
+            if (!_tables[table]) {
+                _tables[table].reset(new Table());
+            }
+            std::unique_ptr<Page>& page = (*_tables[table])[index % TABLE_SPAN / PAGE_SIZE];
+            if (!page) {
+                page.reset(new Page());
+            }
+            return (*page)[index % PAGE_SIZE];
+        }
+        // The first index from 'index' on that has a fat node, capacity() if there is none
+        size_t next(size_t index) const {
+            while (index < capacity()) {
+                if (!_tables[index / TABLE_SPAN]) {
+                    index = (index / TABLE_SPAN + 1) * TABLE_SPAN;
+                } else if (!*_page(index)) {
+                    index = (index / PAGE_SIZE + 1) * PAGE_SIZE;
+                } else {
+                    return index;
+                }
+            }
+            return capacity();
+        }
+        size_t capacity() const {
+            return _tables.size() * TABLE_SPAN;
+        }
+        // Releases the pages none of whose indices has entries left
+        void trim() {
+            for (auto& table : _tables) {
+                if (!table) {
+                    continue;
+                }
+                bool empty = true;
+                for (auto& page : *table) {
+                    if (page && std::all_of(page->begin(), page->end(), [](const FatNode& node) {
+                        return node.history.empty();
+                    })) {
+                        page.reset();
+                    }
+                    empty = empty && !page;
+                }
+                if (empty) {
+                    table.reset();
+                }
+            }
+            while (!_tables.empty() && !_tables.back()) {
+                _tables.pop_back();
+            }
+        }
+        void clear() {
+            _tables.clear();
+        }
 
-        bool operator==(const FatNode& other) {
-            return nodeVersions == other.nodeVersions;
+        bool equals(const FatNodeDirectory& other, const Storage& storage, const Storage& otherStorage) const {
+            size_t index = std::min(next(0), other.next(0));
+            while (index < std::max(capacity(), other.capacity())) {
+                const FatNode* node = find(index);
+                const FatNode* otherNode = other.find(index);
+                bool empty = !node || node->history.empty();
+                bool otherEmpty = !otherNode || otherNode->history.empty();
+                if (empty != otherEmpty || (!empty && !node->equals(*otherNode, storage, otherStorage))) {
+                    return false;
+                }
+                index = std::min(next(index + 1), other.next(index + 1));
+            }
+            return true;
         }
-        bool operator==(const FatNode& other) const {
-            return nodeVersions == other.nodeVersions;
+
+    private:
+        // pages per table of the directory
+        static const size_t TABLE_SIZE = 512;
+        static const size_t TABLE_SPAN = TABLE_SIZE * PAGE_SIZE;
+
+        typedef std::array<FatNode, PAGE_SIZE> Page;
+        typedef std::array<std::unique_ptr<Page>, TABLE_SIZE> Table;
+
+        std::vector<std::unique_ptr<Table> > _tables;
+
+        // nullptr if the index lies beyond the allocated tables
+        const std::unique_ptr<Page>* _page(const size_t index) const {
+            size_t table = index / TABLE_SPAN;
+            if (table >= _tables.size() || !_tables[table]) {
+                return nullptr;
+            }
+            return &(*_tables[table])[index % TABLE_SPAN / PAGE_SIZE];
+        }
+        void _copy(const FatNodeDirectory& other) {
+            _tables.resize(other._tables.size());
+            for (size_t table = 0; table < _tables.size(); ++table) {
+                if (!other._tables[table]) {
+                    continue;
+                }
+                _tables[table].reset(new Table());
+                for (size_t page = 0; page < TABLE_SIZE; ++page) {
+                    if ((*other._tables[table])[page]) {
+                        (*_tables[table])[page].reset(new Page(*(*other._tables[table])[page]));
+                    }
+                }
+            }
+        }
+    };
+
+    // Left by resize() growing a version: in 'version' and its descendants the indices from 'from' on
+    // read 'value' until a descendant writes them
+    struct Reset {
+        size_t version;
+        size_t from;
+        value_type value;
+        // position in _resets of the next reset up the version's ancestry, NONE if there is none
+        size_t previous;
+        /* The nearest reset up the ancestry with a smaller 'from', NONE if there is none, the number of such
+         * links above, and a jump pointer further up that chain (to itself at its top), set by _linkReset() */
+        size_t lower;
+        size_t depth;
+        size_t jump;
+
+        Reset(const size_t version_, const size_t from_, const value_type& value_, const size_t previous_)
+            : version(version_), from(from_), value(value_), previous(previous_), lower(NONE), depth(0), jump(NONE)
+        {}
+
+        bool operator==(const Reset& other) const {
+            return version == other.version && from == other.from && value == other.value;
         }
     };
 
@@ -52,10 +334,10 @@ private:
             : _vector(vector), _cur(cur), _version(version), _isEnd(false)
         {}
         VectorIterator(const VectorIterator& other)
-            : _vector(other._vector), _cur(other._cur), _version(other._version), _isEnd(false)
+            : _vector(other._vector), _cur(other._cur), _version(other._version), _isEnd(other._isEnd)
         {}
         VectorIterator(VectorIterator&& other)
-                : _vector(other._vector), _cur(other._cur), _version(other._version), _isEnd(false) {
+                : _vector(other._vector), _cur(other._cur), _version(other._version), _isEnd(other._isEnd) {
             other._cur = 0;
             other._version = 0;
         }
@@ -118,16 +400,24 @@ private:
         bool operator!=(const VectorIterator& other) const {
             return !operator ==(other);
         }
-        const value_type& operator*() {
+        const_reference operator*() {
             if (_cur >= 0) {
                 return _vector.at(_version, _cur);
             } else {
                 throw new std::out_of_range("Iterator is out of range");
             }
         }
-        const value_type* operator->() {
-            if (_cur) {
-                return &(_vector.at(_version, _cur));
+        // Keeps a by-value const_reference, as CompressedStorage returns, alive for the member access
+        struct Arrow {
+            const_reference value;
+
+            const value_type* operator->() const {
+                return &value;
+            }
+        };
+        Arrow operator->() {
+            if (!_isEnd) {
+                return Arrow{_vector.at(_version, _cur)};
             } else {
                 throw new std::out_of_range("Iterator is out of range");
             }
@@ -142,42 +432,197 @@ private:
 public:
     typedef VectorIterator<const value_type> iterator;
 
-    PersistentVector() {
+    /* Deferred-write mode: edits on top of a version are buffered and written to the fat nodes
+     * as a single version by publish(), at most one entry per touched index. The batch then
+     * continues from the published version. */
+    class Batch {
+        friend class PersistentVector;
+
+    public:
+        Batch(Batch&& other)
+            : _vector(other._vector), _srcVersion(other._srcVersion), _size(other._size),
+              _writes(std::move(other._writes)) {
+            other._vector = nullptr;
+        }
+        Batch(const Batch& other) = delete;
+        Batch& operator=(const Batch& other) = delete;
+
+        const_reference at(const size_t index) const {
+            if (index >= _size) {
+                throwAccessError(AccessError::INDEX_OUT_OF_RANGE, index);
+            }
+            auto it = _writes.find(index);
+            if (it != _writes.end()) {
+                return it->second;
+            }
+            return _vector->at(_srcVersion, index);
+        }
+        void update(const size_t index, const value_type& value) {
+            if (index >= _size) {
+                throwAccessError(AccessError::INDEX_OUT_OF_RANGE, index);
+            }
+            _writes[index] = value;
+        }
+        void update(const size_t index, value_type&& value) {
+            if (index >= _size) {
+                throwAccessError(AccessError::INDEX_OUT_OF_RANGE, index);
+            }
+            _writes[index] = std::move(value);
+        }
+        void push_back(const value_type& value) {
+            _writes[_size++] = value;
+        }
+        void push_back(value_type&& value) {
+            _writes[_size++] = std::move(value);
+        }
+        // Indices past the size are never buffered, so the value is constructed in a new entry
+        template <class... Args>
+        void emplace_back(Args&&... args) {
+            _writes.emplace(std::piecewise_construct, std::forward_as_tuple(_size),
+                            std::forward_as_tuple(std::forward<Args>(args)...));
+            ++_size;
+        }
+        void pop_back() {
+            if (_size == 0) {
+                throw new std::out_of_range("Vector is empty");
+            }
+            _writes.erase(--_size);
+        }
+        // Inserts before 'index'; every later element is buffered one index up, as insert() writes them
+        void insert(const size_t index, const value_type& value) {
+            if (index > _size) {
+                throwAccessError(AccessError::INDEX_OUT_OF_RANGE, index);
+            }
+            for (size_t i = _size; i > index; --i) {
+                _shift(i, i - 1);
+            }
+            ++_size;
+            _writes[index] = value;
+        }
+        void erase(const size_t index) {
+            if (index >= _size) {
+                throwAccessError(AccessError::INDEX_OUT_OF_RANGE, index);
+            }
+            for (size_t i = index; i + 1 < _size; ++i) {
+                _shift(i, i + 1);
+            }
+            _writes.erase(--_size);
+        }
+        size_t size() const {
+            return _size;
+        }
+        bool empty() const {
+            return _size == 0;
+        }
+
+        // Materializes the buffered edits as a new version of the vector and returns its number
+        size_t publish() {
+            size_t version = _vector->_newVersion(_srcVersion, _size);
+            for (auto it = _writes.begin(); it != _writes.end(); ++it) {
+                _vector->_fatNodes[it->first].add(*_vector->_versions, _vector->_storage, version,
+                                                  std::move(it->second));
+            }
+            _writes.clear();
+            _srcVersion = version;
+            return version;
+        }
+
+    private:
+        Batch(PersistentVector& vector, const size_t srcVersion)
+            : _vector(&vector), _srcVersion(srcVersion), _size(vector._versionSizes[srcVersion])
+        {}
+
+        // Buffers the current value of 'from' at 'to'; a buffered 'from' is moved, it is overwritten next
+        void _shift(const size_t to, const size_t from) {
+            auto it = _writes.find(from);
+            if (it != _writes.end()) {
+                _writes[to] = std::move(it->second);
+            } else {
+                _writes[to] = _vector->at(_srcVersion, from);
+            }
+        }
+
+        PersistentVector* _vector;
+        size_t _srcVersion;
+        size_t _size;
+        std::map<size_t, value_type> _writes;
+    };
+
+    PersistentVector()
+            : _versions(std::make_shared<VersionTree>()), _workspace(nullptr), _defaultValue(),
+              _collecting(false), _retiredDuringPass(false), _collectCursor(0), _collectVersions(0) {
         _versionSizes.push_back(0);
+        _versionResets.push_back(NONE);
+    }
+    // Member of 'workspace', versions live in the workspace's tree. The vector is empty in every
+    // version the workspace already has
+    explicit PersistentVector(Workspace& workspace)
+            : _versionSizes(workspace.versionsNumber(), 0), _versions(workspace._versionTree()),
+              _workspace(&workspace), _versionResets(workspace.versionsNumber(), NONE), _defaultValue(), _collecting(false), _retiredDuringPass(false),
+              _collectCursor(0), _collectVersions(0) {
+        _workspace->_attach(this, [this](size_t version, size_t srcVersion) { _alias(version, srcVersion); },
+                            [this](size_t version) { _drop(version); });
     }
+    // Copies never belong to a workspace and get their own version tree. Workspace members can't be
+    // assigned to or from, their versions are numbered by the workspace
     PersistentVector(const PersistentVector& other)
-            : _fatNodes(other._fatNodes), _versionSizes(other._versionSizes), _versions(other._versions) {
+            : _fatNodes(other._fatNodes), _versionSizes(other._versionSizes),
+              _versions(std::make_shared<VersionTree>(*other._versions)), _workspace(nullptr),
+              _storage(other._storage), _resets(other._resets), _versionResets(other._versionResets), _defaultValue(),
+              _retired(other._retired),
+              _collecting(false), _retiredDuringPass(false), _collectCursor(0), _collectVersions(0) {
     }
     PersistentVector(PersistentVector&& other)
-            : _fatNodes(other._fatNodes), _versionSizes(other._versionSizes), _versions(other._versions) {
+            : _fatNodes(other._fatNodes), _versionSizes(other._versionSizes),
+              _versions(std::make_shared<VersionTree>(*other._versions)), _workspace(nullptr),
+              _storage(other._storage), _resets(other._resets), _versionResets(other._versionResets), _defaultValue(),
+              _retired(other._retired),
+              _collecting(false), _retiredDuringPass(false), _collectCursor(0), _collectVersions(0) {
         other.clear();
     }
     PersistentVector& operator=(const PersistentVector& other) {
-        if (*this != other) {
+        if (this != &other) {
+            _checkAssignable(other);
             clear();
             _fatNodes = other._fatNodes;
             _versionSizes = other._versionSizes;
-            _versions = other._versions;
+            _versions = std::make_shared<VersionTree>(*other._versions);
+            _storage = other._storage;
+            _resets = other._resets;
+            _versionResets = other._versionResets;
+            _retired = other._retired;
         }
         return *this;
     }
     PersistentVector& operator=(PersistentVector&& other) {
-        if (*this != other) {
+        if (this != &other) {
+            _checkAssignable(other);
             std::swap(_fatNodes, other._fatNodes);
             std::swap(_versionSizes, other._versionSizes);
             std::swap(_versions, other._versions);
+            std::swap(_storage, other._storage);
+            std::swap(_resets, other._resets);
+            std::swap(_versionResets, other._versionResets);
+            std::swap(_retired, other._retired);
+            _collecting = false;
+            other._collecting = false;
         }
         return *this;
     }
     ~PersistentVector() {
+        if (_workspace) {
+            _workspace->_detach(this);
+        }
         clear();
     }
 
     bool operator==(const PersistentVector& other) {
-        return _fatNodes == other._fatNodes && _versionSizes == other._versionSizes && _versions == other._versions;
+        return _versionSizes == other._versionSizes && _resets == other._resets && *_versions == *other._versions
+                && _fatNodes.equals(other._fatNodes, _storage, other._storage);
     }
     bool operator==(const PersistentVector& other) const {
-        return _fatNodes == other._fatNodes && _versionSizes == other._versionSizes && _versions == other._versions;
+        return _versionSizes == other._versionSizes && _resets == other._resets && *_versions == *other._versions
+                && _fatNodes.equals(other._fatNodes, _storage, other._storage);
     }
     bool operator!=(const PersistentVector& other) {
         return !operator ==(other);
@@ -186,27 +631,47 @@ public:
         return !operator ==(other);
     }
 
-    inline const value_type& at(const size_t version, const size_t index) const {
+    /* Checks the index only. Reading a version that squash() or the garbage collector removed is undefined,
+     * it sees whatever the collected fat nodes hold now; try_at() reports such a version */
+    inline const_reference at(const size_t version, const size_t index) const {
+        if (index >= _versionSizes[version]) {
+            throwAccessError(AccessError::INDEX_OUT_OF_RANGE, index);
+        }
+        return _getLatestVersion(version, index);
+    }
+    // at() without any check, for trusted loops: 'version' and 'index' must be valid
+    inline const_reference unchecked_at(const size_t version, const size_t index) const {
+        return _getLatestVersion(version, index);
+    }
+    // at() reporting an invalid version or index as the error instead of throwing
+    inline Expected<const_reference> try_at(const size_t version, const size_t index) const {
+        if (!_isLive(version)) {
+            return AccessError::INVALID_VERSION;
+        }
         if (index >= _versionSizes[version]) {
-            throw new std::out_of_range("Index out of range: " + index);
+            return AccessError::INDEX_OUT_OF_RANGE;
         }
         return _getLatestVersion(version, index);
     }
 
     void update(const size_t srcVersion, const size_t index, const value_type& value) {
-        if (index >= _versionSizes[srcVersion]) {
-            throw new std::out_of_range("Index out of range: " + index);
-        }
-        size_t version = _versions.size();
-        _versions.insert(version, srcVersion);
-        _versionSizes.push_back(_versionSizes[srcVersion]);
-        _fatNodes[index].nodeVersions.push_back(VersionValue(version, value));
+        _update(srcVersion, index, value);
+    }
+    void update(const size_t srcVersion, const size_t index, value_type&& value) {
+        _update(srcVersion, index, std::move(value));
+    }
+    // update() reporting an invalid version or index as the error, no version is made then
+    Expected<void> try_update(const size_t srcVersion, const size_t index, const value_type& value) {
+        return _tryUpdate(srcVersion, index, value);
+    }
+    Expected<void> try_update(const size_t srcVersion, const size_t index, value_type&& value) {
+        return _tryUpdate(srcVersion, index, std::move(value));
     }
 
-    const value_type& front(const size_t version) const {
+    const_reference front(const size_t version) const {
         return _getLatestVersion(version, 0);
     }
-    const value_type& back(const size_t version) const {
+    const_reference back(const size_t version) const {
         return _getLatestVersion(version, _versionSizes[version] - 1);
     }
 
@@ -229,81 +694,595 @@ public:
         return _versionSizes[version];
     }
     inline size_t versionsNumber() const {
-        return _versions.size();
+        return _versionSizes.size();
+    }
+    inline const storage_type& storage() const {
+        return _storage;
     }
+    // A workspace member keeps its versions, all of them become empty
     inline void clear() noexcept {
         _fatNodes.clear();
-        _versions.clear();
-        _versionSizes.clear();
-        _versionSizes.push_back(0);
+        _storage.clear();
+        _resets.clear();
+        if (_workspace) {
+            std::fill(_versionSizes.begin(), _versionSizes.end(), 0);
+            std::fill(_versionResets.begin(), _versionResets.end(), NONE);
+        } else {
+            _versions->clear();
+            _versionSizes.clear();
+            _versionSizes.push_back(0);
+            _versionResets.clear();
+            _versionResets.push_back(NONE);
+        }
+        _retired.clear();
+        _collecting = false;
     }
 
     inline void insert(const size_t srcVersion, iterator pos, const value_type& value) {
+        emplace(srcVersion, pos, value);
+    }
+    inline void insert(const size_t srcVersion, iterator pos, value_type&& value) {
+        emplace(srcVersion, pos, std::move(value));
+    }
+    // insert() of the value constructed from 'args' in its fat node
+    template <class... Args>
+    void emplace(const size_t srcVersion, iterator pos, Args&&... args) {
         if (pos == end()) {
-            push_back(srcVersion, value);
+            emplace_back(srcVersion, std::forward<Args>(args)...);
             return;
         }
-        size_t version = _versions.size();
-        _versions.insert(version, srcVersion);
-
-        _versionSizes.push_back(_versionSizes[srcVersion] + 1);
-        if (_fatNodes.size() < _versionSizes[version]) {
-            _fatNodes.push_back(FatNode());
-        }
+        size_t version = _newVersion(srcVersion, _versionSizes[srcVersion] + 1);
 
         auto posIndex = pos._cur;
-        value_type curValue = value;
-        for (size_t i = posIndex; i < _versionSizes[srcVersion]; ++i) {
-            _fatNodes[i].nodeVersions.push_back(VersionValue(version, curValue));
-            curValue = at(srcVersion, i);
+        _fatNodes[posIndex].add(*_versions, _storage, version, std::forward<Args>(args)...);
+        // the values from 'pos' on move up by one; the source version keeps them, so they are copied
+        for (size_t i = posIndex + 1; i < _versionSizes[version]; ++i) {
+            _fatNodes[i].add(*_versions, _storage, version, at(srcVersion, i - 1));
         }
-        _fatNodes[_versionSizes[version] - 1].nodeVersions.push_back(VersionValue(version, curValue));
     }
     inline void erase(const size_t srcVersion, iterator pos) {
         if (pos == end()) {
             return;
         }
-        size_t version = _versions.size();
-        _versions.insert(version, srcVersion);
-
-        _versionSizes.push_back(_versionSizes[srcVersion] - 1);
+        size_t version = _newVersion(srcVersion, _versionSizes[srcVersion] - 1);
 
         auto posIndex = pos._cur;
         for (size_t i = posIndex + 1; i < _versionSizes[srcVersion]; ++i) {
             value_type curValue = at(srcVersion, i);
-            _fatNodes[i - 1].nodeVersions.push_back(VersionValue(version, curValue));
+            _fatNodes[i - 1].add(*_versions, _storage, version, curValue);
         }
     }
     void push_back(const size_t srcVersion, const value_type& value) {
-        size_t version = _versions.size();
-        _versions.insert(version, srcVersion);
+        emplace_back(srcVersion, value);
+    }
+    void push_back(const size_t srcVersion, value_type&& value) {
+        emplace_back(srcVersion, std::move(value));
+    }
+    // push_back() of the value constructed from 'args' in its fat node
+    template <class... Args>
+    void emplace_back(const size_t srcVersion, Args&&... args) {
+        size_t version = _newVersion(srcVersion, _versionSizes[srcVersion] + 1);
+        _fatNodes[_versionSizes[version] - 1].add(*_versions, _storage, version, std::forward<Args>(args)...);
+    }
+    void pop_back(const size_t srcVersion) {
+        _newVersion(srcVersion, _versionSizes[srcVersion] - 1);
+    }
+    // pop_back() reporting an invalid version or an empty one as the error, no version is made then
+    Expected<void> try_pop_back(const size_t srcVersion) {
+        if (!_isWritable(srcVersion)) {
+            return AccessError::INVALID_VERSION;
+        }
+        if (_versionSizes[srcVersion] == 0) {
+            return AccessError::EMPTY;
+        }
+        _newVersion(srcVersion, _versionSizes[srcVersion] - 1);
+        return Expected<void>();
+    }
+    /* Values 'index' had on the path from the root to 'version', oldest first, as (version, value) pairs:
+     * the writes of ancestors-or-self and the resizes that covered it. The writes are found by walking from
+     * the nearest one to the value visible before each one's entry event, O(h log n) for h writes.
+     * Like try_at(), a version that was squashed or collected is invalid. */
+    std::vector<std::pair<size_t, value_type> > history(const size_t version, const size_t index) const {
+        if (!_isLive(version)) {
+            throwAccessError(AccessError::INVALID_VERSION, version);
+        }
+        if (index >= _versionSizes[version]) {
+            throwAccessError(AccessError::INDEX_OUT_OF_RANGE, index);
+        }
+        return _history(version, index, _ancestorResets(version));
+    }
+    // history() of several indices of one version
+    std::vector<std::vector<std::pair<size_t, value_type> > > history(const size_t version,
+                                                                     const std::vector<size_t>& indices) const {
+        if (!_isLive(version)) {
+            throwAccessError(AccessError::INVALID_VERSION, version);
+        }
+        std::vector<const Reset*> resets = _ancestorResets(version);
+        std::vector<std::vector<std::pair<size_t, value_type> > > histories;
+        histories.reserve(indices.size());
+        for (auto index : indices) {
+            if (index >= _versionSizes[version]) {
+                throwAccessError(AccessError::INDEX_OUT_OF_RANGE, index);
+            }
+            histories.push_back(_history(version, index, resets));
+        }
+        return histories;
+    }
 
-        _versionSizes.push_back(_versionSizes[srcVersion] + 1);
-        if (_fatNodes.size() < _versionSizes[version]) {
-            _fatNodes.push_back(FatNode());
+    /* Writes the values of every index of 'version' to 'out' in index order. The fat-node directory is
+     * walked once and the ancestor resets are resolved once, instead of looking each index up like at() */
+    template <class OutputIt>
+    OutputIt copy(const size_t version, OutputIt out) const {
+        if (version >= _versionSizes.size()) {
+            throwAccessError(AccessError::INVALID_VERSION, version);
         }
-        _fatNodes[_versionSizes[version] - 1].nodeVersions.push_back(VersionValue(version, value));
+        std::vector<const Reset*> resets = _ancestorResets(version);
+        // the deepest covering reset only changes where one starts, so they are taken in order of 'from'
+        std::vector<size_t> byFrom(resets.size());
+        for (size_t i = 0; i < resets.size(); ++i) {
+            byFrom[i] = i;
+        }
+        std::stable_sort(byFrom.begin(), byFrom.end(), [&resets](const size_t l, const size_t r) {
+            return resets[l]->from < resets[r]->from;
+        });
+        auto nextReset = byFrom.begin();
+        const Reset* reset = nullptr;
+        size_t deepest = 0;
+        size_t size = _versionSizes[version];
+        size_t written = _fatNodes.next(0);
+        for (size_t index = 0; index < size; ++index) {
+            for (; nextReset != byFrom.end() && resets[*nextReset]->from <= index; ++nextReset) {
+                if (!reset || *nextReset >= deepest) {
+                    deepest = *nextReset;
+                    reset = resets[deepest];
+                }
+            }
+            if (written < index) {
+                written = _fatNodes.next(index);
+            }
+            const FatNode* fatNode = written == index ? _fatNodes.find(index) : nullptr;
+            size_t owner = fatNode && !fatNode->history.empty() ? fatNode->find(*_versions, version) : NONE;
+            *out++ = _visible(fatNode, owner, reset);
+        }
+        return out;
     }
-    void pop_back(const size_t srcVersion) {
-        _versions.insert(_versions.size(), srcVersion);
-        _versionSizes.push_back(_versionSizes[srcVersion] - 1);
+
+    // O(1): indices added by growing read 'value' until they are written
+    void resize(const size_t srcVersion, const size_t size, const value_type& value = value_type()) {
+        size_t version = _newVersion(srcVersion, size);
+        if (size > _versionSizes[srcVersion]) {
+            _resets.push_back(Reset(version, _versionSizes[srcVersion], value, _versionResets[version]));
+            _versionResets[version] = _resets.size() - 1;
+            _linkReset(_resets.size() - 1);
+        }
+    }
+
+    Batch batch(const size_t srcVersion) {
+        if (srcVersion >= _versionSizes.size()) {
+            throwAccessError(AccessError::INVALID_VERSION, srcVersion);
+        }
+        return Batch(*this, srcVersion);
+    }
+
+    /* Removes the chain of versions between 'from' and its descendant 'to', so 'to' becomes a child of 'from'.
+     * Every removed version must have exactly one child. The values 'to' inherited from them are rewritten
+     * as entries of 'to', all other entries of the removed versions are dropped, and their resizes move to 'to'. Removed version numbers
+     * are not reused and become invalid. Not available for workspace members. */
+    void squash(const size_t from, const size_t to) {
+        if (_workspace) {
+            throw new std::out_of_range("Can't squash versions shared with a workspace");
+        }
+        std::vector<long> removed = _versions->squash(from, to);
+        if (removed.empty()) {
+            return;
+        }
+        for (auto version : removed) {
+            _retired.erase(version);
+        }
+        _collecting = false;
+        std::unordered_set<size_t> chain(removed.begin(), removed.end());
+        chain.insert(to);
+        std::vector<Reset*> chainResets;
+        for (auto& reset : _resets) {
+            if (chain.count(reset.version)) {
+                chainResets.push_back(&reset);
+            }
+        }
+        for (size_t index = _fatNodes.next(0); index < _fatNodes.capacity(); index = _fatNodes.next(index + 1)) {
+            FatNode* fatNode = _fatNodes.find(index);
+            auto& history = fatNode->history;
+            size_t last = NONE;
+            for (size_t i = 0; i < history.size(); ++i) {
+                if (chain.count(history.version(i))) {
+                    last = i;
+                }
+            }
+            if (last == NONE) {
+                continue;
+            }
+            std::vector<bool> keep(history.size(), true);
+            for (size_t i = 0; i < last; ++i) {
+                keep[i] = !chain.count(history.version(i));
+            }
+            // the latest entry survives unless a later resize of the chain covers it
+            for (auto reset : chainResets) {
+                if (reset->from <= index && reset->version > history.version(last)) {
+                    keep[last] = false;
+                }
+            }
+            history.setVersion(last, to);
+            fatNode->retain(*_versions, _storage, keep);
+        }
+        for (auto reset : chainResets) {
+            reset->version = to;
+        }
+        _indexResets();
+        _fatNodes.trim();
+    }
+
+    /* Marks a version as no longer needed. Its fat-node entries are purged by the garbage collector
+     * unless a live descendant still reads them, and it leaves the version tree once it has no live
+     * descendants. New versions can't be derived from a retired one. A retired version stays readable until
+     * it is removed; at() on it is undefined from then on. Not available for workspace members. */
+    void retire(const size_t version) {
+        if (_workspace || version == 0 || version >= _versionSizes.size() || !_versions->contains(version)) {
+            throwAccessError(AccessError::INVALID_VERSION, version);
+        }
+        _retired.insert(version);
+        if (_collecting) {
+            _retiredDuringPass = true;
+        }
+    }
+
+    /* Incremental garbage collection: examines up to 'steps' fat nodes and drops the entries no live
+     * version can read. Every write runs a few steps by itself; returns true once a full pass is done
+     * and retired versions without live descendants were removed. A pass that was running when a version
+     * got retired is followed by another one. */
+    bool collect(size_t steps) {
+        if (!_collecting) {
+            if (_retired.empty()) {
+                return true;
+            }
+            _startCollection();
+        }
+        while (true) {
+            // indices without entries are skipped for free
+            while (steps > 0 && (_collectCursor = _fatNodes.next(_collectCursor)) < _fatNodes.capacity()) {
+                if (!_fatNodes.find(_collectCursor)->history.empty()) {
+                    _collectFatNode(_collectCursor);
+                    --steps;
+                }
+                ++_collectCursor;
+            }
+            if (_collectCursor < _fatNodes.capacity()) {
+                return false;
+            }
+            _finishCollection();
+            if (!_retiredDuringPass || _retired.empty()) {
+                return true;
+            }
+            _startCollection();
+        }
     }
 
 private:
-    std::vector<FatNode> _fatNodes;
+    // fat nodes examined by the garbage collector on every write while retired versions exist
+    static const size_t COLLECT_STEPS = 2;
+
+    FatNodeDirectory _fatNodes;
     std::vector<size_t> _versionSizes;
-    VersionTree _versions;
+    // own tree, or the workspace's one shared with the other members
+    std::shared_ptr<VersionTree> _versions;
+    Workspace* _workspace;
+    Storage _storage;
+    // in creation order, so the deepest ancestor's reset is the last one
+    std::deque<Reset> _resets;
+    // per version, position in _resets of the deepest reset of an ancestor-or-self, NONE if there is none
+    std::vector<size_t> _versionResets;
+    // read by indices that were never written
+    value_type _defaultValue;
+    std::unordered_set<size_t> _retired;
+
+    // state of the running collection pass, see collect()
+    bool _collecting;
+    bool _retiredDuringPass;
+    size_t _collectCursor;
+    // versions created after the pass started are not in the snapshot and keep all their entries
+    size_t _collectVersions;
+    std::vector<size_t> _collectLive;
+    std::vector<size_t> _collectRetired;
+
+    template <class V>
+    void _update(const size_t srcVersion, const size_t index, V&& value) {
+        if (index >= _versionSizes[srcVersion]) {
+            throwAccessError(AccessError::INDEX_OUT_OF_RANGE, index);
+        }
+        size_t version = _newVersion(srcVersion, _versionSizes[srcVersion]);
+        _fatNodes[index].add(*_versions, _storage, version, std::forward<V>(value));
+    }
+    template <class V>
+    Expected<void> _tryUpdate(const size_t srcVersion, const size_t index, V&& value) {
+        if (!_isWritable(srcVersion)) {
+            return AccessError::INVALID_VERSION;
+        }
+        if (index >= _versionSizes[srcVersion]) {
+            return AccessError::INDEX_OUT_OF_RANGE;
+        }
+        size_t version = _newVersion(srcVersion, _versionSizes[srcVersion]);
+        _fatNodes[index].add(*_versions, _storage, version, std::forward<V>(value));
+        return Expected<void>();
+    }
+    void _checkAssignable(const PersistentVector& other) const {
+        if (_workspace || other._workspace) {
+            throw new std::out_of_range("Can't assign containers shared with a workspace");
+        }
+    }
+    /* The one validity check of the try_* accessors: the version was made and is still in the version tree,
+     * which squash() and the garbage collector remove versions from */
+    inline bool _isLive(const size_t version) const {
+        return version < _versionSizes.size() && _versions->contains(version);
+    }
+    inline bool _isWritable(const size_t version) const {
+        return _isLive(version) && (_retired.empty() || !_retired.count(version));
+    }
+    size_t _newVersion(const size_t srcVersion, const size_t size) {
+        if (!_isWritable(srcVersion)) {
+            throwAccessError(AccessError::INVALID_VERSION, srcVersion);
+        }
+        if (!_retired.empty()) {
+            collect(COLLECT_STEPS);
+        }
+        size_t version = _versionSizes.size();
+        if (_workspace) {
+            version = _workspace->_beginVersion(srcVersion);
+        } else {
+            _versions->insert(version, srcVersion);
+        }
+        _versionSizes.push_back(size);
+        _versionResets.push_back(_versionResets[srcVersion]);
+        if (_workspace) {
+            _workspace->_endVersion(version, srcVersion);
+        }
+        return version;
+    }
+    // Workspace version made without this vector: same contents as 'srcVersion'
+    void _alias(const size_t version, const size_t srcVersion) {
+        if (_versionSizes.size() == version) {
+            _versionSizes.push_back(_versionSizes[srcVersion]);
+            _versionResets.push_back(_versionResets[srcVersion]);
+        }
+    }
+    /* Workspace version whose commit failed. Its entries are the last ones of their histories, but which
+     * indices it wrote is not recorded, so every fat node is looked at; only failed commits get here */
+    void _drop(const size_t version) {
+        if (_versionSizes.size() != version + 1) {
+            return;
+        }
+        for (size_t index = _fatNodes.next(0); index < _fatNodes.capacity(); index = _fatNodes.next(index + 1)) {
+            FatNode& node = _fatNodes[index];
+            if (!node.history.empty() && node.history.version(node.history.size() - 1) == version) {
+                std::vector<bool> keep(node.history.size(), true);
+                keep.back() = false;
+                node.retain(*_versions, _storage, keep);
+            }
+        }
+        while (!_resets.empty() && _resets.back().version == version) {
+            _resets.pop_back();
+        }
+        _versionSizes.pop_back();
+        _versionResets.pop_back();
+    }
+
+    void _startCollection() {
+        _collectLive.clear();
+        for (size_t version = 0; version < _versionSizes.size(); ++version) {
+            if (_versions->contains(version) && !_retired.count(version)) {
+                _collectLive.push_back(version);
+            }
+        }
+        const VersionTree& versions = *_versions;
+        std::sort(_collectLive.begin(), _collectLive.end(), [&versions](const size_t lv, const size_t rv) {
+            return versions.interval(lv).first < versions.interval(rv).first;
+        });
+        _collectRetired.assign(_retired.begin(), _retired.end());
+        _collectCursor = 0;
+        _collectVersions = _versionSizes.size();
+        _collecting = true;
+        _retiredDuringPass = false;
+    }
+
+    /* An entry is kept if it is the nearest ancestor entry of some live version that contains 'index'.
+     * Entries and live versions are swept in Euler tour order keeping the chain of open entries. */
+    void _collectFatNode(const size_t index) {
+        auto& history = _fatNodes.find(index)->history;
+        if (history.empty()) {
+            return;
+        }
+        std::vector<std::pair<std::pair<size_t, size_t>, size_t> > entries;
+        for (size_t i = 0; i < history.size(); ++i) {
+            entries.push_back(std::make_pair(_versions->interval(history.version(i)), i));
+        }
+        std::sort(entries.begin(), entries.end(),
+                  [](const std::pair<std::pair<size_t, size_t>, size_t>& l,
+                     const std::pair<std::pair<size_t, size_t>, size_t>& r) {
+            return l.first.first < r.first.first;
+        });
+
+        std::vector<bool> needed(entries.size(), false);
+        std::vector<size_t> open;
+        size_t next = 0;
+        for (auto version : _collectLive) {
+            if (_versionSizes[version] <= index) {
+                continue;
+            }
+            size_t label = _versions->interval(version).first;
+            for (; next < entries.size() && entries[next].first.first <= label; ++next) {
+                while (!open.empty() && entries[open.back()].first.second < entries[next].first.first) {
+                    open.pop_back();
+                }
+                open.push_back(next);
+            }
+            while (!open.empty() && entries[open.back()].first.second < label) {
+                open.pop_back();
+            }
+            if (!open.empty()) {
+                needed[open.back()] = true;
+            }
+        }
+        std::vector<bool> keep(history.size(), false);
+        bool dropped = false;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            keep[entries[i].second] = needed[i] || history.version(entries[i].second) >= _collectVersions;
+            dropped = dropped || !keep[entries[i].second];
+        }
+        if (dropped) {
+            _fatNodes.find(index)->retain(*_versions, _storage, keep);
+        }
+    }
+
+    void _finishCollection() {
+        // children always have greater numbers than their parents, so leaves go first
+        std::sort(_collectRetired.rbegin(), _collectRetired.rend());
+        for (auto version : _collectRetired) {
+            if (_versions->removeLeaf(version)) {
+                _retired.erase(version);
+            }
+        }
+        const VersionTree& versions = *_versions;
+        _resets.erase(std::remove_if(_resets.begin(), _resets.end(), [&versions](const Reset& reset) {
+            return !versions.contains(reset.version);
+        }), _resets.end());
+        _indexResets();
+        _fatNodes.trim();
+        _collectLive.clear();
+        _collectRetired.clear();
+        _collecting = false;
+    }
 
-    const value_type& _getLatestVersion(const size_t maxVersion, const size_t index) const {
-        auto& elementVersions = _fatNodes[index].nodeVersions;
-        auto pos = elementVersions.end();
-        for (auto it = elementVersions.begin(); it != elementVersions.end(); ++it) {
-            if (_versions.order(it->version, maxVersion)) {
-                pos = it;
+    // Resets of ancestors-or-self of 'version', oldest first
+    std::vector<const Reset*> _ancestorResets(const size_t version) const {
+        std::vector<const Reset*> resets;
+        for (size_t reset = _versionResets[version]; reset != NONE; reset = _resets[reset].previous) {
+            resets.push_back(&_resets[reset]);
+        }
+        std::reverse(resets.begin(), resets.end());
+        return resets;
+    }
+    /* Rebuilds _versionResets and the 'previous' links after resets were removed or moved to other versions:
+     * versions are visited in entry order with their open ancestors on a stack */
+    void _indexResets() {
+        std::vector<std::vector<size_t> > own(_versionSizes.size());
+        for (size_t reset = 0; reset < _resets.size(); ++reset) {
+            own[_resets[reset].version].push_back(reset);
+        }
+        std::vector<size_t> order;
+        for (size_t version = 0; version < _versionSizes.size(); ++version) {
+            _versionResets[version] = NONE;
+            if (_versions->contains(version)) {
+                order.push_back(version);
             }
         }
-        return pos->value;
+        const VersionTree& versions = *_versions;
+        std::sort(order.begin(), order.end(), [&versions](const size_t lv, const size_t rv) {
+            return versions.interval(lv).first < versions.interval(rv).first;
+        });
+        std::vector<size_t> open;
+        for (auto version : order) {
+            while (!open.empty() && versions.interval(open.back()).second < versions.interval(version).first) {
+                open.pop_back();
+            }
+            size_t last = open.empty() ? NONE : _versionResets[open.back()];
+            for (auto reset : own[version]) {
+                _resets[reset].previous = last;
+                _linkReset(reset);
+                last = reset;
+            }
+            _versionResets[version] = last;
+            open.push_back(version);
+        }
+    }
+    std::vector<std::pair<size_t, value_type> > _history(const size_t version, const size_t index,
+                                                         const std::vector<const Reset*>& resets) const {
+        std::vector<std::pair<size_t, value_type> > writes;
+        const FatNode* fatNode = _fatNodes.find(index);
+        if (fatNode && !fatNode->history.empty()) {
+            for (size_t owner = fatNode->find(*_versions, version); owner != NONE;
+                 owner = fatNode->parent(*_versions, owner)) {
+                writes.push_back(std::make_pair(fatNode->history.version(owner),
+                                                fatNode->history.value(owner, _storage)));
+            }
+        }
+        std::reverse(writes.begin(), writes.end());
+        // a reset and a write of the same version only come from squash, which keeps the write if it was later
+        std::vector<std::pair<size_t, value_type> > values;
+        auto write = writes.begin();
+        for (auto reset : resets) {
+            if (reset->from > index) {
+                continue;
+            }
+            for (; write != writes.end() && write->first < reset->version; ++write) {
+                values.push_back(*write);
+            }
+            values.push_back(std::make_pair(reset->version, reset->value));
+        }
+        values.insert(values.end(), write, writes.end());
+        return values;
+    }
+
+    /* Sets the 'lower' link of a reset whose 'previous' is set, and the 'lower' links above it.
+     * Jump pointers follow Myers' skew-binary scheme, so a search up the 'lower' chain takes O(log r) steps. */
+    void _linkReset(const size_t position) {
+        Reset& reset = _resets[position];
+        reset.lower = reset.from > 0 ? _coveringReset(reset.previous, reset.from - 1) : NONE;
+        if (reset.lower == NONE) {
+            reset.depth = 0;
+            reset.jump = position;
+            return;
+        }
+        const Reset& lower = _resets[reset.lower];
+        const Reset& jump = _resets[lower.jump];
+        reset.depth = lower.depth + 1;
+        reset.jump = lower.depth - jump.depth == jump.depth - _resets[jump.jump].depth ? jump.jump : reset.lower;
+    }
+    /* Deepest reset covering 'index' from 'position' up the ancestry, NONE if there is none. The resets
+     * skipped by a 'lower' link start at or after the reset they are skipped from, and 'from' only decreases
+     * up the 'lower' chain, so a jump to a reset still starting after 'index' skips no covering reset. */
+    size_t _coveringReset(size_t position, const size_t index) const {
+        while (position != NONE && _resets[position].from > index) {
+            size_t jump = _resets[position].jump;
+            position = jump != position && _resets[jump].from > index ? jump : _resets[position].lower;
+        }
+        return position;
+    }
+
+    /* The nearest ancestor entry, unless the deepest ancestor reset covering 'index' is below it.
+     * Only the resets of ancestors are looked at, in O(log r) for r of them. */
+    const_reference _getLatestVersion(const size_t maxVersion, const size_t index) const {
+        const FatNode* fatNode = _fatNodes.find(index);
+        size_t owner = fatNode ? fatNode->find(*_versions, maxVersion) : NONE;
+        size_t position = _coveringReset(_versionResets[maxVersion], index);
+        return _visible(fatNode, owner, position != NONE ? &_resets[position] : nullptr);
+    }
+    // Value of an index given its nearest ancestor entry 'owner' and the deepest ancestor reset covering it
+    const_reference _visible(const FatNode* fatNode, const size_t owner, const Reset* reset) const {
+        if (reset) {
+            if (owner == NONE) {
+                return reset->value;
+            }
+            size_t entryVersion = fatNode->history.version(owner);
+            if (entryVersion != reset->version && _versions->order(entryVersion, reset->version)) {
+                return reset->value;
+            }
+        }
+        if (owner == NONE) {
+            return _defaultValue;
+        }
+        return fatNode->history.value(owner, _storage);
     }
 };
 
+// NONE is passed by reference to the containers holding it
+template <class T, class Storage>
+const size_t PersistentVector<T, Storage>::NONE;
+
 #endif // PERSISTENT_LIST_HPP
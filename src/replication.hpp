@@ -0,0 +1,535 @@
+#ifndef REPLICATION_HPP
+#define REPLICATION_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+#include "persistent_list.hpp"
+#include "persistent_map.hpp"
+#include "persistent_vector.hpp"
+
+/* Byte encoding of replicated keys and values: trivially copyable types are shipped as their bytes,
+ * strings with their length. Specialize it for other types. */
+template <class T>
+struct ReplicationCodec {
+    static_assert(std::is_trivially_copyable<T>::value, "Specialize ReplicationCodec for this type");
+
+    static void write(std::string& out, const T& value) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+    static T read(const char*& in) {
+        T value;
+        std::memcpy(&value, in, sizeof(T));
+        in += sizeof(T);
+        return value;
+    }
+};
+
+/* Wire format shared by ReplicationLog and ReplicaApplier. The stream is a sequence of batches, each
+ * a BatchHeader followed by its records; a record is the operation, the container number, the source
+ * version and the arguments, numbers as base-128 varints. */
+class ReplicationFormat {
+protected:
+    enum Operation : uint8_t {
+        INSERT_KEY, ERASE_KEY, PUSH_BACK, POP_BACK, PUSH_FRONT, POP_FRONT, UPDATE, INSERT_AT, ERASE_AT, RESIZE
+    };
+
+    struct BatchHeader {
+        uint32_t bytes;
+        uint32_t records;
+        // records logged up to the end of the batch
+        uint64_t sequence;
+        // steady clock of the primary when the batch was sent; processes of one host share it
+        int64_t sentNanos;
+    };
+
+    static void _writeNumber(std::string& out, uint64_t number) {
+        while (number >= 0x80) {
+            out.push_back(static_cast<char>(number | 0x80));
+            number >>= 7;
+        }
+        out.push_back(static_cast<char>(number));
+    }
+    static uint64_t _readNumber(const char*& in) {
+        uint64_t number = 0;
+        for (unsigned int shift = 0; ; shift += 7) {
+            uint8_t byte = static_cast<uint8_t>(*in++);
+            number |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (byte < 0x80) {
+                return number;
+            }
+        }
+    }
+    // Writes at a position, the containers take iterators
+    template <class T, class Storage>
+    static void _insertAt(PersistentVector<T, Storage>& vector, const size_t srcVersion, const size_t index,
+                          const T& value) {
+        if (index >= vector.size(srcVersion)) {
+            vector.push_back(srcVersion, value);
+        } else {
+            vector.insert(srcVersion, typename PersistentVector<T, Storage>::iterator(vector, srcVersion, index), value);
+        }
+    }
+    template <class T, class Storage>
+    static void _eraseAt(PersistentVector<T, Storage>& vector, const size_t srcVersion, const size_t index) {
+        if (index >= vector.size(srcVersion)) {
+            throw new std::out_of_range("Index out of range: " + std::to_string(index));
+        }
+        vector.erase(srcVersion, typename PersistentVector<T, Storage>::iterator(vector, srcVersion, index));
+    }
+    template <class T, class Allocator>
+    static void _insertAt(PersistentList<T, Allocator>& list, const size_t srcVersion, const size_t index,
+                          const T& value) {
+        if (index >= list.size(srcVersion)) {
+            list.push_back(srcVersion, value);
+            return;
+        }
+        auto pos = list.begin(srcVersion);
+        for (size_t i = 0; i < index; ++i) {
+            ++pos;
+        }
+        list.insert(srcVersion, pos, value);
+    }
+    template <class T, class Allocator>
+    static void _eraseAt(PersistentList<T, Allocator>& list, const size_t srcVersion, const size_t index) {
+        if (index >= list.size(srcVersion)) {
+            throw new std::out_of_range("Index out of range: " + std::to_string(index));
+        }
+        auto pos = list.begin(srcVersion);
+        for (size_t i = 0; i < index; ++i) {
+            ++pos;
+        }
+        list.erase(srcVersion, pos);
+    }
+    static int64_t _now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+};
+
+template <>
+struct ReplicationCodec<std::string> : private ReplicationFormat {
+    static void write(std::string& out, const std::string& value) {
+        _writeNumber(out, value.size());
+        out.append(value);
+    }
+    static std::string read(const char*& in) {
+        size_t size = _readNumber(in);
+        std::string value(in, size);
+        in += size;
+        return value;
+    }
+};
+
+/* Primary side of log shipping: applies every version-creating operation to the local container and
+ * logs it for the replica. Records are collected into batches of about 'batchBytes' and written to
+ * 'fd', a pipe or a socket, by flush() or once a batch is full. Containers are attached in the same
+ * order on both sides and must have the same versions when attached.
+ * Only the writes made through the log are replicated. Versions an attached container gets any other
+ * way (its own writers including the moving and emplacing ones, Batch::publish, parallel_build, merge3,
+ * squash, or a Workspace transaction) have no record, so the next logged write of any attached
+ * container throws std::out_of_range instead of shipping records the replica would apply to other
+ * versions. Workspace members are attached together, a logged write to one adds the version to all. */
+class ReplicationLog : private ReplicationFormat {
+public:
+    static const size_t DEFAULT_BATCH_BYTES = 64 * 1024;
+
+    explicit ReplicationLog(const int fd, const size_t batchBytes = DEFAULT_BATCH_BYTES) :
+        _fd(fd), _batchBytes(batchBytes), _batchRecords(0), _sequence(0), _sentSequence(0)
+    {}
+    ReplicationLog(const ReplicationLog& other) = delete;
+    ReplicationLog& operator=(const ReplicationLog& other) = delete;
+
+    template <class Container>
+    void attach(const Container& container) {
+        Attached attached;
+        attached.id = _attached.size();
+        attached.versionsNumber = [&container]() { return container.versionsNumber(); };
+        attached.versions = container.versionsNumber();
+        _attached[&container] = attached;
+    }
+
+    // Records logged so far and records written to the stream
+    inline uint64_t sequence() const {
+        return _sequence;
+    }
+    inline uint64_t sentSequence() const {
+        return _sentSequence;
+    }
+
+    // Sends the records of the unfinished batch
+    void flush() {
+        if (_batchRecords == 0) {
+            return;
+        }
+        BatchHeader header;
+        header.bytes = _batch.size();
+        header.records = _batchRecords;
+        header.sequence = _sequence;
+        header.sentNanos = _now();
+        _writeAll(&header, sizeof(header));
+        _writeAll(_batch.data(), _batch.size());
+        _batch.clear();
+        _batchRecords = 0;
+        _sentSequence = _sequence;
+    }
+
+    template <class Key, class Value, class Comparator, class Allocator>
+    void insert(PersistentMap<Key, Value, Comparator, Allocator>& map, const size_t srcVersion,
+                const typename PersistentMap<Key, Value, Comparator, Allocator>::value_type& pair) {
+        _check(&map);
+        map.insert(srcVersion, pair);
+        _begin(INSERT_KEY, &map, srcVersion);
+        ReplicationCodec<Key>::write(_batch, pair.first);
+        ReplicationCodec<Value>::write(_batch, pair.second);
+        _end();
+    }
+    template <class Key, class Value, class Comparator, class Allocator>
+    void erase(PersistentMap<Key, Value, Comparator, Allocator>& map, const size_t srcVersion,
+               const typename PersistentMap<Key, Value, Comparator, Allocator>::key_type& key) {
+        _check(&map);
+        map.erase(srcVersion, key);
+        _begin(ERASE_KEY, &map, srcVersion);
+        ReplicationCodec<Key>::write(_batch, key);
+        _end();
+    }
+
+    template <class T, class Storage>
+    void push_back(PersistentVector<T, Storage>& vector, const size_t srcVersion,
+                   const typename PersistentVector<T, Storage>::value_type& value) {
+        _check(&vector);
+        vector.push_back(srcVersion, value);
+        _begin(PUSH_BACK, &vector, srcVersion);
+        ReplicationCodec<T>::write(_batch, value);
+        _end();
+    }
+    template <class T, class Storage>
+    void pop_back(PersistentVector<T, Storage>& vector, const size_t srcVersion) {
+        _check(&vector);
+        vector.pop_back(srcVersion);
+        _begin(POP_BACK, &vector, srcVersion);
+        _end();
+    }
+    template <class T, class Storage>
+    void update(PersistentVector<T, Storage>& vector, const size_t srcVersion, const size_t index,
+                const typename PersistentVector<T, Storage>::value_type& value) {
+        _check(&vector);
+        vector.update(srcVersion, index, value);
+        _begin(UPDATE, &vector, srcVersion);
+        _writeNumber(_batch, index);
+        ReplicationCodec<T>::write(_batch, value);
+        _end();
+    }
+    template <class T, class Storage>
+    void insert(PersistentVector<T, Storage>& vector, const size_t srcVersion, const size_t index,
+                const typename PersistentVector<T, Storage>::value_type& value) {
+        _check(&vector);
+        _insertAt(vector, srcVersion, index, value);
+        _begin(INSERT_AT, &vector, srcVersion);
+        _writeNumber(_batch, index);
+        ReplicationCodec<T>::write(_batch, value);
+        _end();
+    }
+    template <class T, class Storage>
+    void erase(PersistentVector<T, Storage>& vector, const size_t srcVersion, const size_t index) {
+        _check(&vector);
+        _eraseAt(vector, srcVersion, index);
+        _begin(ERASE_AT, &vector, srcVersion);
+        _writeNumber(_batch, index);
+        _end();
+    }
+    template <class T, class Storage>
+    void resize(PersistentVector<T, Storage>& vector, const size_t srcVersion, const size_t size,
+                const typename PersistentVector<T, Storage>::value_type& value = T()) {
+        _check(&vector);
+        vector.resize(srcVersion, size, value);
+        _begin(RESIZE, &vector, srcVersion);
+        _writeNumber(_batch, size);
+        ReplicationCodec<T>::write(_batch, value);
+        _end();
+    }
+
+    template <class T, class Allocator>
+    void push_back(PersistentList<T, Allocator>& list, const size_t srcVersion,
+                   const typename PersistentList<T, Allocator>::value_type& value) {
+        _check(&list);
+        list.push_back(srcVersion, value);
+        _begin(PUSH_BACK, &list, srcVersion);
+        ReplicationCodec<T>::write(_batch, value);
+        _end();
+    }
+    template <class T, class Allocator>
+    void push_front(PersistentList<T, Allocator>& list, const size_t srcVersion,
+                    const typename PersistentList<T, Allocator>::value_type& value) {
+        _check(&list);
+        list.push_front(srcVersion, value);
+        _begin(PUSH_FRONT, &list, srcVersion);
+        ReplicationCodec<T>::write(_batch, value);
+        _end();
+    }
+    template <class T, class Allocator>
+    void pop_back(PersistentList<T, Allocator>& list, const size_t srcVersion) {
+        _check(&list);
+        list.pop_back(srcVersion);
+        _begin(POP_BACK, &list, srcVersion);
+        _end();
+    }
+    template <class T, class Allocator>
+    void pop_front(PersistentList<T, Allocator>& list, const size_t srcVersion) {
+        _check(&list);
+        list.pop_front(srcVersion);
+        _begin(POP_FRONT, &list, srcVersion);
+        _end();
+    }
+    template <class T, class Allocator>
+    void insert(PersistentList<T, Allocator>& list, const size_t srcVersion, const size_t index,
+                const typename PersistentList<T, Allocator>::value_type& value) {
+        _check(&list);
+        _insertAt(list, srcVersion, index, value);
+        _begin(INSERT_AT, &list, srcVersion);
+        _writeNumber(_batch, index);
+        ReplicationCodec<T>::write(_batch, value);
+        _end();
+    }
+    template <class T, class Allocator>
+    void erase(PersistentList<T, Allocator>& list, const size_t srcVersion, const size_t index) {
+        _check(&list);
+        _eraseAt(list, srcVersion, index);
+        _begin(ERASE_AT, &list, srcVersion);
+        _writeNumber(_batch, index);
+        _end();
+    }
+
+private:
+    int _fd;
+    size_t _batchBytes;
+    std::string _batch;
+    uint32_t _batchRecords;
+    uint64_t _sequence;
+    uint64_t _sentSequence;
+    struct Attached {
+        size_t id;
+        std::function<size_t()> versionsNumber;
+        // versions the container had after the last logged write
+        size_t versions;
+    };
+    std::unordered_map<const void*, Attached> _attached;
+
+    // Called before the local write: the container is attached and no attached container got unlogged versions
+    void _check(const void* container) const {
+        if (!_attached.count(container)) {
+            throw new std::out_of_range("Container is not attached to the replication log");
+        }
+        for (auto& attached : _attached) {
+            if (attached.second.versionsNumber() != attached.second.versions) {
+                throw new std::out_of_range("Attached container " + std::to_string(attached.second.id)
+                                            + " has versions the replication log did not record");
+            }
+        }
+    }
+    void _begin(const Operation operation, const void* container, const size_t srcVersion) {
+        _batch.push_back(static_cast<char>(operation));
+        _writeNumber(_batch, _attached.at(container).id);
+        _writeNumber(_batch, srcVersion);
+    }
+    void _end() {
+        // workspace members of the written container got the version as well
+        for (auto& attached : _attached) {
+            attached.second.versions = attached.second.versionsNumber();
+        }
+        ++_sequence;
+        ++_batchRecords;
+        if (_batch.size() >= _batchBytes) {
+            flush();
+        }
+    }
+    void _writeAll(const void* data, size_t size) {
+        const char* bytes = static_cast<const char*>(data);
+        while (size > 0) {
+            ssize_t written = write(_fd, bytes, size);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                throw new std::runtime_error("Cannot write the replication stream");
+            }
+            bytes += written;
+            size -= written;
+        }
+    }
+};
+
+/* Replica side of log shipping: reads whole batches from 'fd' and replays their records on the
+ * attached containers, which thereby get the same version numbers as on the primary. */
+class ReplicaApplier : private ReplicationFormat {
+public:
+    explicit ReplicaApplier(const int fd) : _fd(fd), _sequence(0), _batches(0), _lastLag(0), _maxLag(0)
+    {}
+    ReplicaApplier(const ReplicaApplier& other) = delete;
+    ReplicaApplier& operator=(const ReplicaApplier& other) = delete;
+
+    template <class Key, class Value, class Comparator, class Allocator>
+    void attach(PersistentMap<Key, Value, Comparator, Allocator>& map) {
+        _appliers.push_back([&map](const Operation operation, const size_t version, const char*& in) {
+            Key key = ReplicationCodec<Key>::read(in);
+            if (operation == INSERT_KEY) {
+                Value value = ReplicationCodec<Value>::read(in);
+                map.insert(version, std::make_pair(key, value));
+            } else if (operation == ERASE_KEY) {
+                map.erase(version, key);
+            } else {
+                _unknown();
+            }
+        });
+    }
+    template <class T, class Storage>
+    void attach(PersistentVector<T, Storage>& vector) {
+        _appliers.push_back([&vector](const Operation operation, const size_t version, const char*& in) {
+            switch (operation) {
+            case PUSH_BACK:
+                vector.push_back(version, ReplicationCodec<T>::read(in));
+                break;
+            case POP_BACK:
+                vector.pop_back(version);
+                break;
+            case UPDATE: {
+                size_t index = _readNumber(in);
+                vector.update(version, index, ReplicationCodec<T>::read(in));
+                break;
+            }
+            case INSERT_AT: {
+                size_t index = _readNumber(in);
+                _insertAt(vector, version, index, ReplicationCodec<T>::read(in));
+                break;
+            }
+            case ERASE_AT:
+                _eraseAt(vector, version, _readNumber(in));
+                break;
+            case RESIZE: {
+                size_t size = _readNumber(in);
+                vector.resize(version, size, ReplicationCodec<T>::read(in));
+                break;
+            }
+            default:
+                _unknown();
+            }
+        });
+    }
+    template <class T, class Allocator>
+    void attach(PersistentList<T, Allocator>& list) {
+        _appliers.push_back([&list](const Operation operation, const size_t version, const char*& in) {
+            switch (operation) {
+            case PUSH_BACK:
+                list.push_back(version, ReplicationCodec<T>::read(in));
+                break;
+            case PUSH_FRONT:
+                list.push_front(version, ReplicationCodec<T>::read(in));
+                break;
+            case POP_BACK:
+                list.pop_back(version);
+                break;
+            case POP_FRONT:
+                list.pop_front(version);
+                break;
+            case INSERT_AT: {
+                size_t index = _readNumber(in);
+                _insertAt(list, version, index, ReplicationCodec<T>::read(in));
+                break;
+            }
+            case ERASE_AT:
+                _eraseAt(list, version, _readNumber(in));
+                break;
+            default:
+                _unknown();
+            }
+        });
+    }
+
+    /* Waits for the next batch and applies it. Returns false once the primary has closed the stream */
+    bool apply() {
+        BatchHeader header;
+        if (!_readAll(&header, sizeof(header), true)) {
+            return false;
+        }
+        _batch.resize(header.bytes);
+        _readAll(&_batch[0], header.bytes, false);
+        const char* in = _batch.data();
+        for (uint32_t i = 0; i < header.records; ++i) {
+            Operation operation = static_cast<Operation>(*in++);
+            size_t id = _readNumber(in);
+            size_t version = _readNumber(in);
+            if (id >= _appliers.size()) {
+                throw new std::out_of_range("Record for a container that is not attached");
+            }
+            _appliers[id](operation, version, in);
+        }
+        _sequence = header.sequence;
+        ++_batches;
+        _lastLag = _now() - header.sentNanos;
+        _maxLag = std::max(_maxLag, _lastLag);
+        return true;
+    }
+
+    // Records applied so far; the primary's sequence() minus this is the lag in records
+    inline uint64_t sequence() const {
+        return _sequence;
+    }
+    inline uint64_t batches() const {
+        return _batches;
+    }
+    // Nanoseconds from sending the last applied batch to having applied it, and the worst such lag
+    inline int64_t lastLag() const {
+        return _lastLag;
+    }
+    inline int64_t maxLag() const {
+        return _maxLag;
+    }
+
+private:
+    typedef std::function<void(const Operation, const size_t, const char*&)> Applier;
+
+    int _fd;
+    std::vector<Applier> _appliers;
+    std::string _batch;
+    uint64_t _sequence;
+    uint64_t _batches;
+    int64_t _lastLag;
+    int64_t _maxLag;
+
+    static void _unknown() {
+        throw new std::out_of_range("Unknown replicated operation");
+    }
+    // Returns false on the end of the stream before the first byte if 'atBoundary'
+    bool _readAll(void* data, size_t size, const bool atBoundary) {
+        char* bytes = static_cast<char*>(data);
+        bool started = false;
+        while (size > 0) {
+            ssize_t received = read(_fd, bytes, size);
+            if (received < 0 && errno == EINTR) {
+                continue;
+            }
+            if (received == 0 && atBoundary && !started) {
+                return false;
+            }
+            if (received <= 0) {
+                throw new std::runtime_error("Replication stream ended inside a batch");
+            }
+            started = true;
+            bytes += received;
+            size -= received;
+        }
+        return true;
+    }
+};
+
+#endif // REPLICATION_HPP
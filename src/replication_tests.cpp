@@ -0,0 +1,106 @@
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include "replication.hpp"
+#include "tests.hpp"
+
+TEST_F(ReplicationTest, ApplyTest) {
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+
+    PersistentMap<int, std::string> replicaMap;
+    PersistentVector<int> replicaVector;
+    PersistentList<std::string> replicaList;
+    ReplicaApplier replica(fds[0]);
+    replica.attach(replicaMap);
+    replica.attach(replicaVector);
+    replica.attach(replicaList);
+    std::thread applier([&replica]() {
+        while (replica.apply())
+        {}
+    });
+
+    PersistentMap<int, std::string> map;
+    PersistentVector<int> vector;
+    PersistentList<std::string> list;
+    ReplicationLog log(fds[1], 256);
+    log.attach(map);
+    log.attach(vector);
+    log.attach(list);
+    for (int i = 0; i < 200; ++i) {
+        log.insert(map, i, std::make_pair(i, std::string(i % 13, 'x')));
+        log.push_back(vector, i, i);
+        log.push_front(list, i, std::to_string(i));
+    }
+    log.erase(map, 100, 50);
+    log.update(vector, 150, 3, -3);
+    log.insert(vector, 10, 5, 55);
+    log.erase(vector, 200, 0);
+    log.resize(vector, 30, 100, 7);
+    log.insert(list, 200, 1, std::string("inserted"));
+    log.erase(list, 201, 0);
+    log.pop_back(list, 202);
+    log.flush();
+    close(fds[1]);
+    applier.join();
+    close(fds[0]);
+
+    ASSERT_EQ(log.sequence(), replica.sequence());
+    ASSERT_EQ(608, replica.sequence());
+    ASSERT_GT(replica.batches(), 1);
+    ASSERT_GE(replica.maxLag(), replica.lastLag());
+
+    ASSERT_EQ(map.versionsNumber(), replicaMap.versionsNumber());
+    ASSERT_EQ(vector.versionsNumber(), replicaVector.versionsNumber());
+    ASSERT_EQ(list.versionsNumber(), replicaList.versionsNumber());
+    for (size_t version = 0; version < map.versionsNumber(); ++version) {
+        ASSERT_EQ(map.size(version), replicaMap.size(version));
+        for (auto it = map.begin(version), other = replicaMap.begin(version); it != map.end(); ++it, ++other) {
+            ASSERT_EQ(it->first, other->first);
+            ASSERT_EQ(it->second, other->second);
+        }
+    }
+    for (size_t version = 0; version < vector.versionsNumber(); ++version) {
+        ASSERT_EQ(vector.size(version), replicaVector.size(version));
+        for (size_t i = 0; i < vector.size(version); ++i) {
+            ASSERT_EQ(vector.at(version, i), replicaVector.at(version, i));
+        }
+    }
+    for (size_t version = 0; version < list.versionsNumber(); ++version) {
+        ASSERT_EQ(list.size(version), replicaList.size(version));
+        for (auto it = list.begin(version), other = replicaList.begin(version); it != list.end(); ++it, ++other) {
+            ASSERT_EQ(*it, *other);
+        }
+    }
+    ASSERT_EQ("inserted", *replicaList.begin(203));
+}
+
+TEST_F(ReplicationTest, UnloggedWriteTest) {
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    PersistentMap<int, int> map;
+    PersistentVector<int> vector;
+    PersistentVector<int> detached;
+    ReplicationLog log(fds[1]);
+    log.attach(map);
+    log.attach(vector);
+
+    // checked before the local write, so nothing changes
+    ASSERT_THROW(log.push_back(detached, 0, 1), std::out_of_range*);
+    ASSERT_EQ(1, detached.versionsNumber());
+
+    log.insert(map, 0, std::make_pair(1, 1));
+    log.push_back(vector, 0, 1);
+    ASSERT_EQ(2, log.sequence());
+    // a version made past the log is found by the next logged write of any attached container
+    auto batch = vector.batch(1);
+    batch.push_back(2);
+    batch.publish();
+    ASSERT_THROW(log.insert(map, 1, std::make_pair(2, 2)), std::out_of_range*);
+    ASSERT_EQ(2, map.versionsNumber());
+    ASSERT_THROW(log.update(vector, 1, 0, 5), std::out_of_range*);
+    ASSERT_EQ(3, vector.versionsNumber());
+    ASSERT_EQ(2, log.sequence());
+    close(fds[0]);
+    close(fds[1]);
+}
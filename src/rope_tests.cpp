@@ -0,0 +1,65 @@
+#include <random>
+#include <string>
+#include <vector>
+#include "tests.hpp"
+#include "persistent_rope.hpp"
+
+TEST_F(PersistentRopeTest, EditTest) {
+    std::mt19937 random(7);
+    PersistentRope rope;
+    std::vector<std::string> expected(1);
+    for (int i = 0; i < 2000; ++i) {
+        size_t version = random() % rope.versionsNumber();
+        const std::string& text = expected[version];
+        size_t pos = random() % (text.size() + 1);
+        if (random() % 3 || text.size() < 100) {
+            std::string inserted(random() % 600 + 1, 'a' + i % 26);
+            rope.insert(version, pos, inserted);
+            expected.push_back(std::string(text).insert(pos, inserted));
+        } else {
+            size_t count = random() % 300;
+            rope.erase(version, pos, count);
+            expected.push_back(std::string(text).erase(pos, count));
+        }
+    }
+    for (size_t version = 0; version < expected.size(); ++version) {
+        ASSERT_EQ(expected[version], rope.str(version));
+    }
+    size_t last = rope.versionsNumber() - 1;
+    for (size_t pos = 0; pos < rope.size(last); pos += 97) {
+        ASSERT_EQ(expected[last][pos], rope.at(last, pos));
+        ASSERT_EQ(expected[last].substr(pos, 500), rope.substr(last, pos, 500));
+    }
+
+    rope.split(last, 1000);
+    rope.concat(last + 2, last + 1);
+    ASSERT_EQ(expected[last].substr(0, 1000), rope.str(last + 1));
+    ASSERT_EQ(expected[last].substr(1000), rope.str(last + 2));
+    ASSERT_EQ(expected[last].substr(1000) + expected[last].substr(0, 1000), rope.str(last + 3));
+}
+
+TEST_F(PersistentRopeTest, LinesTest) {
+    std::string text;
+    for (int line = 0; line < 300; ++line) {
+        text += std::string(line % 17, 'x') + "\n";
+    }
+    PersistentRope rope(text);
+    rope.insert(0, 5, "ab\ncd");
+    text.insert(5, "ab\ncd");
+
+    ASSERT_EQ(302, rope.lines(1));
+    ASSERT_EQ(301, rope.lines(0));
+    size_t lineStart = 0;
+    for (size_t line = 0; line < rope.lines(1); ++line) {
+        ASSERT_EQ(lineStart, rope.position(1, line, 0));
+        ASSERT_EQ(std::make_pair(line, (size_t)0), rope.lineColumn(1, lineStart));
+        size_t lineEnd = text.find('\n', lineStart);
+        if (lineEnd == std::string::npos) {
+            break;
+        }
+        ASSERT_EQ(std::make_pair(line, lineEnd - lineStart), rope.lineColumn(1, lineEnd));
+        lineStart = lineEnd + 1;
+    }
+    ASSERT_EQ(std::make_pair((size_t)2, (size_t)2), rope.lineColumn(1, 5));
+    ASSERT_THROW(rope.position(1, 302, 0), std::out_of_range*);
+}
@@ -1,5 +1,7 @@
 #include "tests.hpp"
 
+size_t CopyCounter::copies = 0;
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
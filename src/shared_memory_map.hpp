@@ -0,0 +1,330 @@
+#ifndef SHARED_MEMORY_MAP_HPP
+#define SHARED_MEMORY_MAP_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Persistent map living in a named POSIX shared memory segment, so that processes on one host share
+ * every version without copies or messages. Nodes refer to each other by offsets from the start of the
+ * segment, which every process maps at its own address. One process creates the segment and writes;
+ * it appends path-copied AVL nodes and publishes each new version in the version table only after its
+ * nodes are written. Any number of processes open the segment read-only and query any published
+ * version. Nodes are never freed: the segment holds the whole history and the writer throws once it
+ * is full. Keys and values are copied byte by byte and must be trivially copyable. */
+template <class Key, class Value, class Comparator = std::less<Key> >
+class SharedMemoryMap {
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "SharedMemoryMap needs trivially copyable keys and values");
+
+private:
+    // 0 is the header, never a node
+    typedef uint64_t Offset;
+
+    struct Node {
+        Offset left;
+        Offset right;
+        uint64_t height;
+        Key key;
+        Value value;
+    };
+    struct VersionEntry {
+        Offset root;
+        uint64_t size;
+    };
+    struct Header {
+        uint64_t magic;
+        uint64_t nodeSize;
+        uint64_t capacity;
+        uint64_t maxVersions;
+        uint64_t used;
+        std::atomic<uint64_t> versionsNumber;
+    };
+
+    static const uint64_t MAGIC = 0x70647373686d6170;
+
+public:
+    // Creates the segment 'name' of 'capacity' bytes with room for 'maxVersions' versions and opens it
+    // for writing. Version 0 is the empty map
+    SharedMemoryMap(const std::string& name, const size_t capacity, const size_t maxVersions) : _writable(true) {
+        size_t nodesOffset = _nodesOffset(maxVersions);
+        if (capacity < nodesOffset + sizeof(Node)) {
+            throw new std::out_of_range("Shared memory segment is too small");
+        }
+        int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0) {
+            throw new std::runtime_error("Cannot create shared memory segment " + name);
+        }
+        if (ftruncate(fd, capacity) != 0) {
+            close(fd);
+            shm_unlink(name.c_str());
+            throw new std::runtime_error("Cannot resize shared memory segment " + name);
+        }
+        _map(fd, capacity, PROT_READ | PROT_WRITE);
+
+        Header* header = new (_base) Header();
+        header->magic = MAGIC;
+        header->nodeSize = sizeof(Node);
+        header->capacity = capacity;
+        header->maxVersions = maxVersions;
+        header->used = nodesOffset;
+        _versions()[0].root = 0;
+        _versions()[0].size = 0;
+        header->versionsNumber.store(1, std::memory_order_release);
+    }
+    // Opens the existing segment 'name' read-only
+    explicit SharedMemoryMap(const std::string& name) : _writable(false) {
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0) {
+            throw new std::runtime_error("Cannot open shared memory segment " + name);
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(Header)) {
+            close(fd);
+            throw new std::runtime_error("Invalid shared memory segment " + name);
+        }
+        _map(fd, info.st_size, PROT_READ);
+        if (_header()->magic != MAGIC || _header()->nodeSize != sizeof(Node)) {
+            munmap(_base, _length);
+            throw new std::runtime_error("Shared memory segment " + name + " holds another kind of map");
+        }
+    }
+    SharedMemoryMap(SharedMemoryMap&& other) : _base(other._base), _length(other._length), _writable(other._writable) {
+        other._base = nullptr;
+    }
+    SharedMemoryMap(const SharedMemoryMap& other) = delete;
+    SharedMemoryMap& operator=(const SharedMemoryMap& other) = delete;
+    ~SharedMemoryMap() {
+        if (_base) {
+            munmap(_base, _length);
+        }
+    }
+
+    // The segment lives on until it is removed and unmapped by every process
+    static void remove(const std::string& name) {
+        shm_unlink(name.c_str());
+    }
+
+    // Number of published versions
+    inline size_t versionsNumber() const {
+        return _header()->versionsNumber.load(std::memory_order_acquire);
+    }
+    inline size_t size(const size_t version) const {
+        return _version(version).size;
+    }
+    inline bool empty(const size_t version) const {
+        return size(version) == 0;
+    }
+    // Bytes of the segment taken so far
+    inline size_t used() const {
+        return _header()->used;
+    }
+
+    const Value& at(const size_t version, const Key& key) const {
+        const Node* node = _find(_version(version).root, key);
+        if (!node) {
+            throw new std::out_of_range("Key not found");
+        }
+        return node->value;
+    }
+    inline size_t count(const size_t version, const Key& key) const {
+        return _find(_version(version).root, key) ? 1 : 0;
+    }
+    // Calls visit(key, value) on every pair of 'version' in key order
+    template <class Visitor>
+    void visit(const size_t version, Visitor visit) const {
+        _visit(_version(version).root, visit);
+    }
+
+    // New version with 'key' added to 'srcVersion', a present key keeps its value. Returns whether it was added
+    bool insert(const size_t srcVersion, const Key& key, const Value& value) {
+        const VersionEntry& src = _writableVersion(srcVersion);
+        bool added = false;
+        Offset root = _insert(src.root, key, value, added);
+        _publish(root, added ? src.size + 1 : src.size);
+        return added;
+    }
+    void erase(const size_t srcVersion, const Key& key) {
+        const VersionEntry& src = _writableVersion(srcVersion);
+        bool erased = false;
+        Offset root = _erase(src.root, key, erased);
+        _publish(root, erased ? src.size - 1 : src.size);
+    }
+
+private:
+    char* _base;
+    size_t _length;
+    bool _writable;
+
+    static size_t _nodesOffset(const size_t maxVersions) {
+        size_t versionsOffset = (sizeof(Header) + 63) / 64 * 64;
+        size_t end = versionsOffset + maxVersions * sizeof(VersionEntry);
+        return (end + alignof(Node) - 1) / alignof(Node) * alignof(Node);
+    }
+    void _map(const int fd, const size_t length, const int protection) {
+        void* base = mmap(nullptr, length, protection, MAP_SHARED, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED) {
+            throw new std::runtime_error("Cannot map shared memory segment");
+        }
+        _base = static_cast<char*>(base);
+        _length = length;
+    }
+
+    inline Header* _header() const {
+        return reinterpret_cast<Header*>(_base);
+    }
+    inline VersionEntry* _versions() const {
+        return reinterpret_cast<VersionEntry*>(_base + (sizeof(Header) + 63) / 64 * 64);
+    }
+    inline const Node* _node(const Offset offset) const {
+        return offset ? reinterpret_cast<const Node*>(_base + offset) : nullptr;
+    }
+    inline uint64_t _height(const Offset offset) const {
+        return offset ? _node(offset)->height : 0;
+    }
+
+    const VersionEntry& _version(const size_t version) const {
+        if (version >= versionsNumber()) {
+            throw new std::out_of_range("Invalid version: " + std::to_string(version));
+        }
+        return _versions()[version];
+    }
+    const VersionEntry& _writableVersion(const size_t version) const {
+        if (!_writable) {
+            throw new std::out_of_range("Shared memory map is opened read-only");
+        }
+        if (versionsNumber() == _header()->maxVersions) {
+            throw new std::out_of_range("Shared memory version table is full");
+        }
+        return _version(version);
+    }
+    // The version's nodes are complete before the release store makes it visible to readers
+    void _publish(const Offset root, const size_t size) {
+        size_t number = _header()->versionsNumber.load(std::memory_order_relaxed);
+        _versions()[number].root = root;
+        _versions()[number].size = size;
+        _header()->versionsNumber.store(number + 1, std::memory_order_release);
+    }
+
+    Offset _makeNode(const Offset left, const Key& key, const Value& value, const Offset right) {
+        Header* header = _header();
+        if (header->used + sizeof(Node) > header->capacity) {
+            throw new std::out_of_range("Shared memory segment is full");
+        }
+        Offset offset = header->used;
+        header->used += (sizeof(Node) + alignof(Node) - 1) / alignof(Node) * alignof(Node);
+        Node* node = reinterpret_cast<Node*>(_base + offset);
+        node->left = left;
+        node->right = right;
+        uint64_t hl = _height(left);
+        uint64_t hr = _height(right);
+        node->height = (hl > hr ? hl : hr) + 1;
+        node->key = key;
+        node->value = value;
+        return offset;
+    }
+    // New node over 'left', the pair and 'right', rotated when the heights differ by two
+    Offset _balance(const Offset left, const Key& key, const Value& value, const Offset right) {
+        if (_height(left) > _height(right) + 1) {
+            const Node* l = _node(left);
+            if (_height(l->left) >= _height(l->right)) {
+                return _makeNode(l->left, l->key, l->value, _makeNode(l->right, key, value, right));
+            }
+            const Node* lr = _node(l->right);
+            return _makeNode(_makeNode(l->left, l->key, l->value, lr->left), lr->key, lr->value,
+                             _makeNode(lr->right, key, value, right));
+        }
+        if (_height(right) > _height(left) + 1) {
+            const Node* r = _node(right);
+            if (_height(r->right) >= _height(r->left)) {
+                return _makeNode(_makeNode(left, key, value, r->left), r->key, r->value, r->right);
+            }
+            const Node* rl = _node(r->left);
+            return _makeNode(_makeNode(left, key, value, rl->left), rl->key, rl->value,
+                             _makeNode(rl->right, r->key, r->value, r->right));
+        }
+        return _makeNode(left, key, value, right);
+    }
+
+    const Node* _find(Offset offset, const Key& key) const {
+        while (offset) {
+            const Node* node = _node(offset);
+            if (_comparator(key, node->key)) {
+                offset = node->left;
+            } else if (_comparator(node->key, key)) {
+                offset = node->right;
+            } else {
+                return node;
+            }
+        }
+        return nullptr;
+    }
+    template <class Visitor>
+    void _visit(const Offset offset, Visitor& visit) const {
+        if (offset) {
+            const Node* node = _node(offset);
+            _visit(node->left, visit);
+            visit(node->key, node->value);
+            _visit(node->right, visit);
+        }
+    }
+    Offset _insert(const Offset offset, const Key& key, const Value& value, bool& added) {
+        if (!offset) {
+            added = true;
+            return _makeNode(0, key, value, 0);
+        }
+        const Node* node = _node(offset);
+        if (_comparator(key, node->key)) {
+            Offset left = _insert(node->left, key, value, added);
+            return added ? _balance(left, node->key, node->value, node->right) : offset;
+        }
+        if (_comparator(node->key, key)) {
+            Offset right = _insert(node->right, key, value, added);
+            return added ? _balance(node->left, node->key, node->value, right) : offset;
+        }
+        return offset;
+    }
+    Offset _removeMin(const Offset offset) {
+        const Node* node = _node(offset);
+        if (!node->left) {
+            return node->right;
+        }
+        return _balance(_removeMin(node->left), node->key, node->value, node->right);
+    }
+    Offset _erase(const Offset offset, const Key& key, bool& erased) {
+        if (!offset) {
+            return 0;
+        }
+        const Node* node = _node(offset);
+        if (_comparator(key, node->key)) {
+            Offset left = _erase(node->left, key, erased);
+            return erased ? _balance(left, node->key, node->value, node->right) : offset;
+        }
+        if (_comparator(node->key, key)) {
+            Offset right = _erase(node->right, key, erased);
+            return erased ? _balance(node->left, node->key, node->value, right) : offset;
+        }
+        erased = true;
+        if (!node->left || !node->right) {
+            return node->left ? node->left : node->right;
+        }
+        const Node* min = _node(node->right);
+        while (min->left) {
+            min = _node(min->left);
+        }
+        return _balance(node->left, min->key, min->value, _removeMin(node->right));
+    }
+
+    Comparator _comparator;
+};
+
+#endif // SHARED_MEMORY_MAP_HPP
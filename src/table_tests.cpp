@@ -0,0 +1,60 @@
+#include <cstdint>
+#include "tests.hpp"
+#include "persistent_table.hpp"
+
+TEST_F(PersistentTableTest, ColumnsTest) {
+    PersistentTable<int32_t, double, std::string> table;
+    table.push_back(0, 1, 0.5, "a");
+    table.push_back(1, 2, 1.5, "b");
+    table.push_back(2, 3, 2.5, "c");
+    table.update<1>(3, 1, 10.0);
+    table.pop_back(3);
+
+    ASSERT_EQ(6, table.versionsNumber());
+    ASSERT_EQ(3, table.size(4));
+    ASSERT_EQ(2, table.size(5));
+    ASSERT_EQ(std::make_tuple(2, 10.0, std::string("b")), table.row(4, 1));
+    ASSERT_EQ(1.5, table.at<1>(3, 1));
+    ASSERT_EQ("c", table.at<2>(4, 2));
+    // the update wrote only its own column
+    ASSERT_EQ(1, table.column<0>().history(4, 1).size());
+    ASSERT_EQ(2, table.column<1>().history(4, 1).size());
+    ASSERT_EQ(6, table.column<2>().versionsNumber());
+}
+
+TEST_F(PersistentTableTest, KernelsTest) {
+    PersistentTable<int32_t, int64_t, double> table;
+    size_t version = 0;
+    for (int i = 0; i < 103; ++i) {
+        table.push_back(version++, i % 2 ? -i : i * 1000, (int64_t)i << 33, i * 0.25);
+    }
+    table.update<0>(version++, 50, 7);
+
+    int64_t intSum = 0;
+    int64_t longSum = 0;
+    double doubleSum = 0;
+    std::vector<size_t> expectedInts;
+    std::vector<size_t> expectedDoubles;
+    std::vector<size_t> expectedLongs;
+    for (size_t row = 0; row < table.size(version); ++row) {
+        intSum += table.at<0>(version, row);
+        longSum += table.at<1>(version, row);
+        doubleSum += table.at<2>(version, row);
+        if (table.at<0>(version, row) >= -20 && table.at<0>(version, row) <= 5000) {
+            expectedInts.push_back(row);
+        }
+        if (table.at<1>(version, row) >= ((int64_t)10 << 33) && table.at<1>(version, row) <= ((int64_t)90 << 33)) {
+            expectedLongs.push_back(row);
+        }
+        if (table.at<2>(version, row) >= 3.0 && table.at<2>(version, row) <= 20.25) {
+            expectedDoubles.push_back(row);
+        }
+    }
+    ASSERT_EQ(intSum, table.sum<0>(version));
+    ASSERT_EQ(longSum, table.sum<1>(version));
+    ASSERT_EQ(doubleSum, table.sum<2>(version));
+    ASSERT_EQ(expectedInts, table.filter<0>(version, -20, 5000));
+    ASSERT_EQ(expectedLongs, table.filter<1>(version, (int64_t)10 << 33, (int64_t)90 << 33));
+    ASSERT_EQ(expectedDoubles, table.filter<2>(version, 3.0, 20.25));
+    ASSERT_EQ(table.sum<0>(version - 1) - 50 * 1000 + 7, table.sum<0>(version));
+}
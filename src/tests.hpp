@@ -9,5 +9,35 @@ class PersistentListTest : public ::testing::Test {
 };
 class PersistentVectorTest : public ::testing::Test {
 };
+class WorkspaceTest : public ::testing::Test {
+};
+class PersistentTableTest : public ::testing::Test {
+};
+class PersistentRopeTest : public ::testing::Test {
+};
+class ReplicationTest : public ::testing::Test {
+};
+class VersionTreeTest : public ::testing::Test {
+};
+
+// Counts copy constructions to check that containers do not duplicate stored values
+struct CopyCounter {
+    static size_t copies;
+
+    CopyCounter()
+    {}
+    CopyCounter(const CopyCounter&) {
+        ++copies;
+    }
+    CopyCounter& operator=(const CopyCounter&) {
+        ++copies;
+        return *this;
+    }
+    CopyCounter(CopyCounter&&)
+    {}
+    CopyCounter& operator=(CopyCounter&&) {
+        return *this;
+    }
+};
 
 #endif // TESTS_HPP
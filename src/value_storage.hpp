@@ -0,0 +1,485 @@
+#ifndef VALUE_STORAGE_HPP
+#define VALUE_STORAGE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/* Storage policies of PersistentVector. A policy decides how the values written to one index
+ * (its History) are kept, and may hold state shared by all the histories of a vector:
+ *   const_reference                       what reads return
+ *   History::size(), version(i), setVersion(i, version)
+ *   History::value(i, storage)             value of the i-th write
+ *   History::push_back(version, value, storage)
+ *   History::emplace_back(version, storage, args...)   write of a value constructed from 'args'
+ *   History::retain(keep, storage)         drops the writes whose 'keep' flag is false
+ *   History::equals(other, storage, otherStorage)   same versions and values, each side read through its storage
+ *   History::bytes()                      memory the entries take, allocator overhead aside
+ *   clear()                                forgets everything, histories are cleared by the vector */
+
+// Values are stored in the history entries themselves
+template <class T>
+class InlineStorage {
+public:
+    typedef const T& const_reference;
+
+    class History {
+    public:
+        size_t size() const {
+            return _entries.size();
+        }
+        bool empty() const {
+            return _entries.empty();
+        }
+        size_t version(const size_t i) const {
+            return _entries[i].version;
+        }
+        void setVersion(const size_t i, const size_t version) {
+            _entries[i].version = version;
+        }
+        const_reference value(const size_t i, const InlineStorage&) const {
+            return _entries[i].value;
+        }
+        void push_back(const size_t version, const T& value, InlineStorage&) {
+            _entries.push_back(Entry(version, value));
+        }
+        // The value is constructed in its entry
+        template <class... Args>
+        void emplace_back(const size_t version, InlineStorage&, Args&&... args) {
+            _entries.emplace_back(version, std::forward<Args>(args)...);
+        }
+        void retain(const std::vector<bool>& keep, InlineStorage&) {
+            std::deque<Entry> kept;
+            for (size_t i = 0; i < _entries.size(); ++i) {
+                if (keep[i]) {
+                    kept.push_back(_entries[i]);
+                }
+            }
+            _entries.swap(kept);
+        }
+
+        bool equals(const History& other, const InlineStorage&, const InlineStorage&) const {
+            return _entries == other._entries;
+        }
+        size_t bytes() const {
+            return _entries.size() * sizeof(Entry);
+        }
+
+    private:
+        struct Entry {
+            size_t version;
+            T value;
+
+            template <class... Args>
+            Entry(const size_t version_, Args&&... args) : version(version_), value(std::forward<Args>(args)...)
+            {}
+
+            bool operator==(const Entry& other) const {
+                return version == other.version && value == other.value;
+            }
+        };
+
+        std::deque<Entry> _entries;
+    };
+
+    void clear()
+    {}
+};
+
+/* Values are interned in a pool shared by all indices of the vector: equal values are stored once
+ * and history entries are fixed-size (version, handle) records. Pool slots are reference counted
+ * and reused once no entry refers to them. Needs Hash and operator== for T. */
+template <class T, class Hash = std::hash<T> >
+class PooledStorage {
+public:
+    typedef const T& const_reference;
+    typedef uint32_t handle_type;
+
+    class History {
+    public:
+        size_t size() const {
+            return _entries.size();
+        }
+        bool empty() const {
+            return _entries.empty();
+        }
+        size_t version(const size_t i) const {
+            return _entries[i].version;
+        }
+        void setVersion(const size_t i, const size_t version) {
+            _entries[i].version = version;
+        }
+        const_reference value(const size_t i, const PooledStorage& storage) const {
+            return storage._slots[_entries[i].handle].value;
+        }
+        void push_back(const size_t version, const T& value, PooledStorage& storage) {
+            _entries.push_back(Entry(version, storage._intern(value)));
+        }
+        // The value has to be hashed first, so it is constructed once and moved into a new slot
+        template <class... Args>
+        void emplace_back(const size_t version, PooledStorage& storage, Args&&... args) {
+            _entries.push_back(Entry(version, storage._intern(T(std::forward<Args>(args)...))));
+        }
+        void retain(const std::vector<bool>& keep, PooledStorage& storage) {
+            std::deque<Entry> kept;
+            for (size_t i = 0; i < _entries.size(); ++i) {
+                if (keep[i]) {
+                    kept.push_back(_entries[i]);
+                } else {
+                    storage._release(_entries[i].handle);
+                }
+            }
+            _entries.swap(kept);
+        }
+
+        // Handles index different pools in different vectors, so the values are compared
+        bool equals(const History& other, const PooledStorage& storage, const PooledStorage& otherStorage) const {
+            if (_entries.size() != other._entries.size()) {
+                return false;
+            }
+            for (size_t i = 0; i < _entries.size(); ++i) {
+                if (_entries[i].version != other._entries[i].version
+                        || !(value(i, storage) == other.value(i, otherStorage))) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        // The pooled values are shared by all histories and not counted here
+        size_t bytes() const {
+            return _entries.size() * sizeof(Entry);
+        }
+
+    private:
+        struct Entry {
+            size_t version;
+            handle_type handle;
+
+            Entry(const size_t version_, const handle_type handle_) : version(version_), handle(handle_)
+            {}
+        };
+
+        std::deque<Entry> _entries;
+    };
+
+    // Number of distinct values currently referenced
+    size_t poolSize() const {
+        return _slots.size() - _free.size();
+    }
+
+    void clear() {
+        _slots.clear();
+        _free.clear();
+        _index.clear();
+    }
+
+private:
+    struct Slot {
+        T value;
+        size_t references;
+
+        Slot(const T& value_) : value(value_), references(0)
+        {}
+        Slot(T&& value_) : value(std::move(value_)), references(0)
+        {}
+    };
+
+    // slots never move, so references returned by reads stay valid until the value is released
+    std::deque<Slot> _slots;
+    std::vector<handle_type> _free;
+    // value hash -> slots holding a value with that hash
+    std::unordered_multimap<size_t, handle_type> _index;
+    Hash _hash;
+
+    template <class V>
+    handle_type _intern(V&& value) {
+        size_t hash = _hash(value);
+        auto range = _index.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (_slots[it->second].value == value) {
+                ++_slots[it->second].references;
+                return it->second;
+            }
+        }
+        handle_type handle;
+        if (!_free.empty()) {
+            handle = _free.back();
+            _free.pop_back();
+            _slots[handle].value = std::forward<V>(value);
+        } else {
+            if (_slots.size() > std::numeric_limits<handle_type>::max()) {
+                throw new std::out_of_range("Value pool is full");
+            }
+            handle = _slots.size();
+            _slots.push_back(Slot(std::forward<V>(value)));
+        }
+        _slots[handle].references = 1;
+        _index.insert(std::make_pair(hash, handle));
+        return handle;
+    }
+
+    void _release(const handle_type handle) {
+        Slot& slot = _slots[handle];
+        if (--slot.references > 0) {
+            return;
+        }
+        auto range = _index.equal_range(_hash(slot.value));
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second == handle) {
+                _index.erase(it);
+                break;
+            }
+        }
+        slot.value = T();
+        _free.push_back(handle);
+    }
+};
+
+/* Compressed histories for arithmetic T. Writes are sealed into blocks of BLOCK_SIZE entries, each
+ * holding its first entry as is and the rest as varint codes: the zigzag delta of the version, and
+ * the zigzag delta of the value for integers or the XOR with the previous value, shifted past its
+ * trailing zeros, for floating point. The latest writes stay uncompressed in an open tail of at least
+ * BLOCK_SIZE entries, so reading one of the newest entries never decodes a block, not even right after
+ * a seal. Reads return values, not references.
+ * Only the histories are compressed. A vector also keeps two lookup events of 16 bytes per write in its
+ * fat nodes, so a slowly changing history shrinks about five times while the whole vector saves
+ * about a quarter per write. */
+template <class T>
+class CompressedStorage {
+    static_assert(std::is_arithmetic<T>::value && sizeof(T) <= sizeof(uint64_t),
+                  "CompressedStorage needs an arithmetic type of at most 64 bits");
+
+public:
+    typedef T const_reference;
+
+    class History {
+    public:
+        History() : _sealed(0)
+        {}
+
+        size_t size() const {
+            return _sealed + _tail.size();
+        }
+        bool empty() const {
+            return size() == 0;
+        }
+        size_t version(const size_t i) const {
+            if (i >= _sealed) {
+                return _tail[i - _sealed].version;
+            }
+            return _decode(i).version;
+        }
+        void setVersion(const size_t i, const size_t version) {
+            if (i >= _sealed) {
+                _tail[i - _sealed].version = version;
+                return;
+            }
+            std::vector<Entry> entries = _decodeBlock(i / BLOCK_SIZE);
+            entries[i % BLOCK_SIZE].version = version;
+            _blocks[i / BLOCK_SIZE] = _encodeBlock(entries);
+        }
+        const_reference value(const size_t i, const CompressedStorage&) const {
+            if (i >= _sealed) {
+                return _tail[i - _sealed].value;
+            }
+            return _decode(i).value;
+        }
+        void push_back(const size_t version, const T& value, CompressedStorage&) {
+            _tail.push_back(Entry(version, value));
+            // a block is sealed only once BLOCK_SIZE newer entries follow it
+            if (_tail.size() == 2 * BLOCK_SIZE) {
+                _blocks.push_back(_encodeBlock(std::vector<Entry>(_tail.begin(), _tail.begin() + BLOCK_SIZE)));
+                _sealed += BLOCK_SIZE;
+                _tail.erase(_tail.begin(), _tail.begin() + BLOCK_SIZE);
+            }
+        }
+        template <class... Args>
+        void emplace_back(const size_t version, CompressedStorage& storage, Args&&... args) {
+            push_back(version, T(std::forward<Args>(args)...), storage);
+        }
+        void retain(const std::vector<bool>& keep, CompressedStorage& storage) {
+            std::vector<Entry> entries;
+            for (size_t block = 0; block < _blocks.size(); ++block) {
+                std::vector<Entry> decoded = _decodeBlock(block);
+                entries.insert(entries.end(), decoded.begin(), decoded.end());
+            }
+            entries.insert(entries.end(), _tail.begin(), _tail.end());
+            _blocks.clear();
+            _tail.clear();
+            _sealed = 0;
+            for (size_t i = 0; i < entries.size(); ++i) {
+                if (keep[i]) {
+                    push_back(entries[i].version, entries[i].value, storage);
+                }
+            }
+        }
+
+        // The encoding only depends on the entries, so equal histories have equal blocks
+        bool equals(const History& other, const CompressedStorage&, const CompressedStorage&) const {
+            return _sealed == other._sealed && _blocks == other._blocks && _tail == other._tail;
+        }
+        size_t bytes() const {
+            size_t bytes = _blocks.size() * sizeof(Block) + _tail.size() * sizeof(Entry);
+            for (auto& block : _blocks) {
+                bytes += block.codes.size();
+            }
+            return bytes;
+        }
+
+    private:
+        static const size_t BLOCK_SIZE = 32;
+
+        struct Entry {
+            size_t version;
+            T value;
+
+            Entry(const size_t version_, const T& value_) : version(version_), value(value_)
+            {}
+
+            bool operator==(const Entry& other) const {
+                return version == other.version && value == other.value;
+            }
+        };
+
+        struct Block {
+            size_t firstVersion;
+            T firstValue;
+            std::vector<uint8_t> codes;
+
+            bool operator==(const Block& other) const {
+                return firstVersion == other.firstVersion && firstValue == other.firstValue
+                        && codes == other.codes;
+            }
+        };
+
+        size_t _sealed;
+        std::vector<Block> _blocks;
+        std::vector<Entry> _tail;
+
+        // Decodes the block of entry 'i' up to that entry only
+        Entry _decode(const size_t i) const {
+            const Block& block = _blocks[i / BLOCK_SIZE];
+            Entry entry(block.firstVersion, block.firstValue);
+            uint64_t bits = _toBits(block.firstValue);
+            const uint8_t* code = block.codes.data();
+            for (size_t k = i % BLOCK_SIZE; k > 0; --k) {
+                entry.version += _unzigzag(_readVarint(code));
+                bits = _decodeValue(bits, code);
+            }
+            entry.value = _fromBits(bits);
+            return entry;
+        }
+        std::vector<Entry> _decodeBlock(const size_t index) const {
+            const Block& block = _blocks[index];
+            std::vector<Entry> entries;
+            entries.reserve(BLOCK_SIZE);
+            entries.push_back(Entry(block.firstVersion, block.firstValue));
+            uint64_t bits = _toBits(block.firstValue);
+            const uint8_t* code = block.codes.data();
+            const uint8_t* end = code + block.codes.size();
+            size_t version = block.firstVersion;
+            while (code < end) {
+                version += _unzigzag(_readVarint(code));
+                bits = _decodeValue(bits, code);
+                entries.push_back(Entry(version, _fromBits(bits)));
+            }
+            return entries;
+        }
+        static Block _encodeBlock(const std::vector<Entry>& entries) {
+            Block block;
+            block.firstVersion = entries.front().version;
+            block.firstValue = entries.front().value;
+            uint64_t bits = _toBits(block.firstValue);
+            for (size_t i = 1; i < entries.size(); ++i) {
+                _writeVarint(block.codes, _zigzag(entries[i].version - entries[i - 1].version));
+                uint64_t next = _toBits(entries[i].value);
+                _encodeValue(block.codes, bits, next);
+                bits = next;
+            }
+            block.codes.shrink_to_fit();
+            return block;
+        }
+
+        static void _encodeValue(std::vector<uint8_t>& codes, const uint64_t previous, const uint64_t bits) {
+            if (std::is_floating_point<T>::value) {
+                uint64_t diff = previous ^ bits;
+                if (diff == 0) {
+                    codes.push_back(0);
+                    return;
+                }
+                uint8_t trailing = 0;
+                while (!(diff & 1)) {
+                    diff >>= 1;
+                    ++trailing;
+                }
+                codes.push_back(trailing + 1);
+                _writeVarint(codes, diff);
+            } else {
+                _writeVarint(codes, _zigzag(bits - previous));
+            }
+        }
+        static uint64_t _decodeValue(const uint64_t previous, const uint8_t*& code) {
+            if (std::is_floating_point<T>::value) {
+                uint8_t header = *code++;
+                if (header == 0) {
+                    return previous;
+                }
+                return previous ^ (_readVarint(code) << (header - 1));
+            }
+            return previous + _unzigzag(_readVarint(code));
+        }
+
+        static uint64_t _zigzag(const uint64_t delta) {
+            return (delta << 1) ^ (uint64_t)((int64_t)delta >> 63);
+        }
+        static uint64_t _unzigzag(const uint64_t code) {
+            return (code >> 1) ^ (uint64_t)(-(int64_t)(code & 1));
+        }
+        static void _writeVarint(std::vector<uint8_t>& codes, uint64_t value) {
+            while (value >= 0x80) {
+                codes.push_back((uint8_t)(value | 0x80));
+                value >>= 7;
+            }
+            codes.push_back((uint8_t)value);
+        }
+        static uint64_t _readVarint(const uint8_t*& code) {
+            uint64_t value = *code & 0x7f;
+            unsigned shift = 7;
+            while (*code++ & 0x80) {
+                value |= (uint64_t)(*code & 0x7f) << shift;
+                shift += 7;
+            }
+            return value;
+        }
+
+        // Floating point values are compared bitwise, integers arithmetically
+        static uint64_t _toBits(const T& value) {
+            if (std::is_floating_point<T>::value) {
+                uint64_t bits = 0;
+                std::memcpy(&bits, &value, sizeof(T));
+                return bits;
+            }
+            return (uint64_t)value;
+        }
+        static T _fromBits(const uint64_t bits) {
+            if (std::is_floating_point<T>::value) {
+                T value;
+                std::memcpy(&value, &bits, sizeof(T));
+                return value;
+            }
+            return (T)bits;
+        }
+    };
+
+    void clear()
+    {}
+};
+
+#endif // VALUE_STORAGE_HPP
@@ -332,3 +332,572 @@ TEST_F(PersistentVectorTest, NestedMapTest) {
     ASSERT_EQ(2, vector.size(2));
     ASSERT_EQ(1, vector.size(3));
 }
+
+TEST_F(PersistentVectorTest, BatchTest) {
+    PersistentVector<int> vector;
+    vector.push_back(0, 10);
+    vector.push_back(1, 9);
+
+    auto batch = vector.batch(2);
+    batch.update(0, 1);
+    batch.update(0, 2);
+    batch.push_back(3);
+    batch.push_back(4);
+    batch.pop_back();
+    ASSERT_EQ(2, batch.at(0));
+    ASSERT_EQ(9, batch.at(1));
+    ASSERT_EQ(3, batch.size());
+    ASSERT_EQ(3, vector.versionsNumber());
+
+    ASSERT_EQ(3, batch.publish());
+    ASSERT_EQ(3, vector.size(3));
+    ASSERT_EQ(2, vector.at(3, 0));
+    ASSERT_EQ(9, vector.at(3, 1));
+    ASSERT_EQ(3, vector.at(3, 2));
+    ASSERT_EQ(10, vector.at(2, 0));
+    ASSERT_EQ(2, vector.size(2));
+
+    batch.pop_back();
+    batch.pop_back();
+    batch.push_back(7);
+    ASSERT_EQ(4, batch.publish());
+    ASSERT_EQ(2, vector.size(4));
+    ASSERT_EQ(2, vector.at(4, 0));
+    ASSERT_EQ(7, vector.at(4, 1));
+    ASSERT_EQ(9, vector.at(3, 1));
+
+    batch.insert(0, 1);
+    batch.insert(3, 8);
+    batch.insert(1, 5);
+    batch.erase(2);
+    ASSERT_THROW(batch.insert(5, 0), std::out_of_range*);
+    ASSERT_THROW(batch.erase(4), std::out_of_range*);
+    ASSERT_EQ(5, batch.publish());
+    std::vector<int> expected = {1, 5, 7, 8};
+    ASSERT_EQ(expected, std::vector<int>(vector.begin(5), vector.end()));
+    ASSERT_EQ(2, vector.size(4));
+    ASSERT_EQ(7, vector.at(4, 1));
+}
+
+TEST_F(PersistentVectorTest, SquashTest) {
+    PersistentVector<int> vector;
+    vector.push_back(0, 10);
+    vector.update(1, 0, 20);
+    vector.push_back(2, 30);
+    vector.push_back(3, 5);
+
+    vector.squash(1, 4);
+    ASSERT_EQ(5, vector.versionsNumber());
+    ASSERT_EQ(10, vector.at(1, 0));
+    ASSERT_EQ(3, vector.size(4));
+    ASSERT_EQ(20, vector.at(4, 0));
+    ASSERT_EQ(30, vector.at(4, 1));
+    ASSERT_EQ(5, vector.at(4, 2));
+    ASSERT_THROW(vector.push_back(3, 1), std::out_of_range*);
+
+    vector.update(4, 1, 31);
+    vector.update(5, 0, 1);
+    vector.update(5, 0, 2);
+    ASSERT_THROW(vector.squash(4, 6), std::out_of_range*);
+    ASSERT_THROW(vector.squash(6, 4), std::out_of_range*);
+    ASSERT_EQ(31, vector.at(6, 1));
+    ASSERT_EQ(30, vector.at(4, 1));
+    ASSERT_EQ(1, vector.at(6, 0));
+    ASSERT_EQ(2, vector.at(7, 0));
+    ASSERT_EQ(20, vector.at(5, 0));
+
+    // 'from' with an older branch 1 -> 2 and a younger one 1 -> 5 next to the chain 1 -> 3 -> 4
+    PersistentVector<int> branched;
+    branched.push_back(0, 1);
+    branched.update(1, 0, 2);
+    branched.update(1, 0, 3);
+    branched.push_back(3, 4);
+    branched.update(1, 0, 5);
+    branched.squash(1, 4);
+    ASSERT_EQ(2, branched.at(2, 0));
+    ASSERT_EQ(3, branched.at(4, 0));
+    ASSERT_EQ(4, branched.at(4, 1));
+    ASSERT_EQ(5, branched.at(5, 0));
+    ASSERT_EQ(1, branched.at(1, 0));
+    ASSERT_THROW(branched.update(3, 0, 0), std::out_of_range*);
+    branched.update(4, 1, 6);
+    ASSERT_EQ(6, branched.at(6, 1));
+}
+
+TEST_F(PersistentVectorTest, RetireTest) {
+    std::vector<std::shared_ptr<int> > values;
+    for (int i = 0; i < 20; ++i) {
+        values.push_back(std::make_shared<int>(i));
+    }
+    PersistentVector<std::shared_ptr<int> > vector;
+    for (size_t i = 0; i < 10; ++i) {
+        vector.push_back(i, values[i]);
+    }
+    for (size_t i = 10; i < 20; ++i) {
+        vector.update(i, 3, values[i]);
+    }
+    for (size_t i = 0; i < 5; ++i) {
+        vector.pop_back(i == 0 ? 10 : 20 + i);
+    }
+    ASSERT_EQ(2, values[15].use_count());
+    ASSERT_EQ(2, values[9].use_count());
+
+    for (size_t version = 11; version <= 20; ++version) {
+        vector.retire(version);
+    }
+    ASSERT_THROW(vector.update(15, 0, values[0]), std::out_of_range*);
+    ASSERT_TRUE(vector.collect(100));
+    ASSERT_EQ(1, values[15].use_count());
+    ASSERT_EQ(1, values[19].use_count());
+    ASSERT_EQ(2, values[3].use_count());
+    ASSERT_EQ(values[3], vector.at(10, 3));
+    ASSERT_EQ(values[9], vector.at(10, 9));
+    ASSERT_EQ(5, vector.size(25));
+    ASSERT_THROW(vector.retire(15), std::out_of_range*);
+    // collected versions can't be read any more, try_at() tells them apart from live ones
+    ASSERT_EQ(AccessError::INVALID_VERSION, vector.try_at(15, 3).error());
+    ASSERT_EQ(values[3], *vector.try_at(10, 3));
+
+    for (size_t version = 1; version <= 24; ++version) {
+        if (version < 11 || version > 20) {
+            vector.retire(version);
+        }
+    }
+    for (size_t i = 0; i < 5; ++i) {
+        vector.update(25 + i, 0, values[10 + i]);
+        vector.retire(25 + i);
+    }
+    ASSERT_TRUE(vector.collect(100));
+    ASSERT_EQ(1, values[9].use_count());
+    ASSERT_EQ(1, values[5].use_count());
+    ASSERT_EQ(1, values[10].use_count());
+    ASSERT_EQ(1, values[0].use_count());
+    ASSERT_EQ(2, values[14].use_count());
+    ASSERT_EQ(2, values[4].use_count());
+    ASSERT_EQ(values[14], vector.at(30, 0));
+    ASSERT_EQ(values[4], vector.at(30, 4));
+
+    vector.push_back(30, values[19]);
+    ASSERT_EQ(values[19], vector.at(31, 5));
+    ASSERT_EQ(6, vector.size(31));
+}
+
+TEST_F(PersistentVectorTest, CollectDuringWritesTest) {
+    PersistentVector<int> vector;
+    for (int i = 0; i < 10; ++i) {
+        vector.push_back(i, i);
+    }
+    for (size_t version = 1; version < 10; ++version) {
+        vector.retire(version);
+    }
+    // the pass starts with 0 and 10 live, then versions appear while it is running
+    ASSERT_FALSE(vector.collect(1));
+    vector.update(10, 8, 42);
+    vector.push_back(11, 10);
+    vector.update(10, 9, 43);
+    while (!vector.collect(1)) {
+    }
+    ASSERT_EQ(42, vector.at(11, 8));
+    ASSERT_EQ(42, vector.at(12, 8));
+    ASSERT_EQ(10, vector.at(12, 10));
+    ASSERT_EQ(43, vector.at(13, 9));
+    ASSERT_EQ(8, vector.at(10, 8));
+    ASSERT_EQ(9, vector.at(12, 9));
+}
+
+TEST_F(PersistentVectorTest, HeavilyUpdatedIndexTest) {
+    PersistentVector<int> vector;
+    std::vector<std::vector<int> > expected(1);
+    for (int i = 0; i < 4; ++i) {
+        vector.push_back(i, i);
+        expected.push_back(expected.back());
+        expected.back().push_back(i);
+    }
+    unsigned int seed = 12345;
+    for (int i = 0; i < 2000; ++i) {
+        seed = seed * 1103515245 + 12345;
+        size_t srcVersion = 4 + (seed >> 8) % (expected.size() - 4);
+        size_t index = (seed >> 4) % 8 == 0 ? 1 : 0;
+        vector.update(srcVersion, index, i);
+        expected.push_back(expected[srcVersion]);
+        expected.back()[index] = i;
+    }
+    for (size_t version = 0; version < expected.size(); ++version) {
+        ASSERT_EQ(expected[version].size(), vector.size(version));
+        for (size_t index = 0; index < expected[version].size(); ++index) {
+            ASSERT_EQ(expected[version][index], vector.at(version, index));
+        }
+    }
+}
+
+TEST_F(PersistentVectorTest, PooledStorageTest) {
+    typedef PersistentVector<std::string, PooledStorage<std::string> > StringVector;
+    StringVector vector;
+    std::string big(1000, 'x');
+    for (size_t i = 0; i < 10; ++i) {
+        vector.push_back(i, big);
+    }
+    vector.update(10, 3, "small");
+    vector.update(11, 4, "small");
+    ASSERT_EQ(big, vector.at(12, 0));
+    ASSERT_EQ("small", vector.at(12, 3));
+    ASSERT_EQ("small", vector.at(12, 4));
+    ASSERT_EQ(big, vector.at(11, 4));
+    ASSERT_EQ(2, vector.storage().poolSize());
+
+    StringVector copy = vector;
+    ASSERT_EQ("small", copy.at(12, 3));
+
+    for (size_t version = 1; version <= 11; ++version) {
+        vector.retire(version);
+    }
+    while (!vector.collect(4)) {
+    }
+    ASSERT_EQ(big, vector.at(12, 9));
+    ASSERT_EQ("small", vector.at(12, 3));
+    vector.update(12, 3, big);
+    vector.update(13, 4, big);
+    vector.retire(12);
+    vector.retire(13);
+    while (!vector.collect(4)) {
+    }
+    ASSERT_EQ(big, vector.at(14, 4));
+    ASSERT_EQ(1, vector.storage().poolSize());
+    vector.update(14, 0, "other");
+    ASSERT_EQ(2, vector.storage().poolSize());
+    ASSERT_EQ("other", vector.at(15, 0));
+    ASSERT_EQ(big, vector.at(15, 1));
+
+    // handles of separate vectors index separate pools, equality and assignment go by the values
+    PersistentVector<std::string, PooledStorage<std::string> > a;
+    PersistentVector<std::string, PooledStorage<std::string> > b;
+    a.push_back(0, "x");
+    b.push_back(0, "y");
+    ASSERT_FALSE(a == b);
+    a = b;
+    ASSERT_EQ("y", a.at(1, 0));
+    ASSERT_TRUE(a == b);
+    b.update(1, 0, "z");
+    a = std::move(b);
+    ASSERT_EQ("z", a.at(2, 0));
+    ASSERT_EQ(3, a.versionsNumber());
+}
+
+TEST_F(PersistentVectorTest, CompressedStorageTest) {
+    PersistentVector<int64_t, CompressedStorage<int64_t> > integers;
+    PersistentVector<double, CompressedStorage<double> > doubles;
+    PersistentVector<int64_t> expectedIntegers;
+    for (int i = 0; i < 8; ++i) {
+        integers.push_back(i, -i);
+        doubles.push_back(i, -i / 4.0);
+        expectedIntegers.push_back(i, -i);
+    }
+    unsigned int seed = 777;
+    for (int i = 0; i < 1500; ++i) {
+        seed = seed * 1103515245 + 12345;
+        size_t srcVersion = 8 + (seed >> 8) % (integers.versionsNumber() - 8);
+        size_t index = (seed >> 4) % 8;
+        int64_t value = (seed >> 12) % 2 ? i : -1000000007LL * i;
+        integers.update(srcVersion, index, value);
+        doubles.update(srcVersion, index, value / 4.0);
+        expectedIntegers.update(srcVersion, index, value);
+    }
+    for (size_t version = 0; version < expectedIntegers.versionsNumber(); ++version) {
+        for (size_t index = 0; index < expectedIntegers.size(version); ++index) {
+            ASSERT_EQ(expectedIntegers.at(version, index), integers.at(version, index));
+            ASSERT_EQ(expectedIntegers.at(version, index) / 4.0, doubles.at(version, index));
+        }
+    }
+
+    for (size_t version = 1; version < 1000; ++version) {
+        integers.retire(version);
+    }
+    while (!integers.collect(8)) {
+    }
+    for (size_t version = 1000; version < expectedIntegers.versionsNumber(); ++version) {
+        for (size_t index = 0; index < expectedIntegers.size(version); ++index) {
+            ASSERT_EQ(expectedIntegers.at(version, index), integers.at(version, index));
+        }
+    }
+}
+
+TEST_F(PersistentVectorTest, CompressedStorageBytesTest) {
+    CompressedStorage<int64_t> compressedStorage;
+    CompressedStorage<int64_t>::History compressed;
+    InlineStorage<int64_t> inlineStorage;
+    InlineStorage<int64_t>::History uncompressed;
+    int64_t value = 1000000;
+    for (size_t version = 0; version < 10000; ++version) {
+        value += version % 3;
+        compressed.push_back(version, value, compressedStorage);
+        uncompressed.push_back(version, value, inlineStorage);
+    }
+    for (size_t i = 0; i < uncompressed.size(); ++i) {
+        ASSERT_EQ(uncompressed.value(i, inlineStorage), compressed.value(i, compressedStorage));
+    }
+    ASSERT_LT(compressed.bytes() * 4, uncompressed.bytes());
+
+
+    PersistentVector<std::pair<int, int> > pairs;
+    pairs.push_back(0, std::make_pair(3, 4));
+    ASSERT_EQ(4, pairs.begin(1)->second);
+}
+
+TEST_F(PersistentVectorTest, ResizeChainTest) {
+    PersistentVector<int> vector;
+    std::vector<std::vector<int> > expected(1);
+    unsigned int seed = 31;
+    for (int i = 0; i < 3000; ++i) {
+        seed = seed * 1103515245 + 12345;
+        size_t srcVersion = (seed >> 8) % expected.size();
+        std::vector<int> values = expected[srcVersion];
+        if ((seed >> 4) % 4 == 0 && !values.empty()) {
+            size_t index = (seed >> 12) % values.size();
+            vector.update(srcVersion, index, i);
+            values[index] = i;
+        } else {
+            size_t size = (seed >> 12) % 64;
+            vector.resize(srcVersion, size, i);
+            values.resize(size, i);
+        }
+        expected.push_back(values);
+    }
+    for (size_t version = 0; version < expected.size(); ++version) {
+        ASSERT_EQ(expected[version].size(), vector.size(version));
+        for (size_t index = 0; index < expected[version].size(); ++index) {
+            ASSERT_EQ(expected[version][index], vector.at(version, index));
+        }
+    }
+
+    // reading below a long chain of resets doesn't walk the chain
+    PersistentVector<int> grown;
+    grown.push_back(0, -1);
+    const size_t resizes = 200000;
+    for (size_t version = 1; version <= resizes; ++version) {
+        grown.resize(version, version + 1, version);
+    }
+    for (size_t version = 2; version <= resizes + 1; ++version) {
+        ASSERT_EQ(-1, grown.at(version, 0));
+        ASSERT_EQ(static_cast<int>(version - 1), grown.at(version, version - 1));
+    }
+}
+
+TEST_F(PersistentVectorTest, ResizeTest) {
+    PersistentVector<int> vector;
+    for (int i = 0; i < 5; ++i) {
+        vector.push_back(i, i + 1);
+    }
+    vector.pop_back(5);
+    vector.pop_back(6);
+    vector.resize(7, 1000000000, 7);
+    ASSERT_EQ(1000000000, vector.size(8));
+    ASSERT_EQ(3, vector.at(8, 2));
+    ASSERT_EQ(7, vector.at(8, 3));
+    ASSERT_EQ(7, vector.at(8, 4));
+    ASSERT_EQ(7, vector.at(8, 999999999));
+    ASSERT_EQ(5, vector.at(5, 4));
+
+    vector.update(8, 4, 40);
+    vector.update(9, 500000000, 50);
+    vector.resize(10, 2);
+    vector.resize(11, 600000000, -1);
+    ASSERT_EQ(40, vector.at(10, 4));
+    ASSERT_EQ(50, vector.at(10, 500000000));
+    ASSERT_EQ(7, vector.at(10, 500000001));
+    ASSERT_EQ(2, vector.at(12, 1));
+    ASSERT_EQ(-1, vector.at(12, 2));
+    ASSERT_EQ(-1, vector.at(12, 4));
+    ASSERT_EQ(-1, vector.at(12, 500000000));
+
+    PersistentVector<int> squashed = vector;
+    squashed.update(12, 3, 30);
+    squashed.squash(7, 13);
+    ASSERT_EQ(2, squashed.at(13, 1));
+    ASSERT_EQ(-1, squashed.at(13, 2));
+    ASSERT_EQ(30, squashed.at(13, 3));
+    ASSERT_EQ(-1, squashed.at(13, 4));
+    ASSERT_EQ(-1, squashed.at(13, 500000000));
+    ASSERT_EQ(3, squashed.at(7, 2));
+    ASSERT_EQ(3, squashed.size(7));
+
+    for (size_t version = 8; version <= 11; ++version) {
+        vector.retire(version);
+    }
+    vector.push_back(12, 9);
+    while (!vector.collect(4)) {
+    }
+    ASSERT_EQ(-1, vector.at(13, 500000000));
+    ASSERT_EQ(9, vector.at(13, 600000000));
+    ASSERT_EQ(600000001, vector.size(13));
+
+    // only the resets of ancestors are visible
+    PersistentVector<int> branches;
+    branches.push_back(0, 1);
+    branches.resize(1, 3, 5);
+    branches.resize(1, 3, 6);
+    branches.resize(2, 4, 7);
+    branches.pop_back(3);
+    branches.resize(5, 4, 8);
+    ASSERT_EQ(5, branches.at(4, 2));
+    ASSERT_EQ(7, branches.at(4, 3));
+    ASSERT_EQ(6, branches.at(3, 2));
+    ASSERT_EQ(6, branches.at(6, 1));
+    ASSERT_EQ(8, branches.at(6, 2));
+    ASSERT_EQ(8, branches.at(6, 3));
+    std::vector<std::pair<size_t, int> > expected = {{3, 6}, {6, 8}};
+    ASSERT_EQ(expected, branches.history(6, 2));
+    branches.update(6, 1, 9);
+    branches.resize(7, 6, 10);
+    for (size_t version = 0; version < branches.versionsNumber(); ++version) {
+        std::vector<int> values;
+        branches.copy(version, std::back_inserter(values));
+        ASSERT_EQ(branches.size(version), values.size());
+        for (size_t index = 0; index < values.size(); ++index) {
+            ASSERT_EQ(branches.at(version, index), values[index]);
+        }
+    }
+}
+
+TEST_F(PersistentVectorTest, HistoryTest) {
+    PersistentVector<int> vector;
+    std::vector<size_t> parents(1, 0);
+    std::vector<std::map<size_t, int> > writes(1);
+    for (int i = 0; i < 4; ++i) {
+        vector.push_back(i, i);
+        parents.push_back(i);
+        writes.push_back(std::map<size_t, int>());
+        writes.back()[i] = i;
+    }
+    unsigned int seed = 4242;
+    for (int i = 0; i < 600; ++i) {
+        seed = seed * 1103515245 + 12345;
+        size_t srcVersion = 4 + (seed >> 8) % (parents.size() - 4);
+        size_t index = (seed >> 4) % 4;
+        vector.update(srcVersion, index, 100 + i);
+        parents.push_back(srcVersion);
+        writes.push_back(std::map<size_t, int>());
+        writes.back()[index] = 100 + i;
+    }
+    std::vector<size_t> indices = {0, 1, 2, 3};
+    for (size_t version = 4; version < parents.size(); version += 7) {
+        std::vector<size_t> path;
+        for (size_t cur = version; cur != 0; cur = parents[cur]) {
+            path.push_back(cur);
+        }
+        std::reverse(path.begin(), path.end());
+        auto histories = vector.history(version, indices);
+        for (size_t index = 0; index < 4; ++index) {
+            std::vector<std::pair<size_t, int> > expected;
+            for (auto cur : path) {
+                if (writes[cur].count(index)) {
+                    expected.push_back(std::make_pair(cur, writes[cur][index]));
+                }
+            }
+            ASSERT_EQ(expected, vector.history(version, index));
+            ASSERT_EQ(expected, histories[index]);
+        }
+    }
+
+    PersistentVector<int> resized;
+    resized.push_back(0, 1);
+    resized.push_back(1, 2);
+    resized.pop_back(2);
+    resized.resize(3, 5, 7);
+    resized.update(4, 1, 8);
+    std::vector<std::pair<size_t, int> > expected = {{2, 2}, {4, 7}, {5, 8}};
+    ASSERT_EQ(expected, resized.history(5, 1));
+    ASSERT_THROW(resized.history(3, 1), std::out_of_range*);
+
+    // the version is checked first, and reported with its number
+    std::string invalidVersion = std::string(accessErrorMessage(AccessError::INVALID_VERSION)) + ": ";
+    try {
+        resized.history(9, 1);
+        FAIL();
+    } catch (std::out_of_range* error) {
+        ASSERT_EQ(invalidVersion + "9", error->what());
+        delete error;
+    }
+    resized.squash(2, 5);
+    try {
+        resized.history(4, 0);
+        FAIL();
+    } catch (std::out_of_range* error) {
+        ASSERT_EQ(invalidVersion + "4", error->what());
+        delete error;
+    }
+    ASSERT_THROW(resized.history(3, std::vector<size_t>(1, 0)), std::out_of_range*);
+    ASSERT_EQ(std::make_pair((size_t)5, 8), resized.history(5, 1).back());
+}
+
+TEST_F(PersistentVectorTest, MoveWritesTest) {
+    PersistentVector<CopyCounter> vector;
+    CopyCounter::copies = 0;
+    for (size_t i = 0; i < 100; ++i) {
+        vector.push_back(i, CopyCounter());
+    }
+    vector.emplace_back(100);
+    vector.update(101, 50, CopyCounter());
+    auto batch = vector.batch(102);
+    batch.push_back(CopyCounter());
+    batch.emplace_back();
+    batch.update(0, CopyCounter());
+    batch.publish();
+    ASSERT_EQ(0, CopyCounter::copies);
+    ASSERT_EQ(101, vector.size(102));
+    ASSERT_EQ(103, vector.size(103));
+
+    PersistentVector<std::string, PooledStorage<std::string> > strings;
+    std::string big(1000, 'x');
+    strings.push_back(0, std::move(big));
+    strings.emplace_back(1, 3, 'y');
+    strings.update(2, 0, std::string("small"));
+    ASSERT_EQ(std::string(1000, 'x'), strings.at(2, 0));
+    ASSERT_EQ("small", strings.at(3, 0));
+    ASSERT_EQ("yyy", strings.at(3, 1));
+    strings.insert(3, strings.begin(3), std::string("first"));
+    ASSERT_EQ("first", strings.at(4, 0));
+    ASSERT_EQ("yyy", strings.at(4, 2));
+}
+
+TEST_F(PersistentVectorTest, CheckedAccessTest) {
+    PersistentVector<int> vector;
+    for (int i = 0; i < 10; ++i) {
+        vector.push_back(i, i * 10);
+    }
+    for (size_t i = 0; i < 10; ++i) {
+        ASSERT_EQ(vector.at(10, i), vector.unchecked_at(10, i));
+        ASSERT_EQ(i * 10, *vector.try_at(10, i));
+    }
+    ASSERT_EQ(AccessError::INDEX_OUT_OF_RANGE, vector.try_at(5, 5).error());
+    ASSERT_EQ(AccessError::INVALID_VERSION, vector.try_at(11, 0).error());
+    ASSERT_EQ(-1, vector.try_at(5, 7).value_or(-1));
+    ASSERT_THROW(vector.try_at(5, 7).value(), std::out_of_range*);
+    ASSERT_THROW(vector.at(5, 7), std::out_of_range*);
+
+    ASSERT_TRUE(vector.try_update(10, 3, 7).has_value());
+    ASSERT_EQ(7, vector.at(11, 3));
+    ASSERT_EQ(AccessError::INDEX_OUT_OF_RANGE, vector.try_update(10, 10, 7).error());
+    ASSERT_EQ(AccessError::INVALID_VERSION, vector.try_update(12, 0, 7).error());
+    ASSERT_EQ(AccessError::EMPTY, vector.try_pop_back(0).error());
+    ASSERT_EQ(12, vector.versionsNumber());
+    ASSERT_TRUE(vector.try_pop_back(11));
+    ASSERT_EQ(9, vector.size(12));
+
+    // squashed versions are reported, not thrown from the version tree
+    vector.squash(5, 8);
+    ASSERT_EQ(AccessError::INVALID_VERSION, vector.try_at(6, 0).error());
+    ASSERT_EQ(AccessError::INVALID_VERSION, vector.try_update(7, 0, 1).error());
+    ASSERT_EQ(AccessError::INVALID_VERSION, vector.try_pop_back(6).error());
+    ASSERT_EQ(70, *vector.try_at(8, 7));
+    // so are retired ones, and once collected they can't be read either
+    vector.retire(12);
+    ASSERT_EQ(70, *vector.try_at(12, 7));
+    ASSERT_EQ(AccessError::INVALID_VERSION, vector.try_update(12, 0, 1).error());
+    ASSERT_EQ(AccessError::INVALID_VERSION, vector.try_pop_back(12).error());
+    while (!vector.collect(4)) {
+    }
+    ASSERT_EQ(AccessError::INVALID_VERSION, vector.try_at(12, 0).error());
+    ASSERT_EQ(AccessError::INVALID_VERSION, vector.try_update(12, 0, 1).error());
+    ASSERT_EQ(AccessError::INVALID_VERSION, vector.try_pop_back(12).error());
+    ASSERT_EQ(13, vector.versionsNumber());
+}
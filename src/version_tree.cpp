@@ -1,4 +1,63 @@
 #include "version_tree.h"
 
 const long VersionTree::NONE_VERSION = std::numeric_limits<long>::max();
-const double VersionTree::OVERFLOW_THRESHOLD_BASE = 1.5;
+const double VersionTree::ROOT_DENSITY = 0.5;
+
+/* Relabeling after Bender et al.'s order-maintenance list: the labels of the smallest aligned range
+ * around 'prevLabel' that stays sparse enough once 'version' is added are spread evenly. The allowed
+ * density falls from 1 for the smallest ranges to ROOT_DENSITY for the whole label space, which doubles
+ * when even that is exceeded. A relabeled range was dense, so inserts take amortized O(log n) labels. */
+void VersionTree::_relabel(const size_t prevLabel, const long version) {
+    size_t levels = 0;
+    while (((size_t)2 << levels) <= _labelsNumber) {
+        ++levels;
+    }
+    size_t rangeSize = 2;
+    for (size_t level = 1; level < levels; ++level, rangeSize *= 2) {
+        size_t rangeStart = prevLabel / rangeSize * rangeSize;
+        // the last label belongs to the end of the events
+        size_t rangeEnd = std::min(rangeStart + rangeSize, _labelsNumber - 1);
+        double threshold = 1.0 - (1.0 - ROOT_DENSITY) * level / levels;
+        if (_getOccupied(rangeStart, rangeEnd) + 1 <= threshold * (rangeEnd - rangeStart)) {
+            _relabelRange(rangeStart, rangeEnd, prevLabel, version);
+            return;
+        }
+    }
+    size_t occupied = _getOccupied(0, _labelsNumber - 1) + 1;
+    while (occupied > ROOT_DENSITY * (_labelsNumber - 1)) {
+        _labelsNumber *= 2;
+    }
+    _labelToVersion.resize(_labelsNumber, NONE_VERSION);
+    _relabelRange(0, _labelsNumber - 1, prevLabel, version);
+    _versionToLabel[NONE_VERSION] = _labelsNumber - 1;
+}
+
+size_t VersionTree::_getOccupied(const size_t rangeStart, const size_t rangeEnd) const {
+    size_t occupied = 0;
+    for (size_t i = rangeStart; i < rangeEnd; ++i) {
+        if (_labelToVersion[i] != NONE_VERSION) {
+            ++occupied;
+        }
+    }
+    return occupied;
+}
+
+void VersionTree::_relabelRange(const size_t rangeStart, const size_t rangeEnd, const size_t prevLabel, const long version) {
+    std::vector<long> rangeVersions;
+    for (size_t i = rangeStart; i < rangeEnd; ++i) {
+        if (_labelToVersion[i] != NONE_VERSION) {
+            rangeVersions.push_back(_labelToVersion[i]);
+            _labelToVersion[i] = NONE_VERSION;
+        }
+        if (i == prevLabel) {
+            rangeVersions.push_back(version);
+        }
+    }
+
+    size_t rangeSize = rangeEnd - rangeStart;
+    for (size_t i = 0; i < rangeVersions.size(); ++i) {
+        size_t label = rangeStart + i * rangeSize / rangeVersions.size();
+        _labelToVersion[label] = rangeVersions[i];
+        _versionToLabel[rangeVersions[i]] = label;
+    }
+}
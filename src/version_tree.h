@@ -9,6 +9,8 @@
 #include <limits>
 #include <algorithm>
 #include <iterator>
+#include <stdexcept>
+#include <string>
 
 class VersionTree {
 private:
@@ -38,8 +40,20 @@ public:
     }
 
     VersionTree(const VersionTree & other) : _events(other._events), _labelsNumber(other._labelsNumber),
-            _labelToVersion(other._labelToVersion), _versionToLabel(other._versionToLabel)
-    {}
+            _labelToVersion(other._labelToVersion), _versionToLabel(other._versionToLabel) {
+        _indexEvents();
+    }
+
+    VersionTree& operator=(const VersionTree& other) {
+        if (this != &other) {
+            _events = other._events;
+            _labelsNumber = other._labelsNumber;
+            _labelToVersion = other._labelToVersion;
+            _versionToLabel = other._versionToLabel;
+            _indexEvents();
+        }
+        return *this;
+    }
 
     bool operator==(const VersionTree& other) {
         return _events == other._events && _labelsNumber == other._labelsNumber
@@ -61,22 +75,18 @@ public:
         if (_events.empty()) {
             throw new std::out_of_range("Empty version tree");
         }
-        auto it = _events.begin();
-        for (; it != _events.end(); ++it) {
-            if (it->version == parentVersion) {
-                auto pos = _insert(version, it);
-                pos = _insert(-1 * version, pos);
-                break;
-            }
-        }
-        if (it == _events.end()) {
-            throw new std::out_of_range("Version tree doesn't contain parent version " + parentVersion);
+        auto it = _eventPositions.find(parentVersion);
+        if (it == _eventPositions.end() || parentVersion == NONE_VERSION) {
+            throw new std::out_of_range("Version tree doesn't contain parent version " + std::to_string(parentVersion));
         }
+        auto pos = _insert(version, it->second);
+        _insert(-1 * version, pos);
     }
 
     /* if lv <= rv returns true, else false */
     bool order(const long lv, const long rv) const {
-        return _getLabel(lv) <= _getLabel(rv) && _getLabel(-1 * rv) <= _getLabel(-1 * lv);
+        std::pair<size_t, size_t> left = interval(lv), right = interval(rv);
+        return left.first <= right.first && right.second <= left.second;
     }
 
     // empty version tree's _events contains only 2 entries for starting version
@@ -90,17 +100,110 @@ public:
 
     void clear() {
         _events.clear();
+        _eventPositions.clear();
         _init();
     }
 
+    bool contains(const long version) const {
+        return _versionToLabel.count(version) != 0 && version != NONE_VERSION;
+    }
+
+    /* label of a version's entry event, or of its exit event for -version */
+    size_t label(const long event) const {
+        return _getLabel(event);
+    }
+
+    /* labels of the version's entry and exit events: 'lv' is an ancestor of 'rv' iff interval(lv) contains interval(rv).
+     * Labels change on relabeling, but their relative order never does */
+    std::pair<size_t, size_t> interval(const long version) const {
+        return std::make_pair(_getLabel(version), _getLabel(version == 0 ? NONE_VERSION : -1 * version));
+    }
+
+    /* remove a version without children, returns false if it has any */
+    bool removeLeaf(const long version) {
+        if (version == 0) {
+            return false;
+        }
+        auto position = _eventPositions.find(version);
+        if (position == _eventPositions.end() || version == NONE_VERSION) {
+            throw new std::out_of_range("Version tree doesn't contain version " + std::to_string(version));
+        }
+        auto it = position->second;
+        auto next = it;
+        ++next;
+        if (next->version != -1 * version) {
+            return false;
+        }
+        _remove(next);
+        _remove(it);
+        return true;
+    }
+
+    /* remove all versions strictly between 'from' and its descendant 'to', so 'to' becomes a child of 'from'.
+     * Every removed version must have exactly one child. Returns the removed versions, nearest to 'to' first */
+    std::vector<long> squash(const long from, const long to) {
+        if (from == to || !contains(from) || !contains(to) || to == 0) {
+            throw new std::out_of_range("Invalid squash range");
+        }
+        auto toBegin = _eventPositions.at(to);
+        auto toEnd = _eventPositions.at(-1 * to);
+
+        /* a chain of single children looks like "from ... i1 ... ik to ... -to -ik ... -i1" in _events. Children
+         * are inserted right after their parent's entry, so subtrees of younger children of 'from' may sit
+         * between 'from' and i1, and those of older ones between -i1 and -from; inside the chain any other
+         * subtree means a second child */
+        std::vector<long> removed;
+        bool skipped = false;
+        auto it = toBegin;
+        while (it != _events.begin()) {
+            --it;
+            if (it->version == from) {
+                break;
+            }
+            if (it->version < 0) {
+                // exit of a subtree that ends before 'to': skip back to its entry
+                long entry = -1 * it->version;
+                while (it != _events.begin() && it->version != entry) {
+                    --it;
+                }
+                skipped = true;
+                continue;
+            }
+            if (skipped) {
+                throw new std::out_of_range("Versions between squash bounds must form a chain");
+            }
+            removed.push_back(it->version);
+        }
+        if (it->version != from) {
+            throw new std::out_of_range("Squash bounds are not an ancestor and its descendant");
+        }
+        auto endIt = toEnd;
+        ++endIt;
+        for (size_t i = 0; i < removed.size(); ++i, ++endIt) {
+            if (endIt == _events.end() || endIt->version != -1 * removed[i]) {
+                throw new std::out_of_range("Versions between squash bounds must form a chain");
+            }
+        }
+
+        for (size_t i = 0; i < removed.size(); ++i) {
+            auto next = toBegin;
+            _remove(--next);
+            next = toEnd;
+            _remove(++next);
+        }
+        return removed;
+    }
+
 private:
     std::list<Node> _events;
     size_t _labelsNumber;
     std::vector<long> _labelToVersion;
     std::unordered_map<long, size_t> _versionToLabel;
+    // every event's node in _events, so insertions and removals don't search the list
+    std::unordered_map<long, std::list<Node>::iterator> _eventPositions;
 
     static const long NONE_VERSION;
-    static const double OVERFLOW_THRESHOLD_BASE;
+    static const double ROOT_DENSITY;
 
     std::list<Node>::iterator _insert(const long version, const std::list<Node>::iterator & prev) {
         size_t prevLabel = _getLabel(prev->version);
@@ -112,11 +215,11 @@ private:
         }
 
         auto pos = _events.insert(next, Node(version));
+        _eventPositions[version] = pos;
 
         if (nextLabel - prevLabel < 2) {
-            _relabel(prevLabel, nextLabel);
-            prevLabel = _getLabel(prev->version);
-            nextLabel = _getLabel(next->version);
+            _relabel(prevLabel, version);
+            return pos;
         }
         size_t label = prevLabel + (nextLabel - prevLabel + 1) / 2;
 
@@ -126,115 +229,36 @@ private:
         return pos;
     }
 
-    void remove(const long version) {
-        bool wasDelete = false;
-        for (auto it = _events.begin(); it != _events.end(); ++it) {
-            if (it->version == version) {
-                auto next = it;
-                ++next;
-                _events.erase(it);
-                it = next;
-                // _events always contains 2 entries of one version with diferent inEvent flag values
-                if (wasDelete) {
-                    break;
-                }
-                wasDelete = true;
-            }
-        }
+    void _remove(const std::list<Node>::iterator & pos) {
+        size_t label = _getLabel(pos->version);
+        _labelToVersion[label] = NONE_VERSION;
+        _versionToLabel.erase(pos->version);
+        _eventPositions.erase(pos->version);
+        _events.erase(pos);
     }
 
-    void _relabel(const size_t firstLabel, const size_t secondLabel) {
-        size_t rangeSize = 2;
-        while (rangeSize <= _labelsNumber) {
-            size_t firstRangeNum = firstLabel / rangeSize;
-            size_t secondRangeNum = secondLabel / rangeSize;
-            if (firstRangeNum == secondRangeNum) {
-                size_t rangeStart = rangeSize * firstRangeNum;
-                size_t rangeEnd = rangeSize * (firstRangeNum + 1);
-                double rangeDensity = _getRangeDensity(rangeStart, rangeEnd);
+    /* Spreads the labels of the smallest aligned range around 'prevLabel' that stays sparse enough once
+     * 'version' is added right after it, see version_tree.cpp */
+    void _relabel(const size_t prevLabel, const long version);
+    size_t _getOccupied(const size_t rangeStart, const size_t rangeEnd) const;
+    // Evenly spaced labels for the versions of the range, with 'version' placed right after 'prevLabel'
+    void _relabelRange(const size_t rangeStart, const size_t rangeEnd, const size_t prevLabel, const long version);
 
-                double overflowThreshold = std::pow(OVERFLOW_THRESHOLD_BASE, -1 * (long long)rangeSize);
-                if (rangeDensity < overflowThreshold) {
-                    _relabelRange(rangeStart, rangeEnd);
-                    break;
-                }
-            }
-            rangeSize *= 2;
-        }
-        if (rangeSize >= _labelsNumber) {
-            _relabelAll();
-        }
-    }
-
-    double _getRangeDensity(const size_t rangeStart, const size_t rangeEnd) {
-        size_t occupied = 0;
-        for (size_t i = rangeStart; i < rangeEnd; ++i) {
-            if (_labelToVersion[i] != NONE_VERSION) {
-                ++occupied;
-            }
-        }
-        return (occupied + 0.0) / (rangeEnd - rangeStart);
-    }
-
-    void _relabelRange(const size_t rangeStart, const size_t rangeEnd) {
-        std::list<long> rangeVersions;
-        for (size_t i = rangeStart; i < rangeEnd; ++i) {
-            if (_labelToVersion[i] != NONE_VERSION) {
-                rangeVersions.push_back(_labelToVersion[i]);
-            }
-        }
-
-        auto rangeStartIt = _labelToVersion.begin();
-        std::advance(rangeStartIt, rangeStart);
-        auto rangeEndIt = _labelToVersion.begin();
-        std::advance(rangeEndIt, rangeEnd);
-        std::fill(rangeStartIt, rangeEndIt, NONE_VERSION);
-
-        size_t step = rangeEnd - rangeStart;
-        for (size_t i = rangeStart; i < rangeEnd; i += step) {
-            if (rangeVersions.empty()) {
-                break;
-            }
-            auto version = rangeVersions.front();
-            _labelToVersion[i] = version;
-            _versionToLabel[version] = i;
-            rangeVersions.pop_front();
-        }
-        _versionToLabel[NONE_VERSION] = _labelsNumber - 1;
+    size_t _getLabel(const long version) const {
+        return _versionToLabel.at(version);
     }
 
-    void _relabelAll() {
-        std::list<long> rangeVersions;
-        for (auto version : _labelToVersion) {
-            if (version != NONE_VERSION) {
-                rangeVersions.push_back(version);
-            }
-        }
-
-        _labelsNumber *= 2;
-        _labelToVersion.resize(_labelsNumber, NONE_VERSION);
-        std::fill(_labelToVersion.begin(), _labelToVersion.end(), NONE_VERSION);
-
-        size_t step = _labelsNumber / rangeVersions.size();
-        for (size_t i = 0; i < _labelsNumber; i += step) {
-            if (rangeVersions.empty()) {
-                break;
-            }
-            auto version = rangeVersions.front();
-            _labelToVersion[i] = version;
-            _versionToLabel[version] = i;
-            rangeVersions.pop_front();
+    void _indexEvents() {
+        _eventPositions.clear();
+        for (auto it = _events.begin(); it != _events.end(); ++it) {
+            _eventPositions[it->version] = it;
         }
-        _versionToLabel[NONE_VERSION] = _labelsNumber - 1;
-    }
-
-    size_t _getLabel(const long version) const {
-        return _versionToLabel.at(version);
     }
 
     void _init() {
         _events.push_back(Node(0));
         _events.push_back(Node(NONE_VERSION));
+        _indexEvents();
         _labelToVersion[0] = 0;
         _versionToLabel[0] = 0;
         _labelToVersion[_labelsNumber - 1] = NONE_VERSION;
@@ -0,0 +1,44 @@
+#include <vector>
+#include "tests.hpp"
+#include "version_tree.h"
+
+TEST_F(VersionTreeTest, RelabelTest) {
+    VersionTree versions;
+    std::vector<long> parents(1, -1);
+    // a chain first, so the labels after it fill up, then branches off random versions of it
+    for (long version = 1; version <= 600; ++version) {
+        versions.insert(version, version - 1);
+        parents.push_back(version - 1);
+    }
+    unsigned int seed = 4242;
+    for (long version = 601; version <= 1500; ++version) {
+        seed = seed * 1103515245 + 12345;
+        long parent = (seed >> 8) % version;
+        versions.insert(version, parent);
+        parents.push_back(parent);
+    }
+    ASSERT_EQ(1501, versions.size());
+
+    for (long version = 0; version <= 1500; ++version) {
+        ASSERT_TRUE(versions.contains(version));
+        auto interval = versions.interval(version);
+        ASSERT_LT(interval.first, interval.second);
+        if (version > 0) {
+            auto parent = versions.interval(parents[version]);
+            ASSERT_LT(parent.first, interval.first);
+            ASSERT_LT(interval.second, parent.second);
+        }
+        for (long ancestor = version; ancestor != -1; ancestor = parents[ancestor]) {
+            ASSERT_TRUE(versions.order(ancestor, version));
+        }
+    }
+    // unrelated versions are not ordered: siblings and the chain below a branch point
+    for (long version = 601; version <= 1500; ++version) {
+        long parent = parents[version];
+        if (parent < 600) {
+            ASSERT_FALSE(versions.order(parent + 1, version));
+            ASSERT_FALSE(versions.order(version, parent + 1));
+        }
+        ASSERT_FALSE(versions.order(version, parent));
+    }
+}
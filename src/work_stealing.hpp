@@ -0,0 +1,90 @@
+#ifndef WORK_STEALING_HPP
+#define WORK_STEALING_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Calls body(i) exactly once for every i in [0, count), on 'threads' threads including the caller
+ * (0: one per hardware thread). Each worker starts with an equal slice of the indices and takes them
+ * from the front; a worker whose slice runs dry steals the back half of the largest remaining slice,
+ * so uneven items even out without a shared queue. 'body' is called concurrently. */
+template <class Body>
+void workStealingFor(const size_t count, Body body, size_t threads = 0) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = std::min(threads, count);
+    if (threads <= 1) {
+        for (size_t i = 0; i < count; ++i) {
+            body(i);
+        }
+        return;
+    }
+
+    struct Slice {
+        std::mutex mutex;
+        size_t begin;
+        size_t end;
+    };
+    std::vector<Slice> slices(threads);
+    for (size_t i = 0; i < threads; ++i) {
+        slices[i].begin = count * i / threads;
+        slices[i].end = count * (i + 1) / threads;
+    }
+
+    auto work = [&slices, &body, threads](const size_t self) {
+        const size_t NONE = std::numeric_limits<size_t>::max();
+        while (true) {
+            size_t index = NONE;
+            {
+                std::lock_guard<std::mutex> lock(slices[self].mutex);
+                if (slices[self].begin < slices[self].end) {
+                    index = slices[self].begin++;
+                }
+            }
+            if (index != NONE) {
+                body(index);
+                continue;
+            }
+
+            size_t victim = NONE;
+            size_t largest = 0;
+            for (size_t i = 0; i < threads; ++i) {
+                std::lock_guard<std::mutex> lock(slices[i].mutex);
+                if (i != self && slices[i].end - slices[i].begin > largest) {
+                    largest = slices[i].end - slices[i].begin;
+                    victim = i;
+                }
+            }
+            if (victim == NONE) {
+                return;
+            }
+            size_t begin = 0;
+            size_t end = 0;
+            {
+                std::lock_guard<std::mutex> lock(slices[victim].mutex);
+                end = slices[victim].end;
+                begin = end - (end - slices[victim].begin) / 2;
+                slices[victim].end = begin;
+            }
+            std::lock_guard<std::mutex> lock(slices[self].mutex);
+            slices[self].begin = begin;
+            slices[self].end = end;
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < threads; ++i) {
+        workers.push_back(std::thread(work, i));
+    }
+    work(0);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+#endif // WORK_STEALING_HPP
@@ -0,0 +1,181 @@
+#ifndef WORKSPACE_H
+#define WORKSPACE_H
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "version_tree.h"
+
+/* One version history shared by several containers. Containers constructed with a workspace
+ * have exactly the workspace's versions: every version created through any of them (or through
+ * a Transaction) exists in all of them, unchanged in the containers that were not edited.
+ * PersistentVector members use the workspace's VersionTree instead of their own.
+ * The workspace must outlive its members. */
+class Workspace {
+private:
+    struct Staged {
+        virtual ~Staged()
+        {}
+        virtual void publish() = 0;
+    };
+
+    template <class Batch>
+    struct StagedBatch : public Staged {
+        Batch batch;
+
+        StagedBatch(Batch&& batch_) : batch(std::move(batch_))
+        {}
+        void publish() {
+            batch.publish();
+        }
+    };
+
+public:
+    /* Edits of several containers that become one workspace version on commit() */
+    class Transaction {
+        friend class Workspace;
+
+    public:
+        Transaction(Transaction&& other)
+            : _workspace(other._workspace), _srcVersion(other._srcVersion), _staged(std::move(other._staged))
+        {}
+        Transaction(const Transaction& other) = delete;
+        Transaction& operator=(const Transaction& other) = delete;
+
+        // Batch of 'container' on top of the transaction's version; the same batch for repeated calls
+        template <class Container>
+        typename std::decay<decltype(std::declval<Container&>().batch(0))>::type& edit(Container& container) {
+            typedef typename std::decay<decltype(std::declval<Container&>().batch(0))>::type batch_type;
+            auto it = _staged.find(&container);
+            if (it == _staged.end()) {
+                std::unique_ptr<Staged> staged(new StagedBatch<batch_type>(container.batch(_srcVersion)));
+                it = _staged.insert(std::make_pair(&container, std::move(staged))).first;
+            }
+            return static_cast<StagedBatch<batch_type>*>(it->second.get())->batch;
+        }
+
+        /* Creates the version in every member and returns its number. The transaction then continues from it.
+         * If a publish throws, the members that already published drop the version again, the workspace
+         * is left as it was and the staged edits are discarded */
+        size_t commit() {
+            size_t version = _workspace->_versionsNumber;
+            _workspace->_versions->insert(version, _srcVersion);
+            ++_workspace->_versionsNumber;
+            _workspace->_committing = true;
+            try {
+                for (auto& staged : _staged) {
+                    staged.second->publish();
+                }
+            } catch (...) {
+                _workspace->_committing = false;
+                _staged.clear();
+                _workspace->_rollback(version);
+                throw;
+            }
+            _workspace->_committing = false;
+            _workspace->_sync(version, _srcVersion);
+            _staged.clear();
+            _srcVersion = version;
+            return version;
+        }
+
+        size_t version() const {
+            return _srcVersion;
+        }
+
+    private:
+        Transaction(Workspace& workspace, const size_t srcVersion) : _workspace(&workspace), _srcVersion(srcVersion)
+        {}
+
+        Workspace* _workspace;
+        size_t _srcVersion;
+        std::map<const void*, std::unique_ptr<Staged> > _staged;
+    };
+
+    Workspace() : _versions(std::make_shared<VersionTree>()), _versionsNumber(1), _committing(false)
+    {}
+    Workspace(const Workspace& other) = delete;
+    Workspace& operator=(const Workspace& other) = delete;
+
+    Transaction transaction(const size_t srcVersion) {
+        if (srcVersion >= _versionsNumber) {
+            throw new std::out_of_range("Invalid version: " + std::to_string(srcVersion));
+        }
+        return Transaction(*this, srcVersion);
+    }
+
+    inline size_t versionsNumber() const {
+        return _versionsNumber;
+    }
+    inline const VersionTree& versions() const {
+        return *_versions;
+    }
+
+    /* Interface for the containers */
+
+    inline std::shared_ptr<VersionTree> _versionTree() const {
+        return _versions;
+    }
+    /* 'sync' has to add version 'version' derived from 'srcVersion' if the member doesn't have it yet,
+     * 'drop' has to remove the member's newest version 'version' if the member has it */
+    void _attach(const void* member, std::function<void(size_t, size_t)> sync, std::function<void(size_t)> drop) {
+        _members.push_back(Member{member, sync, drop});
+    }
+    void _detach(const void* member) {
+        for (auto it = _members.begin(); it != _members.end(); ++it) {
+            if (it->container == member) {
+                _members.erase(it);
+                return;
+            }
+        }
+    }
+    // Number for the version a member is about to create from 'srcVersion'
+    size_t _beginVersion(const size_t srcVersion) {
+        if (_committing) {
+            return _versionsNumber - 1;
+        }
+        size_t version = _versionsNumber;
+        _versions->insert(version, srcVersion);
+        ++_versionsNumber;
+        return version;
+    }
+    // Called once the member has created the version, the other members follow
+    void _endVersion(const size_t version, const size_t srcVersion) {
+        if (!_committing) {
+            _sync(version, srcVersion);
+        }
+    }
+
+private:
+    struct Member {
+        const void* container;
+        std::function<void(size_t, size_t)> sync;
+        std::function<void(size_t)> drop;
+    };
+
+    std::shared_ptr<VersionTree> _versions;
+    size_t _versionsNumber;
+    bool _committing;
+    std::vector<Member> _members;
+
+    void _sync(const size_t version, const size_t srcVersion) {
+        for (auto& member : _members) {
+            member.sync(version, srcVersion);
+        }
+    }
+    // Undoes a failed commit of the newest version
+    void _rollback(const size_t version) {
+        for (auto& member : _members) {
+            member.drop(version);
+        }
+        _versions->removeLeaf(version);
+        --_versionsNumber;
+    }
+};
+
+#endif // WORKSPACE_H
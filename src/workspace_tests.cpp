@@ -0,0 +1,162 @@
+#include <stdexcept>
+#include "tests.hpp"
+#include "workspace.h"
+#include "persistent_vector.hpp"
+#include "persistent_list.hpp"
+#include "persistent_map.hpp"
+
+TEST_F(WorkspaceTest, CommitTest) {
+    Workspace workspace;
+    PersistentMap<int, int> map(workspace);
+    PersistentVector<int> vector(workspace);
+    PersistentList<int> list(workspace);
+
+    auto transaction = workspace.transaction(0);
+    transaction.edit(map).insert(1, 10);
+    transaction.edit(map).insert(2, 20);
+    transaction.edit(vector).push_back(5);
+    ASSERT_EQ(1, transaction.commit());
+
+    transaction.edit(list).push_back(7);
+    transaction.edit(vector).update(0, 6);
+    ASSERT_EQ(2, transaction.commit());
+
+    ASSERT_EQ(3, workspace.versionsNumber());
+    ASSERT_EQ(3, map.versionsNumber());
+    ASSERT_EQ(3, vector.versionsNumber());
+    ASSERT_EQ(3, list.versionsNumber());
+
+    ASSERT_TRUE(map.empty(0));
+    ASSERT_EQ(2, map.size(1));
+    ASSERT_EQ(20, map.at(2, 2));
+    ASSERT_EQ(5, vector.at(1, 0));
+    ASSERT_EQ(6, vector.at(2, 0));
+    ASSERT_TRUE(list.empty(1));
+    ASSERT_EQ(7, *list.begin(2));
+}
+
+TEST_F(WorkspaceTest, SingleContainerWriteTest) {
+    Workspace workspace;
+    PersistentMap<int, int> map(workspace);
+    PersistentVector<int> vector(workspace);
+
+    map.insert(0, std::make_pair(1, 1));
+    vector.push_back(1, 2);
+    vector.push_back(0, 3);
+    map.insert(2, std::make_pair(4, 4));
+
+    ASSERT_EQ(5, workspace.versionsNumber());
+    ASSERT_EQ(5, map.versionsNumber());
+    ASSERT_EQ(5, vector.versionsNumber());
+    ASSERT_EQ(1, map.size(2));
+    ASSERT_EQ(2, vector.at(2, 0));
+    ASSERT_TRUE(map.empty(3));
+    ASSERT_EQ(3, vector.at(3, 0));
+    ASSERT_EQ(2, map.size(4));
+    ASSERT_EQ(2, vector.at(4, 0));
+
+    // the vector keeps no version tree of its own
+    ASSERT_TRUE(workspace.versions().contains(3));
+    ASSERT_TRUE(workspace.versions().order(2, 4));
+    ASSERT_FALSE(workspace.versions().order(3, 4));
+
+    // members attached later are empty in the existing versions
+    PersistentList<int> list(workspace);
+    ASSERT_EQ(5, list.versionsNumber());
+    list.push_front(4, 8);
+    ASSERT_EQ(2, map.size(5));
+    ASSERT_EQ(8, *list.begin(5));
+}
+
+// Value whose copies and moves throw while 'fail' is set
+struct Fragile {
+    static bool fail;
+    int value;
+
+    Fragile(const int value_ = 0) : value(value_)
+    {}
+    Fragile(const Fragile& other) : value(other.value) {
+        if (fail) {
+            throw std::runtime_error("Fragile copy");
+        }
+    }
+    Fragile& operator=(const Fragile& other) = default;
+};
+bool Fragile::fail = false;
+
+TEST_F(WorkspaceTest, FailedCommitTest) {
+    Workspace workspace;
+    // members are published in address order, so the list and the int vector publish before the failure
+    struct Members {
+        PersistentList<int> list;
+        PersistentVector<int> vector;
+        PersistentVector<Fragile> fragile;
+
+        Members(Workspace& workspace) : list(workspace), vector(workspace), fragile(workspace)
+        {}
+    } members(workspace);
+
+    auto transaction = workspace.transaction(0);
+    transaction.edit(members.vector).push_back(1);
+    transaction.edit(members.fragile).push_back(Fragile(2));
+    ASSERT_EQ(1, transaction.commit());
+
+    transaction.edit(members.list).push_back(3);
+    transaction.edit(members.vector).update(0, 4);
+    transaction.edit(members.fragile).update(0, Fragile(5));
+    Fragile::fail = true;
+    ASSERT_THROW(transaction.commit(), std::runtime_error);
+    Fragile::fail = false;
+
+    ASSERT_EQ(2, workspace.versionsNumber());
+    ASSERT_FALSE(workspace.versions().contains(2));
+    ASSERT_EQ(2, members.list.versionsNumber());
+    ASSERT_EQ(2, members.vector.versionsNumber());
+    ASSERT_EQ(2, members.fragile.versionsNumber());
+    ASSERT_EQ(1, members.vector.at(1, 0));
+    ASSERT_EQ(2, members.fragile.at(1, 0).value);
+
+    // the number is reused and no member keeps anything of the failed commit
+    ASSERT_EQ(1, transaction.version());
+    transaction.edit(members.fragile).push_back(Fragile(6));
+    ASSERT_EQ(2, transaction.commit());
+    ASSERT_TRUE(members.list.empty(2));
+    ASSERT_EQ(1, members.vector.at(2, 0));
+    ASSERT_EQ(2, members.fragile.at(2, 0).value);
+    ASSERT_EQ(6, members.fragile.at(2, 1).value);
+}
+
+TEST_F(WorkspaceTest, AssignmentTest) {
+    Workspace workspace;
+    PersistentVector<int> vector(workspace);
+    PersistentMap<int, int> map(workspace);
+    PersistentList<int> list(workspace);
+    vector.push_back(0, 1);
+
+    PersistentVector<int> otherVector;
+    otherVector.push_back(0, 2);
+    otherVector.push_back(1, 3);
+    PersistentMap<int, int> otherMap;
+    otherMap.insert(0, std::make_pair(1, 1));
+    PersistentList<int> otherList;
+    otherList.push_back(0, 1);
+
+    // another history would no longer match the workspace's numbering, in either direction
+    ASSERT_THROW(vector = otherVector, std::out_of_range*);
+    ASSERT_THROW(otherVector = vector, std::out_of_range*);
+    ASSERT_THROW(vector = std::move(otherVector), std::out_of_range*);
+    ASSERT_THROW(map = otherMap, std::out_of_range*);
+    ASSERT_THROW(otherMap = std::move(map), std::out_of_range*);
+    ASSERT_THROW(list = otherList, std::out_of_range*);
+    ASSERT_THROW(otherList = list, std::out_of_range*);
+
+    // the members are untouched and keep following the workspace
+    ASSERT_EQ(2, vector.versionsNumber());
+    ASSERT_EQ(1, vector.at(1, 0));
+    ASSERT_EQ(3, otherVector.versionsNumber());
+    list.push_back(1, 5);
+    ASSERT_EQ(3, workspace.versionsNumber());
+    ASSERT_EQ(3, vector.versionsNumber());
+    ASSERT_EQ(3, map.versionsNumber());
+    ASSERT_EQ(1, vector.at(2, 0));
+}